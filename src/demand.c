@@ -0,0 +1,437 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "demand.h"
+#include "reader.h"
+#include "lexer.h"
+#include "parser.h"
+#include "eval.h"
+#include "env.h"
+#include "symbol.h"
+
+/*
+ * A script only prints its last result, so only the last line with anything to evaluate (the
+ * target) and whatever it reads have to be evaluated. The whole script is parsed first, noting the
+ * name each line binds and the names it reads, and the lines the target needs are found from it.
+ *
+ * A name read on some line is bound by the last line before it that binds it, so that one's
+ * needed, and so are the ones before it in case it fails, back to one that can't (a number being
+ * assigned). What a needed line reads is needed in turn. A function's body reads its globals
+ * when it's called, not where it's defined, so the lines binding those are the ones before the
+ * call; and since defining a function needs its globals bound (and inlines the functions it
+ * calls), so are the ones before its definition. Each request for a name is therefore for where
+ * it's looked up and where a function it's bound to gets called, which is the same line unless
+ * the name was assigned a function.
+ *
+ * The needed lines are then evaluated in order, so each sees just what it would have in a full
+ * run. If the target doesn't have a result after all, an earlier line's gets printed, so the
+ * whole script is evaluated over again in a fresh env, the way it normally is, but for the lines
+ * that failed. A line that fails binds nothing, and it'd fail the same way again, reporting the
+ * same errors a second time. The needed lines that didn't fail report nothing when they're
+ * evaluated again, so every error is reported once.
+ */
+
+typedef struct {
+    ExprTree *tree;     /* NULL for a line with nothing to evaluate (blank, or it didn't parse) */
+    Symbol_t binds;     /* the name it assigns or defines, or -1 */
+    int certain;        /* whether it can't fail to bind that name, since it assigns a number */
+    int reads;          /* where the names it reads start in the script's reads */
+    int num_reads;
+    int needed;
+    int failed;         /* whether it was needed and reported an error when it was evaluated */
+} Line;
+
+typedef struct {
+    Symbol_t name;
+    int at;             /* the line the name's looked up on, which only the lines before it bind for */
+    int call;           /* the line a function bound to it is called on */
+} Request;
+
+typedef struct {
+    Line *lines;
+    int num_lines;
+    int lines_capacity;
+    Symbol_t *reads;
+    int num_reads;
+    int reads_capacity;
+    int *seen;          /* by name, the last line it was read on (or is a parameter of), or -1 */
+    int num_names;      /* names seen, i.e. the length of seen, first_binder and num_binders */
+    int *first_binder;  /* by name, where the lines binding it start in binders */
+    int *num_binders;
+    int *binders;       /* lines binding a name, grouped by name and in order within each group */
+    Request *requests;  /* still to be looked up */
+    int num_requests;
+    int requests_capacity;
+    unsigned long long *visited; /* each line and call it's been needed for, as a hash set */
+    unsigned int visited_capacity;
+    unsigned int num_visited;
+} Script;
+
+static void grow_names(Script *s, Symbol_t id) {
+    int old = s->num_names, i;
+
+    if (id < s->num_names) {
+        return;
+    }
+
+    while (s->num_names <= id) {
+        s->num_names = s->num_names == 0 ? 64 : s->num_names * 2;
+    }
+
+    s->seen = realloc(s->seen, s->num_names * sizeof(int));
+
+    for (i = old; i < s->num_names; i++) {
+        s->seen[i] = -1;
+    }
+}
+
+static void add_read(Script *s, Symbol_t id) {
+    int line = s->num_lines - 1;
+
+    grow_names(s, id);
+
+    if (s->seen[id] == line) {
+        return;
+    }
+
+    s->seen[id] = line;
+
+    if (s->num_reads == s->reads_capacity) {
+        s->reads_capacity = s->reads_capacity == 0 ? 256 : s->reads_capacity * 2;
+        s->reads = realloc(s->reads, s->reads_capacity * sizeof(Symbol_t));
+    }
+
+    s->reads[s->num_reads++] = id;
+    s->lines[line].num_reads++;
+}
+
+/* adds every name in the subtree rooted at node that isn't marked as seen on the current line */
+static void add_reads(Script *s, const ExprTree *tree, int node) {
+    int i;
+
+    for (i = node - tree->nodes[node].size + 1; i <= node; i++) {
+        if (tree->nodes[i].expr == ID) {
+            add_read(s, tree->nodes[i].value.id);
+        }
+    }
+}
+
+/* adds a line for tree, which may be NULL, noting what it binds and reads */
+static void add_line(Script *s, ExprTree *tree) {
+    Line *line;
+    int root, i;
+
+    if (s->num_lines == s->lines_capacity) {
+        s->lines_capacity = s->lines_capacity == 0 ? 256 : s->lines_capacity * 2;
+        s->lines = realloc(s->lines, s->lines_capacity * sizeof(Line));
+    }
+
+    line = &(s->lines[s->num_lines++]);
+    line->tree = tree;
+    line->binds = -1;
+    line->certain = 0;
+    line->reads = s->num_reads;
+    line->num_reads = 0;
+    line->needed = 0;
+    line->failed = 0;
+
+    if (tree == NULL) {
+        return;
+    }
+
+    root = expr_tree_root(tree);
+
+    switch (tree->nodes[root].expr) {
+        case Assign:
+            i = right_child(tree, root);
+            line->binds = tree->nodes[left_child(tree, root)].value.id;
+            line->certain = tree->nodes[i].expr == Int || tree->nodes[i].expr == Float;
+            add_reads(s, tree, i);
+            break;
+        case Fun:
+            line->binds = tree->nodes[root].value.id;
+
+            /* the parameters aren't globals, so they're marked seen to leave them out */
+            for (i = left_child(tree, root); i != NO_NODE; i = right_child(tree, i)) {
+                Symbol_t param = tree->nodes[left_child(tree, i)].value.id;
+
+                grow_names(s, param);
+                s->seen[param] = s->num_lines - 1;
+            }
+
+            add_reads(s, tree, right_child(tree, root));
+            break;
+        default:
+            add_reads(s, tree, root);
+            break;
+    }
+
+    if (line->binds != -1) {
+        grow_names(s, line->binds);
+    }
+}
+
+/* parses every line of the script, leaving out any that don't tokenize or parse */
+static void read_script(Script *s, int fd, const Env_t *env) {
+    LineReader *reader = open_reader(fd);
+    const char *text;
+    size_t length;
+
+    while ((text = next_line(reader, &length))) {
+        TokenList *tok_l;
+        ExprTree *tree = NULL;
+
+        errno = 0;
+        tok_l = tokenize(text, length);
+
+        if (errno == 0) {
+            tree = parse(tok_l);
+
+            if (errno != 0 || expr_tree_root(tree) == NO_NODE) {
+                free_expr_tree(tree);
+                tree = NULL;
+            } else if (env->share) {
+                share_subtrees(tree);
+            }
+        }
+
+        free_token_list(tok_l);
+        add_line(s, tree);
+    }
+
+    close_reader(reader);
+}
+
+/* groups the lines binding each name, in order, so the last before some line can be searched for */
+static void index_binders(Script *s) {
+    int i, total = 0;
+
+    s->first_binder = calloc(s->num_names + 1, sizeof(int));
+    s->num_binders = calloc(s->num_names + 1, sizeof(int));
+
+    for (i = 0; i < s->num_lines; i++) {
+        if (s->lines[i].binds != -1) {
+            s->num_binders[s->lines[i].binds]++;
+        }
+    }
+
+    for (i = 0; i < s->num_names; i++) {
+        s->first_binder[i] = total;
+        total += s->num_binders[i];
+        s->num_binders[i] = 0;
+    }
+
+    s->binders = malloc((total + 1) * sizeof(int));
+
+    for (i = 0; i < s->num_lines; i++) {
+        Symbol_t id = s->lines[i].binds;
+
+        if (id != -1) {
+            s->binders[s->first_binder[id] + s->num_binders[id]++] = i;
+        }
+    }
+}
+
+static void request(Script *s, Symbol_t name, int at, int call) {
+    if (s->num_requests == s->requests_capacity) {
+        s->requests_capacity = s->requests_capacity == 0 ? 256 : s->requests_capacity * 2;
+        s->requests = realloc(s->requests, s->requests_capacity * sizeof(Request));
+    }
+
+    s->requests[s->num_requests].name = name;
+    s->requests[s->num_requests].at = at;
+    s->requests[s->num_requests].call = call;
+    s->num_requests++;
+}
+
+/* returns 1 if line hadn't been needed for call before, marking it so, or 0 if it had */
+static int visit(Script *s, int line, int call) {
+    unsigned long long key = (unsigned long long) line * (s->num_lines + 1) + call + 1, *old = s->visited;
+    unsigned int capacity = s->visited_capacity, h, i;
+
+    if (2 * (s->num_visited + 1) > s->visited_capacity) {
+        s->visited_capacity = s->visited_capacity == 0 ? 256 : s->visited_capacity * 2;
+        s->visited = calloc(s->visited_capacity, sizeof(unsigned long long));
+        s->num_visited = 0;
+
+        for (i = 0; i < capacity; i++) {
+            if (old[i] != 0) {
+                visit(s, (old[i] - 1) / (s->num_lines + 1), (old[i] - 1) % (s->num_lines + 1));
+            }
+        }
+
+        free(old);
+    }
+
+    h = (unsigned int) ((key * 0x9E3779B97F4A7C15ull) >> 32) & (s->visited_capacity - 1);
+
+    while (s->visited[h] != 0) {
+        if (s->visited[h] == key) {
+            return 0;
+        }
+
+        h = (h + 1) & (s->visited_capacity - 1);
+    }
+
+    s->visited[h] = key;
+    s->num_visited++;
+    return 1;
+}
+
+/* needs line b for a call on line call, and so whatever it reads */
+static void need_line(Script *s, int b, int call) {
+    const Line *line = &(s->lines[b]);
+    int is_fun = line->tree->nodes[expr_tree_root(line->tree)].expr == Fun, i;
+
+    if (!visit(s, b, call)) {
+        return;
+    }
+
+    s->lines[b].needed = 1;
+
+    for (i = line->reads; i < line->reads + line->num_reads; i++) {
+        request(s, s->reads[i], b, b);
+        request(s, s->reads[i], is_fun ? call : b, call);
+    }
+}
+
+/* needs the lines binding name before line at, back to one sure to bind it */
+static void resolve(Script *s, Request r) {
+    const int *binders;
+    int low = 0, high, k;
+
+    if (r.name >= s->num_names) {
+        return;
+    }
+
+    binders = &(s->binders[s->first_binder[r.name]]);
+    high = s->num_binders[r.name];
+
+    /* finds how many of them come before line at */
+    while (low < high) {
+        int mid = (low + high) / 2;
+
+        if (binders[mid] < r.at) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    for (k = low - 1; k >= 0; k--) {
+        need_line(s, binders[k], r.call);
+
+        if (s->lines[binders[k]].certain) {
+            break;
+        }
+    }
+}
+
+/* evaluates tree, returning what to print for it or NULL if there was an error */
+static char *eval_tree(const ExprTree *tree, Env_t *env) {
+    ExprTree *value;
+    char *result = NULL;
+
+    errno = 0;
+    value = eval(tree, env);
+
+    if (errno == 0) {
+        result = eval_result_to_str(value);
+    }
+
+    free_expr_tree(value);
+    return result;
+}
+
+/*
+ * Evaluates every line but those that failed on demand in a fresh env like env, returning the last
+ * result there was. Rewrites are only reported for the lines that weren't already evaluated.
+ */
+static char *eval_all(const Script *s, const Env_t *env) {
+    Env_t *fresh = init_env();
+    char *result, *last = NULL;
+    int i;
+
+    fresh->jit = env->jit;
+    fresh->opt_level = env->opt_level;
+    fresh->memos = env->memos;
+    fresh->share = env->share;
+    fresh->version = env->version; /* memos check names against it, and must see them all change */
+
+    for (i = 0; i < s->num_lines; i++) {
+        if (s->lines[i].tree == NULL || s->lines[i].failed) {
+            continue;
+        }
+
+        fresh->opt_verbose = env->opt_verbose && !s->lines[i].needed;
+        result = eval_tree(s->lines[i].tree, fresh);
+
+        if (result != NULL && strcmp(result, "") != 0) {
+            free(last);
+            last = result;
+        } else {
+            free(result);
+        }
+    }
+
+    free_env(fresh);
+    return last;
+}
+
+/*
+ * Evaluates the script read from fd in env, only as far as what it prints needs, and returns
+ * what that is (the last result a full run would have), or NULL if there's nothing to print.
+ * Only the lines evaluated report their errors, and env is left as they leave it.
+ */
+char *eval_on_demand(int fd, Env_t *env) {
+    Script s = {0};
+    char *result = NULL;
+    int target, i;
+
+    read_script(&s, fd, env);
+    index_binders(&s);
+    target = s.num_lines - 1;
+
+    while (target >= 0 && s.lines[target].tree == NULL) {
+        target--;
+    }
+
+    if (target >= 0) {
+        need_line(&s, target, target);
+
+        while (s.num_requests > 0) {
+            resolve(&s, s.requests[--s.num_requests]);
+        }
+
+        for (i = 0; i < target; i++) {
+            if (s.lines[i].needed) {
+                free(eval_tree(s.lines[i].tree, env));
+                s.lines[i].failed = errno != 0;
+            }
+        }
+
+        result = eval_tree(s.lines[target].tree, env);
+        s.lines[target].needed = 1;
+        s.lines[target].failed = errno != 0;
+
+        if (result == NULL || strcmp(result, "") == 0) {
+            free(result);
+            result = eval_all(&s, env);
+        }
+    }
+
+    for (i = 0; i < s.num_lines; i++) {
+        free_expr_tree(s.lines[i].tree);
+    }
+
+    free(s.lines);
+    free(s.reads);
+    free(s.seen);
+    free(s.first_binder);
+    free(s.num_binders);
+    free(s.binders);
+    free(s.requests);
+    free(s.visited);
+
+    return result;
+}
@@ -0,0 +1,8 @@
+#ifndef Demand_h
+#define Demand_h
+
+#include "env.h"
+
+char *eval_on_demand(int fd, Env_t *env);
+
+#endif
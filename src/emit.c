@@ -0,0 +1,525 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <err.h>
+#include "emit.h"
+#include "reader.h"
+#include "lexer.h"
+#include "parser.h"
+#include "eval.h"
+#include "vm.h"
+#include "env.h"
+#include "symbol.h"
+
+/*
+ * What every emitted program starts with: values, globals, and the arithmetic of compute_binop with
+ * the checks of check_int_limits, as small static functions the C compiler can inline into each
+ * operation. Kept as lines since ISO C limits how long a single string literal can be.
+ */
+static const char *prelude[] = {
+    "/* generated by mint --emit-c */",
+    "#include <stdio.h>",
+    "#include <stdlib.h>",
+    "#include <string.h>",
+    "#include <limits.h>",
+    "#include <math.h>",
+    "#include <err.h>",
+    "",
+    "typedef struct num Num;",
+    "",
+    "struct num {",
+    "    enum { INT, FLOAT, FUN } type;",
+    "    long i;",
+    "    double d;",
+    "    int (*fun)(const Num *args, Num *result);",
+    "    int arity;",
+    "};",
+    "",
+    "typedef struct {",
+    "    int bound;",
+    "    Num value;",
+    "} Global;",
+    "",
+    "static char *last; /* what the last line to have a value printed as, since only that one is printed */",
+    "",
+    "static Num int_num(long i) {",
+    "    Num n = {INT, 0, 0.0, NULL, 0};",
+    "",
+    "    n.i = i;",
+    "    return n;",
+    "}",
+    "",
+    "static Num float_num(double d) {",
+    "    Num n = {FLOAT, 0, 0.0, NULL, 0};",
+    "",
+    "    n.d = d;",
+    "    return n;",
+    "}",
+    "",
+    "static int load(const Global *g, const char *name, Num *v) {",
+    "    if (!g->bound) {",
+    "        warnx(\"error: (E7001) unbound identifier: %s\", name);",
+    "        return -1;",
+    "    }",
+    "",
+    "    *v = g->value;",
+    "    return 0;",
+    "}",
+    "",
+    "static void assign(Global *g, Num v) {",
+    "    g->bound = 1;",
+    "    g->value = v;",
+    "}",
+    "",
+    "static void define(Global *g, int (*fun)(const Num *, Num *), int arity) {",
+    "    Num v = {FUN, 0, 0.0, NULL, 0};",
+    "",
+    "    v.fun = fun;",
+    "    v.arity = arity;",
+    "    assign(g, v);",
+    "}",
+    "",
+    "/* mint's check_int_limits, down to how it takes absolute values: 1 for overflow, 2 for underflow */",
+    "static int int_limits(long v1, long v2, char op) {",
+    "    switch (op) {",
+    "        case '+':",
+    "            if (v1 > 0 && v2 > 0 && v1 > LONG_MAX - v2) return 1;",
+    "            if (v1 < 0 && v2 < 0 && v1 < LONG_MIN - v2) return 2;",
+    "            return 0;",
+    "        case '-':",
+    "            if (v1 > 0 && v2 < 0 && v1 > LONG_MAX + v2) return 1;",
+    "            if (v1 < 0 && v2 > 0 && v1 < LONG_MIN + v2) return 2;",
+    "            return 0;",
+    "        case '*': {",
+    "            int same_sign = (v1 > 0 && v2 > 0) || (v1 < 0 && v2 < 0);",
+    "",
+    "            if (v2 == 0) return 0;",
+    "            v1 = v1 >= 0 ? v1 : (long) (0UL - (unsigned long) v1);",
+    "            v2 = v2 >= 0 ? v2 : (long) (0UL - (unsigned long) v2);",
+    "            if (same_sign && v1 > LONG_MAX / v2) return 1;",
+    "            if (!same_sign && (long) (0UL - (unsigned long) v1) < LONG_MIN / v2) return 2;",
+    "            return 0;",
+    "        }",
+    "        case '^':",
+    "            if (v1 > 0 && v2 > 0 && v1 >= pow(LONG_MAX, 1.0 / v2)) return 1;",
+    "            return 0;",
+    "        default:",
+    "            return 0;",
+    "    }",
+    "}",
+    "",
+    "/* a = a op b, promoting to float the way mint's eval_binop does */",
+    "static int binop(char op, Num *a, Num b) {",
+    "    int is_float = a->type == FLOAT || b.type == FLOAT, limits;",
+    "    long i1 = a->i, i2 = b.i;",
+    "    double d1 = a->type == INT ? (double) i1 : a->d, d2 = b.type == INT ? (double) i2 : b.d;",
+    "",
+    "    if (a->type == FUN || b.type == FUN) {",
+    "        warnx(\"error: (E8003) a function can't be used as a number\");",
+    "        return -1;",
+    "    }",
+    "",
+    "    limits = is_float ? 0 : int_limits(i1, i2, op);",
+    "",
+    "    if (limits == 1) {",
+    "        warnx(\"error: (E7004) integer overflow detected\");",
+    "        return -1;",
+    "    } else if (limits == 2) {",
+    "        warnx(\"error: (E7006) integer underflow detected\");",
+    "        return -1;",
+    "    }",
+    "",
+    "    switch (op) {",
+    "        case '+':",
+    "            *a = is_float ? float_num(d1 + d2) : int_num(i1 + i2);",
+    "            return 0;",
+    "        case '-':",
+    "            *a = is_float ? float_num(d1 - d2) : int_num(i1 - i2);",
+    "            return 0;",
+    "        case '*':",
+    "            *a = is_float ? float_num(d1 * d2) : int_num(i1 * i2);",
+    "            return 0;",
+    "        case '/':",
+    "            if (is_float ? d2 == 0 : i2 == 0) {",
+    "                warnx(\"error: (E7007) division by 0\");",
+    "                return -1;",
+    "            }",
+    "",
+    "            *a = is_float || i1 % i2 != 0 ? float_num(d1 / d2) : int_num(i1 / i2);",
+    "            return 0;",
+    "        default:",
+    "            /* negative exponent can cause expr to evaluate to float */",
+    "            *a = is_float || d2 < 0 ? float_num(pow(d1, d2)) : int_num((long) pow(d1, d2));",
+    "            return 0;",
+    "    }",
+    "}",
+    "",
+    "/* calls the function in callee on the arguments after it, replacing it with the result */",
+    "static int call(Num *callee, const Num *args, int num_args, const char *name) {",
+    "    int arity = callee->type == FUN ? callee->arity : 0;",
+    "",
+    "    if (num_args != arity) {",
+    "        warnx(\"error: (E7008) in application of %s, received %d arguments but expected %d\", name,",
+    "              num_args, arity);",
+    "        return -1;",
+    "    } else if (callee->type != FUN) {",
+    "        warnx(\"error: (E8003) %s isn't a function\", name);",
+    "        return -1;",
+    "    }",
+    "",
+    "    return callee->fun(args, callee);",
+    "}",
+    "",
+    "static void keep_text(const char *text) {",
+    "    free(last);",
+    "    last = malloc(strlen(text) + 1);",
+    "    strcpy(last, text);",
+    "}",
+    "",
+    "/* keeps v as the value to print, after name and a colon for an assignment */",
+    "static void keep(const char *name, Num v) {",
+    "    char *p;",
+    "",
+    "    free(last);",
+    "    last = malloc((name != NULL ? strlen(name) + 2 : 0) + snprintf(NULL, 0, \"%f\", v.d) + 32);",
+    "    p = last + (name != NULL ? sprintf(last, \"%s: \", name) : 0);",
+    "",
+    "    if (v.type == INT) {",
+    "        sprintf(p, \"%ld\", v.i);",
+    "    } else {",
+    "        sprintf(p, \"%f\", v.d);",
+    "    }",
+    "}",
+    NULL
+};
+
+typedef struct {
+    char *str;
+    size_t length;
+    size_t capacity;
+} Buf;
+
+typedef struct {
+    Buf code;        /* a C function per mint function and per line */
+    Buf main;        /* main's body, a statement or two per line */
+    char *used;      /* whether each symbol needs a global, indexed by symbol */
+    int num_symbols; /* how many symbols used has room for */
+} Emitter;
+
+static void append(Buf *buf, const char *fmt, ...) {
+    va_list args;
+    int length;
+
+    va_start(args, fmt);
+    length = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    if (buf->length + length + 1 > buf->capacity) {
+        while (buf->length + length + 1 > buf->capacity) {
+            buf->capacity = buf->capacity == 0 ? 4096 : buf->capacity * 2;
+        }
+
+        buf->str = realloc(buf->str, buf->capacity);
+    }
+
+    va_start(args, fmt);
+    vsprintf(buf->str + buf->length, fmt, args);
+    va_end(args);
+
+    buf->length += length;
+}
+
+/* notes that id needs a global, and returns its name */
+static const char *use(Emitter *e, Symbol_t id) {
+    if (id >= e->num_symbols) {
+        int old = e->num_symbols;
+
+        e->num_symbols = 2 * (id + 1);
+        e->used = realloc(e->used, e->num_symbols);
+        memset(e->used + old, 0, e->num_symbols - old);
+    }
+
+    e->used[id] = 1;
+    return symbol_name(id);
+}
+
+/* a C literal for a number exactly as mint holds it */
+static void append_int(Buf *buf, long int i) {
+    if (i == LONG_MIN) {
+        append(buf, "(-%ldL - 1)", LONG_MAX);
+    } else {
+        append(buf, "%ldL", i);
+    }
+}
+
+static void append_float(Buf *buf, double d) {
+    if (isnan(d)) {
+        append(buf, "NAN");
+    } else if (isinf(d)) {
+        append(buf, d > 0 ? "HUGE_VAL" : "-HUGE_VAL");
+    } else {
+        append(buf, "%a", d);
+    }
+}
+
+/*
+ * Translates a chunk to the statements of a C function, one or two per instruction. The depth of
+ * the stack is known at every instruction, so its values go in a local array at fixed indices,
+ * which the C compiler is free to keep in registers. params holds the names of the parameters (for
+ * error messages), whose values are in args.
+ */
+static void emit_code(Emitter *e, const Chunk *chunk, const Symbol_t *params) {
+    const Symbol_t no_name = -1;
+    Symbol_t *names = malloc((chunk->max_stack + 1) * sizeof(Symbol_t)); /* what pushed each value */
+    const Word *w;
+    int depth = 0;
+
+    append(&(e->code), "    Num s[%d];\n\n", chunk->max_stack);
+
+    for (w = chunk->code; w < chunk->code + chunk->length; w++) {
+        switch (w->op) {
+            case OP_INT:
+                append(&(e->code), "    s[%d] = int_num(", depth);
+                append_int(&(e->code), (++w)->i);
+                append(&(e->code), ");\n");
+                names[depth++] = no_name;
+                break;
+            case OP_FLOAT:
+                append(&(e->code), "    s[%d] = float_num(", depth);
+                append_float(&(e->code), (++w)->d);
+                append(&(e->code), ");\n");
+                names[depth++] = no_name;
+                break;
+            case OP_LOCAL:
+                append(&(e->code), "    s[%d] = args[%d];\n", depth, (++w)->arg);
+                names[depth++] = params[w->arg];
+                break;
+            case OP_GLOBAL: {
+                Symbol_t id = chunk->globals[(++w)->arg].id;
+                const char *name = use(e, id);
+
+                append(&(e->code), "    if (load(&g_%s, \"%s\", &s[%d]) != 0) return -1;\n", name, name, depth);
+                names[depth++] = id;
+                break;
+            }
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MULT:
+            case OP_DIV:
+            case OP_EXP:
+                append(&(e->code), "    if (binop('%c', &s[%d], s[%d]) != 0) return -1;\n",
+                       "+-*/^"[w->op - OP_ADD], depth - 2, depth - 1);
+                names[--depth - 1] = no_name;
+                break;
+            case OP_CALL: {
+                int num_args = (++w)->arg;
+
+                depth -= num_args;
+                append(&(e->code), "    if (call(&s[%d], &s[%d], %d, \"%s\") != 0) return -1;\n", depth - 1,
+                       depth, num_args, names[depth - 1] != no_name ? symbol_name(names[depth - 1]) : "?");
+                names[depth - 1] = no_name;
+                break;
+            }
+            case OP_RETURN:
+                append(&(e->code), "    *result = s[%d];\n    return 0;\n", depth - 1);
+                break;
+            default:
+                /* the specialized operations are only ever in the VM's versions of the code */
+                break;
+        }
+    }
+
+    free(names);
+}
+
+/* a body for the top level expression rooted at node, compiled as if it were a function's */
+static Chunk *compile_line(const ExprTree *tree, int node) {
+    ExprTree *wrapper = new_expr_tree(tree->nodes[node].size + 1);
+    int body = copy_subtree(wrapper, tree, node);
+    Chunk *chunk = compile_fun(wrapper, push_node(wrapper, Fun, NO_NODE, body));
+
+    free_expr_tree(wrapper);
+    return chunk;
+}
+
+static int emit_fun(Emitter *e, const ExprTree *fun, const char *text, int line_num) {
+    int root = expr_tree_root(fun), params = left_child(fun, root), num_params = 0;
+    const char *name = use(e, fun->nodes[root].value.id);
+    Symbol_t *names;
+
+    if (fun->code == NULL) {
+        errno = EINVAL;
+        warnx("error: (E8002) line %d can't be compiled to C", line_num);
+        return -1;
+    }
+
+    names = malloc((fun->code->num_params + 1) * sizeof(Symbol_t));
+
+    for (; params != NO_NODE && num_params < fun->code->num_params; params = right_child(fun, params)) {
+        names[num_params++] = fun->nodes[left_child(fun, params)].value.id;
+    }
+
+    append(&(e->code), "/* %s */\nstatic int line_%d(const Num *args, Num *result) {\n", text, line_num);
+    emit_code(e, fun->code, names);
+    append(&(e->code), "}\n\n");
+    free(names);
+
+    append(&(e->main), "    define(&g_%s, line_%d, %d);\n", name, line_num, fun->code->num_params);
+    append(&(e->main), "    keep_text(\"%s\");\n", text);
+
+    return 0;
+}
+
+/* an assignment or any other expression, as a function main calls for its value */
+static int emit_line(Emitter *e, const ExprTree *tree, int line_num) {
+    int root = expr_tree_root(tree), is_assign = tree->nodes[root].expr == Assign;
+    Chunk *chunk = compile_line(tree, is_assign ? right_child(tree, root) : root);
+
+    if (chunk == NULL) {
+        errno = EINVAL;
+        warnx("error: (E8002) line %d can't be compiled to C", line_num);
+        return -1;
+    }
+
+    append(&(e->code), "static int line_%d(const Num *args, Num *result) {\n", line_num);
+    emit_code(e, chunk, NULL);
+    append(&(e->code), "}\n\n");
+    free(chunk);
+
+    append(&(e->main), "    if (line_%d(NULL, &v) == 0) {\n", line_num);
+
+    if (is_assign) {
+        const char *name = use(e, tree->nodes[left_child(tree, root)].value.id);
+
+        append(&(e->main), "        assign(&g_%s, v);\n        keep(\"%s\", v);\n", name, name);
+    } else {
+        append(&(e->main), "        keep(NULL, v);\n");
+    }
+
+    append(&(e->main), "    }\n");
+
+    return 0;
+}
+
+static int is_number_value(const ExprTree *value) {
+    int root = expr_tree_root(value);
+    const ExprNode *n;
+
+    if (root == NO_NODE) {
+        return 0;
+    }
+
+    n = &(value->nodes[root]);
+
+    if (n->expr == Assign) {
+        n = &(value->nodes[right_child(value, root)]);
+    }
+
+    return n->expr == Int || n->expr == Float;
+}
+
+/*
+ * Translates the script read from fd into a C program that prints what mint -f would, and writes
+ * it to out. Each function definition becomes a C function and each other line a C function that
+ * main calls in order, all translated from the same bytecode the VM runs, so numbers, promotion to
+ * float, overflow checks and errors all behave the way they do in mint.
+ *
+ * The script is also evaluated in env as it's read, since that's what resolves a function's
+ * parameters and folds its body, and it tells which lines can be compiled at all. Lines that fail
+ * to parse or evaluate are left out, their errors reported here instead of by the program.
+ * A line whose value isn't a number (e.g. a function, or a symbolic expression) has no C
+ * equivalent, and nothing is written if there's one. Returns 0 on success or -1 (with errno set).
+ *
+ * Calls aren't inlined, however much env optimizes. Each function is written once, from the
+ * bytecode it's defined with, and a function with another's body inlined into it is defined over
+ * when that one is, which the program would never see.
+ */
+int emit_c(int fd, Env_t *env, FILE *out) {
+    LineReader *reader = open_reader(fd);
+    Emitter e = {{0}};
+    const char *line, **p;
+    size_t length;
+    int line_num = 0, failed = 0, i;
+
+    env->no_inlining = 1;
+
+    while (!failed && (line = next_line(reader, &length))) {
+        TokenList *tok_l;
+        ExprTree *tree, *value;
+        int root, ok;
+        char *text;
+
+        line_num++;
+        errno = 0;
+        tok_l = tokenize(line, length);
+
+        if (errno != 0) {
+            free_token_list(tok_l);
+            continue;
+        }
+
+        tree = parse(tok_l);
+        root = expr_tree_root(tree);
+
+        if (errno != 0 || root == NO_NODE) {
+            free_token_list(tok_l);
+            free_expr_tree(tree);
+            continue;
+        }
+
+        value = eval(tree, env);
+        ok = errno == 0;
+        text = eval_result_to_str(value);
+
+        if (!ok) {
+            /* left out, like it's left out of what mint prints, its error having been reported */
+        } else if (tree->nodes[root].expr == Fun) {
+            failed = emit_fun(&e, env_find(env, tree->nodes[root].value.id)->data, text, line_num) != 0;
+        } else if (!is_number_value(value)) {
+            errno = EINVAL;
+            warnx("error: (E8001) line %d can't be compiled to C, since its value isn't a number: %s",
+                  line_num, text);
+            failed = 1;
+        } else {
+            failed = emit_line(&e, tree, line_num) != 0;
+        }
+
+        free(text);
+        free_expr_tree(value);
+        free_expr_tree(tree);
+        free_token_list(tok_l);
+    }
+
+    close_reader(reader);
+
+    if (!failed) {
+        for (p = prelude; *p != NULL; p++) {
+            fprintf(out, "%s\n", *p);
+        }
+
+        fprintf(out, "\n");
+
+        for (i = 0; i < e.num_symbols; i++) {
+            if (e.used[i]) {
+                fprintf(out, "static Global g_%s;\n", symbol_name(i));
+            }
+        }
+
+        fprintf(out, "\n%s", e.code.length > 0 ? e.code.str : "");
+        fprintf(out, "int main(void) {\n    Num v;\n\n    (void) v;\n");
+        fprintf(out, "%s", e.main.length > 0 ? e.main.str : "");
+        fprintf(out, "\n    if (last != NULL) {\n        printf(\"%%s\\n\", last);\n    }\n\n");
+        fprintf(out, "    free(last);\n    return 0;\n}\n");
+    }
+
+    free(e.code.str);
+    free(e.main.str);
+    free(e.used);
+
+    errno = failed ? EINVAL : 0;
+    return failed ? -1 : 0;
+}
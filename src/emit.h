@@ -0,0 +1,9 @@
+#ifndef Emit_h
+#define Emit_h
+
+#include <stdio.h>
+#include "env.h"
+
+int emit_c(int fd, Env_t *env, FILE *out);
+
+#endif
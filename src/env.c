@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include "env.h"
+#include "parser.h"
+#include "symbol.h"
+
+#define INITIAL_SLOTS 64    /* must be a power of 2 */
+#define INITIAL_BINDINGS 32
+#define INITIAL_STACK 256
+
+/*
+ * A bound value is never changed, only replaced, so bindings can share one tree. Binding a value
+ * that's already some binding's shares it (e.g. y = x, or f(x) binding a parameter to x's value)
+ * and anything else gets copied into a tree of its own. Trees are freed when the last binding
+ * holding them goes.
+ */
+static ExprTree *share_value(const ExprTree *src, int node) {
+    ExprTree *value;
+
+    if (src->refs > 0 && node == expr_tree_root(src)) {
+        value = (ExprTree *) src; /* only refs changes, which isn't part of the value */
+    } else {
+        value = new_expr_tree(src->nodes[node].size);
+        copy_subtree(value, src, node);
+    }
+
+    value->refs++;
+    return value;
+}
+
+static void release_value(ExprTree *value) {
+    if (--value->refs == 0) {
+        free_expr_tree(value);
+    }
+}
+
+Env_t *init_env() {
+    return calloc(1, sizeof(Env_t));
+}
+
+void free_env(Env_t *env) {
+    int i;
+
+    if (env == NULL) {
+        return;
+    }
+
+    for (i = 0; i < env->num_bindings; i++) {
+        release_value(env->bindings[i].data);
+    }
+
+    for (i = 0; i < env->num_inlinings; i++) {
+        free_expr_tree(env->inlinings[i].source);
+        free(env->inlinings[i].callees);
+    }
+
+    free(env->inlinings);
+
+    free(env->bindings);
+    free(env->slots);
+    free(env->stack);
+    free(env);
+}
+
+/*
+ * Open addressing with linear probing, kept at most half full. Symbols are already small distinct
+ * integers handed out in order, so they index the table directly (modulo its size) without
+ * hashing. An id keeps its slot after its last binding is dropped, since it's likely to be bound
+ * again (e.g. a parameter name) and leaving it saves having to handle deletion.
+ */
+static EnvSlot *find_slot(const Env_t *env, Symbol_t id) {
+    unsigned int mask = env->num_slots - 1;
+    unsigned int slot = (unsigned int) id & mask;
+
+    while (env->slots[slot].id != -1 && env->slots[slot].id != id) {
+        slot = (slot + 1) & mask;
+    }
+
+    return &(env->slots[slot]);
+}
+
+static void grow_slots(Env_t *env) {
+    EnvSlot *old_slots = env->slots;
+    unsigned int i, old_num_slots = env->num_slots;
+
+    env->num_slots = old_num_slots == 0 ? INITIAL_SLOTS : old_num_slots * 2;
+    env->slots = malloc(env->num_slots * sizeof(EnvSlot));
+
+    for (i = 0; i < env->num_slots; i++) {
+        env->slots[i].id = -1;
+        env->slots[i].newest = -1;
+        env->slots[i].changed = 0;
+    }
+
+    for (i = 0; i < old_num_slots; i++) {
+        if (old_slots[i].id != -1) {
+            *find_slot(env, old_slots[i].id) = old_slots[i];
+        }
+    }
+
+    free(old_slots);
+}
+
+/* binds id to the subtree of src rooted at node, shadowing any binding id already has */
+void extend_env(Env_t *env, Symbol_t id, const ExprTree *src, int node) {
+    EnvSlot *slot;
+    Binding *binding;
+
+    if (errno != 0) {
+        return;
+    }
+
+    if (2 * (env->num_ids + 1) > env->num_slots) {
+        grow_slots(env);
+    }
+
+    if (env->num_bindings == env->capacity) {
+        env->capacity = env->capacity == 0 ? INITIAL_BINDINGS : env->capacity * 2;
+        env->bindings = realloc(env->bindings, env->capacity * sizeof(Binding));
+    }
+
+    slot = find_slot(env, id);
+
+    if (slot->id == -1) {
+        slot->id = id;
+        env->num_ids++;
+    }
+
+    binding = &(env->bindings[env->num_bindings]);
+    binding->id = id;
+    binding->data = share_value(src, node);
+    binding->shadowed = slot->newest;
+
+    slot->newest = env->num_bindings++;
+    slot->changed = ++env->version;
+}
+
+/* rebinds the newest binding of id, which has to exist. The new value may be in the old one. */
+void update_env(Env_t *env, Symbol_t id, const ExprTree *src, int node) {
+    Binding *binding = env_find(env, id);
+    ExprTree *old_value;
+
+    if (errno != 0) {
+        return;
+    }
+
+    old_value = binding->data;
+    binding->data = share_value(src, node);
+    release_value(old_value);
+    find_slot(env, id)->changed = ++env->version;
+}
+
+/* drops the newest bindings until only num_bindings are left, uncovering what they shadowed */
+void shrink_env(Env_t *env, int num_bindings) {
+    while (env->num_bindings > num_bindings) {
+        Binding *binding = &(env->bindings[--env->num_bindings]);
+
+        EnvSlot *slot = find_slot(env, binding->id);
+
+        slot->newest = binding->shadowed;
+        slot->changed = ++env->version;
+        release_value(binding->data);
+    }
+}
+
+/*
+ * Returns the newest binding of id, or NULL if it's unbound. The pointer is only good until the
+ * environment is next extended.
+ */
+Binding *env_find(Env_t *env, Symbol_t id) {
+    EnvSlot *slot;
+
+    if (env->num_slots == 0) {
+        return NULL;
+    }
+
+    slot = find_slot(env, id);
+
+    return slot->newest != -1 ? &(env->bindings[slot->newest]) : NULL;
+}
+
+/* the env's version when id's bindings last changed, 0 if it's never been bound */
+unsigned long env_changed(Env_t *env, Symbol_t id) {
+    return env->num_slots == 0 ? 0 : find_slot(env, id)->changed;
+}
+
+/* same as env_find, but it's an error for id to be unbound */
+Binding *lookup(Env_t *env, Symbol_t id) {
+    Binding *binding = env_find(env, id);
+
+    if (binding == NULL) {
+        errno = EINVAL;
+        warnx("error: (E7001) unbound identifier: %s", symbol_name(id));
+    }
+
+    return binding;
+}
+
+/*
+ * Reserves a frame of num_slots argument values on top of the stack and returns where it starts.
+ * It doesn't become env->frame yet, since a call's arguments are evaluated in its caller's frame.
+ */
+int push_frame(Env_t *env, int num_slots) {
+    int frame = env->stack_length;
+
+    if (env->stack_length + num_slots > env->stack_capacity) {
+        while (env->stack_length + num_slots > env->stack_capacity) {
+            env->stack_capacity = env->stack_capacity == 0 ? INITIAL_STACK : env->stack_capacity * 2;
+        }
+
+        env->stack = realloc(env->stack, env->stack_capacity * sizeof(Value));
+    }
+
+    env->stack_length += num_slots;
+
+    return frame;
+}
+
+/* drops the frame starting at frame, along with any above it */
+void pop_frame(Env_t *env, int frame) {
+    env->stack_length = frame;
+}
+
+/* lists every binding newest first, including shadowed ones */
+char *env_to_str(Env_t *env) {
+    char **data_strs = malloc((env->num_bindings + 1) * sizeof(char *));
+    char *str, *p;
+    int i, total_len = 0;
+
+    for (i = env->num_bindings - 1; i >= 0; i--) {
+        data_strs[i] = expr_tree_to_str(env->bindings[i].data);
+
+        /* the + 7 is for parens, colon, spaces, and a comma */
+        total_len += symbol_length(env->bindings[i].id) + strlen(data_strs[i]) + 7;
+    }
+
+    /* the + 3 at the end is for brackets and null char */
+    str = malloc(total_len + 3);
+    p = str;
+
+    *p++ = '[';
+    for (i = env->num_bindings - 1; i >= 0; i--) {
+        p += sprintf(p, "%s(%s : %s)", i < env->num_bindings - 1 ? ", " : "",
+                     symbol_name(env->bindings[i].id), data_strs[i]);
+        free(data_strs[i]);
+    }
+    strcpy(p, "]");
+
+    free(data_strs);
+
+    return str;
+}
@@ -0,0 +1,98 @@
+#ifndef Env_h
+#define Env_h
+
+#include "parser.h"
+#include "symbol.h"
+
+typedef enum {
+    INT_VALUE,
+    FLOAT_VALUE,
+    NODE_VALUE
+} Value_t;
+
+/*
+ * What evaluating something gives. Numbers are held unboxed rather than in a tree node, and
+ * anything else (e.g. a function, or a symbolic expression) is a reference to the node it's rooted
+ * at in some tree, with NO_NODE for no value. At 16 bytes it's passed and returned in registers.
+ */
+typedef struct {
+    Value_t type;
+    int node; /* the referenced node of a NODE_VALUE */
+    union {
+        const ExprTree *tree;
+        long int i;
+        double d;
+    } as;
+} Value;
+
+typedef struct {
+    Symbol_t id;
+    ExprTree *data; /* may be shared with other bindings */
+    int shadowed;   /* index of the binding of id this one shadows, or -1 */
+} Binding;
+
+typedef struct {
+    Symbol_t id;           /* -1 for a slot no id has been put in */
+    int newest;            /* index of id's newest binding, or -1 once it has none */
+    unsigned long changed; /* the env's version when id was last bound, rebound or unbound */
+} EnvSlot;
+
+/*
+ * A function whose definition had the bodies of others inlined into it (see optimize.c), so it's
+ * defined over whenever one of them is.
+ */
+typedef struct {
+    Symbol_t fun;
+    ExprTree *source;   /* fun's definition before anything was inlined into it */
+    Symbol_t *callees;  /* the functions that were */
+    int num_callees;
+} Inlining;
+
+/*
+ * Bindings are kept on a stack, oldest first, so a scope is dropped by cutting the stack back to
+ * where it started. Each id's newest binding is found through an open addressing hash table, and
+ * every binding remembers the one it shadows, so lookups are O(1) however many bindings there are
+ * and popping a scope uncovers what it shadowed.
+ *
+ * Function arguments don't go through bindings at all. A function's parameters are resolved to
+ * slots when it's defined, and each call gets a frame of that many slots on the value stack, which
+ * only grows, so calls don't allocate once it's big enough.
+ */
+typedef struct env {
+    Binding *bindings;
+    int num_bindings;
+    int capacity;
+    EnvSlot *slots;
+    unsigned int num_slots;
+    int num_ids;
+    Value *stack;       /* argument values of every call in progress, innermost last */
+    int stack_length;
+    int stack_capacity;
+    int frame;          /* where the innermost call's frame starts in stack */
+    unsigned long version; /* bumped whenever a binding changes (see env_changed) */
+    struct jit *jit;    /* compiles hot functions to machine code when set (see jit.c), owned by the caller */
+    int opt_level;      /* how much function bodies are optimized when defined (see optimize.c), 0 for not at all */
+    int opt_verbose;    /* whether every rewrite the optimizer makes is reported */
+    int no_inlining;    /* whether calls are left alone however much bodies are optimized */
+    Inlining *inlinings; /* every function bound with others inlined into it */
+    int num_inlinings;
+    int inlinings_capacity;
+    struct memo *memos; /* caches of the results of calls to some functions (see memo.c), owned by the caller */
+    int share;          /* whether repeats in a line are shared and evaluated once (see share_subtrees) */
+    const ExprTree *memo_tree; /* the tree being evaluated, while it has Shared nodes */
+    Value *memo;        /* the numbers its nodes have evaluated to so far, by node */
+} Env_t;
+
+Env_t *init_env();
+void free_env(Env_t *env);
+void extend_env(Env_t *env, Symbol_t id, const ExprTree *src, int node);
+void update_env(Env_t *env, Symbol_t id, const ExprTree *src, int node);
+void shrink_env(Env_t *env, int num_bindings);
+Binding *env_find(Env_t *env, Symbol_t id);
+Binding *lookup(Env_t *env, Symbol_t id);
+unsigned long env_changed(Env_t *env, Symbol_t id);
+int push_frame(Env_t *env, int num_slots);
+void pop_frame(Env_t *env, int frame);
+char *env_to_str(Env_t *env);
+
+#endif
@@ -6,295 +6,276 @@
 #include <math.h>
 #include <limits.h>
 #include "eval.h"
+#include "env.h"
 #include "parser.h"
+#include "vm.h"
+#include "optimize.h"
+#include "memo.h"
 
 #define MAX_PARAMS 50       /* arbitrary upper limit on how many params a function can have */
 #define MAX_NODE_VAL_LEN 50 /* arbitrary upper limit on value length for a node in chars (i.e. an ID or float) */
 
-Env_t *init_env() {
-    return calloc(1, sizeof(Env_t));
-}
-
-static ExprTree *copy_expr_tree(ExprTree *tree) {
-    ExprTree *copy, *left_copy, *right_copy;
-
-    if (tree == NULL) {
-        return NULL;
-    }
-
-    left_copy = copy_expr_tree(tree->left);
-    right_copy = copy_expr_tree(tree->right);
+static const Value NO_VALUE = {NODE_VALUE, NO_NODE, {NULL}};
 
-    copy = malloc(sizeof(ExprTree));
-    copy->expr = tree->expr;
-
-    switch (tree->expr) {
-        case ID:
-        case Fun:
-            copy->value.id = malloc(strlen(tree->value.id) + 1);
-            strcpy(copy->value.id, tree->value.id);
-            break;
-        case Int:
-        case Float:
-        case Binop:
-            copy->value = tree->value;
-            break;
-        default:
-            break;
+/*
+ * Evaluation reads the input tree without rewriting it and returns Values instead of trees.
+ * Numbers are carried unboxed, so arithmetic on them never touches a tree. Anything else (a
+ * function, a variable's value, or an unevaluated piece of the input) is referenced where it
+ * already sits, in the input or in the tree bound in env, so reading a variable copies nothing.
+ * Nodes are only built in the result tree (out) for symbolic results, and materialize copies
+ * their children in next to them. eval leaves a copy of the final result as the only thing in out.
+ * In particular a function body is evaluated straight from the tree bound to the function, so a
+ * call neither copies nor frees any of the definition.
+ */
+static Value eval_expr(const ExprTree *src, int node, Env_t *env, char in_fun, ExprTree *out);
+static Value eval_fun(const ExprTree *src, int node, Env_t *env, ExprTree *out);
+static Value eval_binop(const ExprTree *src, int node, Env_t *env, char in_fun, ExprTree *out);
+static Value eval_assign(const ExprTree *src, int node, Env_t *env, ExprTree *out);
+static Value eval_application(const ExprTree *src, int node, Env_t *env, char in_fun, ExprTree *out);
+static int eval_arguments(const ExprTree *src, int node, Env_t *env, char in_fun, ExprTree *out);
+static void bind_locals(const ExprTree *src, int params, Env_t *env);
+static void start_memo(const ExprTree *tree, Env_t *env);
+static Value memoize(const ExprTree *src, int node, Env_t *env, Value value);
+
+/* the value of a node in tree, unboxing it if it's a number */
+Value node_value(const ExprTree *tree, int node) {
+    Value v;
+
+    v.node = NO_NODE;
+
+    if (node != NO_NODE && tree->nodes[node].expr == Int) {
+        v.type = INT_VALUE;
+        v.as.i = tree->nodes[node].value.i;
+    } else if (node != NO_NODE && tree->nodes[node].expr == Float) {
+        v.type = FLOAT_VALUE;
+        v.as.d = tree->nodes[node].value.d;
+    } else {
+        v.type = NODE_VALUE;
+        v.node = node;
+        v.as.tree = tree;
     }
 
-    copy->left = left_copy;
-    copy->right = right_copy;
-
-    return copy;
+    return v;
 }
 
-static void extend_env(Env_t *env, const char *id, ExprTree *data) {
-    Env_t *new_data;
-
-    if (errno != 0) {
-        return;
-    }
-
-    new_data = malloc(sizeof(Env_t));
-    new_data->id = malloc(strlen(id) + 1);
-    strcpy(new_data->id, id);
-    new_data->data = copy_expr_tree(data);
-    new_data->next = env->next;
+static int is_number(Value v) {
+    return v.type != NODE_VALUE;
+}
 
-    env->next = new_data;
+static int is_node(Value v, Expr_t expr) {
+    return v.type == NODE_VALUE && v.node != NO_NODE && v.as.tree->nodes[v.node].expr == expr;
 }
 
-static void extend_env_tmp(Env_t *env, const char *id) {
-    ExprTree *dummy_data = calloc(1, sizeof(ExprTree));
+/* appends v to tree as a node, returns its index */
+static int push_value(ExprTree *tree, Value v) {
+    int node;
 
-    if (errno != 0) {
-        free(dummy_data);
-        return;
+    if (v.type == NODE_VALUE) {
+        return copy_subtree(tree, v.as.tree, v.node);
     }
 
-    dummy_data->expr = ID;
-    dummy_data->value.id = malloc(strlen(id) + 1);
-    strcpy(dummy_data->value.id, id);
+    node = push_node(tree, v.type == INT_VALUE ? Int : Float, NO_NODE, NO_NODE);
 
-    extend_env(env, id, dummy_data);
+    if (v.type == INT_VALUE) {
+        tree->nodes[node].value.i = v.as.i;
+    } else {
+        tree->nodes[node].value.d = v.as.d;
+    }
 
-    free_expr_tree(dummy_data);
+    return node;
 }
 
-static Env_t *env_find(Env_t *env, const char *id, Env_t **prev) {
-    Env_t *p = env;
+/*
+ * Lays values out one after another as subtrees of out starting at mark, drops anything else out
+ * holds past mark, and puts where each one ended up in nodes (NO_NODE for no value). Subtrees
+ * already in place are left alone, which is the usual case for results built in out, so mostly
+ * only numbers and values referenced from elsewhere get copied.
+ */
+static void materialize(ExprTree *out, int mark, const Value *values, int *nodes, int num_values) {
+    int start = mark, copied, i, j;
 
-    env = env->next;
-    while (env != NULL) {
-        if (strcmp(env->id, id) == 0) {
-            if (prev != NULL) {
-                *prev = p;
-            }
+    for (i = 0; i < num_values; i++) {
+        nodes[i] = values[i].node;
 
-            return env;
+        if (values[i].type == NODE_VALUE && values[i].node == NO_NODE) {
+            continue;
         }
 
-        p = env;
-        env = env->next;
-    }
-
-    return NULL;
-}
-
-static ExprTree *lookup(Env_t *env, const char *id) {
-    Env_t *e = env_find(env, id, NULL);
+        if (values[i].type != NODE_VALUE || values[i].as.tree != out
+            || values[i].node - out->nodes[values[i].node].size + 1 != start) {
+            break;
+        }
 
-    if (e != NULL) {
-        return copy_expr_tree(e->data);
-    } else {
-        errno = EINVAL;
-        warnx("error: (E7001) unbound identifier: %s", id);
-        return NULL;
+        start = values[i].node + 1;
     }
-}
 
-static void free_env_node(Env_t *env) {
-    free(env->id);
-    free_expr_tree(env->data);
-    free(env);
-}
+    copied = out->length;
 
-void free_env(Env_t *env) {
-    if (env == NULL) {
-        return;
+    for (j = i; j < num_values; j++) {
+        if (values[j].type != NODE_VALUE || values[j].node != NO_NODE) {
+            nodes[j] = push_value(out, values[j]) - (copied - start);
+        } else {
+            nodes[j] = NO_NODE;
+        }
     }
 
-    free_env(env->next);
-    free_env_node(env);
+    memmove(&(out->nodes[start]), &(out->nodes[copied]), (out->length - copied) * sizeof(ExprNode));
+    truncate_expr_tree(out, start + out->length - copied);
 }
 
-static void shrink_env(Env_t *env, const char *id, int qty) {
-    Env_t *e, *prev, *last;
-    int i;
-
-    e = env_find(env, id, &prev);
+/* drops everything out holds past mark except what v needs, returning v at its new place */
+static Value keep_value(ExprTree *out, int mark, Value v) {
+    int node;
 
-    if (e == NULL) {
-        errno = EINVAL;
-        warnx("error: (E7005) couldn't find identifier %s when attempting to shrink environment\n", id);
-        return;
+    if (v.type != NODE_VALUE || v.as.tree != out || v.node < mark) {
+        truncate_expr_tree(out, mark);
+        return v;
     }
 
-    last = e;
-    for (i = 1; i < qty; i++) {
-        last = last->next;
-    }
+    materialize(out, mark, &v, &node, 1);
 
-    prev->next = last->next;
-    last->next = NULL;
-    free_env(e);
+    return node_value(out, node);
 }
 
-static void update_env(Env_t *env, const char *id, ExprTree *new_data) {
-    Env_t *env_entry = env_find(env, id, NULL);
+/* evaluates tree without changing it, returning the result as a new tree (NULL if tree is NULL) */
+ExprTree *eval(const ExprTree *tree, Env_t *env) {
+    ExprTree *result;
+    Value value;
+    int root;
 
-    if (errno != 0) {
-        return;
+    if (tree == NULL) {
+        return NULL;
     }
 
-    free_expr_tree(env_entry->data);
-    env_entry->data = copy_expr_tree(new_data);
+    result = new_expr_tree(tree->length);
+    start_memo(tree, env);
+    value = eval_expr(tree, expr_tree_root(tree), env, 0, result);
+    materialize(result, 0, &value, &root, 1);
+    free(env->memo);
+    env->memo = NULL;
+    env->memo_tree = NULL;
+
+    return result;
 }
 
-static char *env_to_str_aux(Env_t *env) {
-    char *str, *data_str, *env_str;
-    int env_str_len, total_len;
+/* has env remember what tree's nodes evaluate to, if it has Shared nodes (see share_subtrees) */
+static void start_memo(const ExprTree *tree, Env_t *env) {
+    int num_shared = 0, i;
 
-    if (env == NULL) {
-        return calloc(1, 1); /* effectively returns "" */
+    for (i = 0; i < tree->length; i++) {
+        num_shared += tree->nodes[i].expr == Shared;
     }
 
-    env_str = env_to_str_aux(env->next);
-    data_str = expr_tree_to_str(env->data);
-    
-    env_str_len = strlen(env_str);
-    total_len = strlen(env->id) + strlen(data_str) + env_str_len;
-    
-    /* the + 8 at the end is for null char, parens, colon, spaces, and potentially a comma */
-    str = malloc(total_len + 8);
-    sprintf(str, "(%s : %s)", env->id, data_str);
-
-    if (env_str_len != 0) {
-        sprintf(str + strlen(str), ", %s", env_str);
+    if (num_shared == 0) {
+        return;
     }
-    
-    free(data_str);
-    free(env_str);
-
-    return str;
-}
-
-char *env_to_str(Env_t *env) {
-    char *str, *contents;
-
-    env = env->next;
-    contents = env_to_str_aux(env);
 
-    str = malloc(strlen(contents) + 3);
+    env->memo = malloc(tree->length * sizeof(Value));
+    env->memo_tree = tree;
 
-    sprintf(str, "[%s]", contents);
-    free(contents);
-
-    return str;
+    for (i = 0; i < tree->length; i++) {
+        env->memo[i] = NO_VALUE;
+    }
 }
 
-static ExprTree *eval_expr(ExprTree **tree, Env_t *env, char in_fun);
-static void eval_fun(ExprTree **t, Env_t *env);
-static void eval_binop(ExprTree **t, Env_t *env, char in_fun);
-static void eval_assign(ExprTree *tree, Env_t *env);
-static void eval_application(ExprTree **t, Env_t *env, char in_fun);
-static void eval_arguments(ExprTree **t, Env_t *env, char in_fun);
-static int push_params(ExprTree *params, Env_t *env);
-static int bind_args(ExprTree *args, ExprTree *params, Env_t *env);
-static void pop_params(ExprTree *params, int num_params, Env_t *env);
-
-ExprTree *eval(ExprTree **tree, Env_t *env) {
-    return eval_expr(tree, env, 0);
+/*
+ * Remembers what a node of the tree being evaluated came to, if it's a number, so anything
+ * sharing the node gets it without evaluating it again. Nothing is remembered once there's been
+ * an error, so the errors of an expression repeated in a line are still all reported.
+ */
+static Value memoize(const ExprTree *src, int node, Env_t *env, Value value) {
+    if (src == env->memo_tree && is_number(value) && errno == 0) {
+        env->memo[node] = value;
+    }
+
+    return value;
 }
 
-static ExprTree *eval_expr(ExprTree **tree, Env_t *env, char in_fun) {
-    if (*tree == NULL) {
-        return NULL;
+static Value eval_expr(const ExprTree *src, int node, Env_t *env, char in_fun, ExprTree *out) {
+    if (node == NO_NODE) {
+        return NO_VALUE;
     }
 
-    switch ((*tree)->expr) {
+    switch (src->nodes[node].expr) {
         case Int:
         case Float:
-            return *tree;
+            return node_value(src, node);
         case ID: {
-            ExprTree *value = lookup(env, (*tree)->value.id);
+            Binding *binding = lookup(env, src->nodes[node].value.id);
+            Value value = binding != NULL ? node_value(binding->data, expr_tree_root(binding->data)) : NO_VALUE;
 
-            if (!in_fun) {
-                free_expr_tree(*tree);
-                *tree = value;
-            } else {
-                free_expr_tree(value);
+            /* in a function body, parameters turn into Locals and everything else is left as is */
+            if (in_fun) {
+                return is_node(value, Local) ? value : node_value(src, node);
             }
 
-            break;
+            return value;
         }
+        case Local:
+            return in_fun ? node_value(src, node) : env->stack[env->frame + src->nodes[node].value.local.slot];
         case Fun:
-            eval_fun(tree, env);
-            break;
+            return eval_fun(src, node, env, out);
         case Binop:
-            eval_binop(tree, env, in_fun);
-            break;
+            return memoize(src, node, env, eval_binop(src, node, env, in_fun, out));
         case Assign:
-            eval_assign(*tree, env);
-            break;
+            return eval_assign(src, node, env, out);
         case Application:
-            eval_application(tree, env, in_fun);
-            break;
+            return memoize(src, node, env, eval_application(src, node, env, in_fun, out));
+        case Shared: {
+            int shared = node - src->nodes[node].value.i;
+
+            if (src == env->memo_tree && is_number(env->memo[shared])) {
+                return env->memo[shared];
+            }
+
+            return eval_expr(src, shared, env, in_fun, out);
+        }
         case Argument:
             errno = EINVAL;
             warnx("error: (E7010) argument expression outside of function application\n");
-            return NULL;
+            return NO_VALUE;
         case Parameter:
             errno = EINVAL;
             warnx("error: (E7015) parameter expression outside of function definition\n");
-            return NULL;
+            return NO_VALUE;
         default: {
-            char *expr_str = expr_tree_to_str(*tree);
+            char *expr_str = expr_tree_to_str(src);
             errno = EINVAL;
             warnx("error: (E7020) failed to evaluate unrecognized expression: %s\n", expr_str);
             free(expr_str);
-            return NULL;
+            return NO_VALUE;
         }
     }
-    
-    return *tree;
 }
 
-static int validate_params(ExprTree *params, const char *fun_id) {
-    char *p[MAX_PARAMS];
+static int validate_params(const ExprTree *src, int params, Symbol_t fun_id) {
+    Symbol_t p[MAX_PARAMS];
     int i = 0, j, dupes = 0;
 
-    while (params != NULL) {
-        p[i] = params->left->value.id;
+    while (params != NO_NODE) {
+        p[i] = src->nodes[left_child(src, params)].value.id;
 
-        if (strcmp(p[i], fun_id) == 0) {
+        if (p[i] == fun_id) {
             errno = EINVAL;
-            warnx("error: (E7002) parameter %s copies function name", p[i]);
+            warnx("error: (E7002) parameter %s copies function name", symbol_name(p[i]));
             return -1;
         }
 
         for (j = 0; j < i; j++) {
-            if (strcmp(p[j], p[i]) == 0) {
+            if (p[j] == p[i]) {
                 errno = EINVAL;
-                warnx("error: (E7003) duplicate parameter %s in definition of function %s", p[i], fun_id);
+                warnx(
+                    "error: (E7003) duplicate parameter %s in definition of function %s",
+                    symbol_name(p[i]),
+                    symbol_name(fun_id)
+                );
                 dupes++;
                 break;
             }
         }
 
         i++;
-        params = params->right;
+        params = right_child(src, params);
     }
 
     if (dupes) {
@@ -304,25 +285,49 @@ static int validate_params(ExprTree *params, const char *fun_id) {
     return 0;
 }
 
-static void eval_fun(ExprTree **t, Env_t *env) {
-    ExprTree *tree = *t;
-    int num_params;
+static Value eval_fun(const ExprTree *src, int node, Env_t *env, ExprTree *out) {
+    int mark = out->length, scope = env->num_bindings, params = left_child(src, node), fun, valid;
+    Symbol_t id = src->nodes[node].value.id;
+    Inlining inlining = {0};
+    Value children[2];
+    int nodes[2];
+
+    bind_locals(src, params, env);
+    children[0] = node_value(out, copy_subtree(out, src, params));
+    children[1] = eval_expr(src, right_child(src, node), env, 1, out);
+    materialize(out, mark, children, nodes, 2);
+
+    fun = push_node(out, Fun, nodes[0], nodes[1]);
+    out->nodes[fun].value.id = id;
+
+    valid = validate_params(out, nodes[0], id) == 0;
+    shrink_env(env, scope);
 
-    num_params = push_params(tree->left, env);
-    eval_expr(&(tree->right), env, 1);
+    if (valid && errno == 0) {
+        fun = inline_calls(out, fun, env, &inlining);
+        fun = optimize_fun(out, fun, env->opt_level, env->opt_verbose);
+    }
+
+    if (valid) {
+        extend_env(env, id, out, fun);
+    }
 
-    if (validate_params(tree->left, tree->value.id) == 0) {
-        extend_env(env, tree->value.id, tree);
+    /* the bound copy is compiled, so the code lives (and is shared) with it */
+    if (valid && errno == 0) {
+        ExprTree *bound = env_find(env, id)->data;
+
+        bound->code = compile_fun(bound, expr_tree_root(bound));
+        respecialize(env, id, &inlining);
     }
 
-    pop_params(tree->left, num_params, env);
+    return node_value(out, fun);
 }
 
 /*
  * Checks binary operation for integer overflow or underflow.
  * Returns 1 if overflow is detected, 2 if underflow is detected, and 0 otherwise.
  */
-static int check_int_limits(long v1, long v2, Operator_t op) {
+int check_int_limits(long v1, long v2, Operator_t op) {
     int overflow = 1, underflow = 2, op_is_ok = 0;
 
     switch(op) {
@@ -334,7 +339,7 @@ static int check_int_limits(long v1, long v2, Operator_t op) {
                 return overflow;
             }
 
-            if (both_neg && v1 < LONG_MIN + v2) {
+            if (both_neg && v1 < LONG_MIN - v2) {
                 return underflow;
             }
 
@@ -418,250 +423,340 @@ static void interpret_limit_check(int check_result, int is_int) {
     }
 }
 
-static void eval_binop(ExprTree **t, Env_t *env, char in_fun) {
-    ExprTree *tree = *t;
-    ExprTree *v1, *v2, *v;
-    int can_simplify, v1_is_int, v1_is_float, v2_is_int, v2_is_float;
-
-    v1 = eval_expr(&(tree->left), env, in_fun);
-    v2 = eval_expr(&(tree->right), env, in_fun);
-
-    if (v1 == NULL || v2 == NULL) {
-        return;
-    }
-
-    v1_is_int = v1->expr == Int;
-    v1_is_float = v1->expr == Float;
-    v2_is_int = v2->expr == Int;
-    v2_is_float = v2->expr == Float;
-    can_simplify = (v1_is_int || v1_is_float) && (v2_is_int || v2_is_float);
-
-    if (!can_simplify) {
-        return;
-    }
-
-    v = malloc(sizeof(ExprTree));
-    v->expr = (v1_is_float || v2_is_float) ? Float : Int;
-    v->left = NULL;
-    v->right = NULL;
+/*
+ * Applies op to two numbers, leaving the resulting number in v, without reporting anything.
+ * Returns BINOP_OK, BINOP_OVERFLOW or BINOP_UNDERFLOW (v then holds the wrapped result), or
+ * BINOP_DIV_BY_ZERO or BINOP_BAD_OP when there's no result.
+ */
+int compute_binop(Operator_t op, Value n1, Value n2, Value *v) {
+    int is_float = n1.type == FLOAT_VALUE || n2.type == FLOAT_VALUE;
+    long int i1 = n1.as.i, i2 = n2.as.i;
+    double d1 = n1.type == INT_VALUE ? (double) i1 : n1.as.d;
+    double d2 = n2.type == INT_VALUE ? (double) i2 : n2.as.d;
+    int limits = is_float ? check_float_limits(d1, d2, op) : check_int_limits(i1, i2, op);
 
-    if (v->expr == Float) {
-        if (v1_is_int) {
-            v1->value.d = (double) v1->value.i;
-        } else if (v2_is_int) {
-            v2->value.d = (double) v2->value.i;
-        }
-    }
+    v->type = is_float ? FLOAT_VALUE : INT_VALUE;
+    v->node = NO_NODE;
 
-    switch (v->expr) {
-        case Int:
-            interpret_limit_check(check_int_limits(v1->value.i, v2->value.i, tree->value.binop), 1);
-            break;
-        case Float:
-            interpret_limit_check(check_float_limits(v1->value.d, v2->value.d, tree->value.binop), 0);
-            break;
-        default:
-            errno = EINVAL;
-            warnx("error: (E7030) unexpected expression type while checking for over/underflow");
-            return;
-    }
-
-    switch (tree->value.binop) {
+    switch (op) {
         case Add:
-            if (v->expr == Int) {
-                v->value.i = v1->value.i + v2->value.i;
+            if (is_float) {
+                v->as.d = d1 + d2;
             } else {
-                v->value.d = v1->value.d + v2->value.d;
+                v->as.i = i1 + i2;
             }
 
-            break;
+            return limits;
         case Sub:
-            if (v->expr == Int) {
-                v->value.i = v1->value.i - v2->value.i;
+            if (is_float) {
+                v->as.d = d1 - d2;
             } else {
-                v->value.d = v1->value.d - v2->value.d;
+                v->as.i = i1 - i2;
             }
 
-            break;
+            return limits;
         case Mult:
-            if (v->expr == Int) {
-                v->value.i = v1->value.i * v2->value.i;
+            if (is_float) {
+                v->as.d = d1 * d2;
             } else {
-                v->value.d = v1->value.d * v2->value.d;
+                v->as.i = i1 * i2;
             }
 
-            break;
+            return limits;
         case Div:
-            if ((v->expr == Int ? v2->value.i : v2->value.d) == 0) {
-                errno = EINVAL;
-                warnx("error: (E7007) division by 0");
-                return;
+            if ((is_float ? d2 : i2) == 0) {
+                return BINOP_DIV_BY_ZERO;
             }
 
-            if (v->expr == Int) {
-                if (v1->value.i % v2->value.i == 0) {
-                    v->value.i = v1->value.i / v2->value.i;
-                } else {
-                    v->expr = Float;
-                    v->value.d = (double) v1->value.i / (double) v2->value.i;
-                }
+            if (is_float) {
+                v->as.d = d1 / d2;
+            } else if (i1 % i2 == 0) {
+                v->as.i = i1 / i2;
             } else {
-                v->value.d = v1->value.d / v2->value.d;
+                v->type = FLOAT_VALUE;
+                v->as.d = d1 / d2;
             }
             
-            break;
+            return limits;
         case Exp:
-            if (v->expr == Int) {
-                v1->value.d = (double) v1->value.i;
-                v2->value.d = (double) v2->value.i;
-
-                /* negative exponent can cause expr to evaluate to float */
-                if (v2->value.d < 0) {
-                    v->expr = Float;
-                    v->value.d = pow(v1->value.d, v2->value.d);
-                } else {
-                    v->value.i = (long int) pow(v1->value.d, v2->value.d);
-                }
+            /* negative exponent can cause expr to evaluate to float */
+            if (!is_float && d2 < 0) {
+                v->type = FLOAT_VALUE;
+            }
+
+            if (v->type == FLOAT_VALUE) {
+                v->as.d = pow(d1, d2);
             } else {
-                v->value.d = pow(v1->value.d, v2->value.d);
+                v->as.i = (long int) pow(d1, d2);
             }
 
-            break;
-        default: {
-            char *expr_str = expr_tree_to_str(tree);
-            errno = EINVAL;
-            warnx("error: (E7035) failed to evaluate unrecognized binary operator expression: %s", expr_str);
-            free(expr_str);
-            return;
-        }
+            return limits;
+        default:
+            return BINOP_BAD_OP;
     }
-
-    free_expr_tree(tree);
-    *t = v;
 }
 
-static void eval_assign(ExprTree *tree, Env_t *env) {
-    ExprTree *value = eval(&(tree->right), env);
-    
-    if (env_find(env, tree->left->value.id, NULL) != NULL) {
-        update_env(env, tree->left->value.id, value);
-    } else {
-        extend_env(env, tree->left->value.id, value);
+/*
+ * compute_binop, reporting what went wrong. Returns -1 (with errno set) if the operation can't be
+ * done, and 0 otherwise. Like before, overflow is reported but the (wrapped) result is still used.
+ */
+static int apply_binop(Operator_t op, Value n1, Value n2, Value *v) {
+    int is_int = n1.type == INT_VALUE && n2.type == INT_VALUE;
+    int result = compute_binop(op, n1, n2, v);
+
+    switch (result) {
+        case BINOP_DIV_BY_ZERO:
+            errno = EINVAL;
+            warnx("error: (E7007) division by 0");
+            return -1;
+        case BINOP_BAD_OP:
+            errno = EINVAL;
+            warnx("error: (E7035) failed to evaluate unrecognized binary operator: %d", op);
+            return -1;
+        default:
+            interpret_limit_check(result, is_int);
+            return 0;
     }
 }
 
-static void eval_application(ExprTree **t, Env_t *env, char in_fun) {
-    ExprTree *tree = *t;
-    ExprTree *fun = lookup(env, tree->left->value.id);
-    ExprTree *params, *fun_body, *ret_val;
-    ExprTree *args = tree->right;
-    int num_params, num_args_bound;
-    
-    /* lookup failed because the function is not in env */
-    if (fun == NULL) {
-        /* errno already set by lookup, but just to be clear there's an error */
-        errno = EINVAL;
-        return;
+static Value eval_binop(const ExprTree *src, int node, Env_t *env, char in_fun, ExprTree *out) {
+    int mark = out->length, nodes[2], binop;
+    Operator_t op = src->nodes[node].value.binop;
+    Value v[2], value;
+
+    v[0] = eval_expr(src, left_child(src, node), env, in_fun, out);
+    v[1] = eval_expr(src, right_child(src, node), env, in_fun, out);
+
+    if (is_number(v[0]) && is_number(v[1]) && apply_binop(op, v[0], v[1], &value) == 0) {
+        return value;
     }
 
-    params = fun->left;
-    fun_body = fun->right;
+    materialize(out, mark, v, nodes, 2);
+    binop = push_node(out, Binop, nodes[0], nodes[1]);
+    out->nodes[binop].value.binop = op;
 
-    eval_arguments(&(args), env, in_fun);
-    num_params = push_params(params, env);
-    num_args_bound = bind_args(args, params, env);
+    return node_value(out, binop);
+}
 
-    if (num_params != num_args_bound) {
-        errno = EINVAL;
-        warnx("error: (E7008) in application of %s, received %d arguments but expected %d", fun->value.id, num_args_bound, num_params);
-        pop_params(params, num_params, env);
-        return;
+/* binds (or rebinds) var to v, which goes into a tree of its own if it's a number */
+static void bind_value(Env_t *env, Symbol_t var, Value v) {
+    ExprNode number = {0};
+    ExprTree number_data = {0};
+    const ExprTree *tree = v.as.tree;
+    int node = v.node;
+
+    if (is_number(v)) {
+        number_data.nodes = &number;
+        number_data.capacity = 1;
+        node = push_value(&number_data, v);
+        tree = &number_data;
     }
 
-    if (in_fun) {
-        pop_params(params, num_params, env);
-        return;
+    if (env_find(env, var) != NULL) {
+        update_env(env, var, tree, node);
+    } else {
+        extend_env(env, var, tree, node);
     }
+}
+
+/*
+ * The value is bound before it's copied into out, since rebinding a variable frees its old value,
+ * which the value may be (e.g. x = x). A value that's another variable's is shared rather than
+ * copied (see env.c).
+ */
+static Value eval_assign(const ExprTree *src, int node, Env_t *env, ExprTree *out) {
+    int mark = out->length, nodes[2];
+    Value v[2];
+    Symbol_t var;
+
+    v[0] = node_value(src, left_child(src, node));
+    v[1] = eval_expr(src, right_child(src, node), env, 0, out);
+    var = src->nodes[v[0].node].value.id;
 
-    ret_val = eval(&fun_body, env);
-    pop_params(params, num_params, env);
+    if ((is_number(v[1]) || v[1].node != NO_NODE) && errno == 0) {
+        Binding *binding;
 
-    free_expr_tree(tree);
+        bind_value(env, var, v[1]);
+        respecialize(env, var, NULL);
+        binding = env_find(env, var);
+        v[1] = node_value(binding->data, expr_tree_root(binding->data));
+    }
 
-    fun->right = NULL;  /* fun->right is currently the ret_val & don't want to free it yet  */
-    free_expr_tree(fun);
+    materialize(out, mark, v, nodes, 2);
 
-    *t = ret_val;
+    return node_value(out, push_node(out, Assign, nodes[0], nodes[1]));
 }
 
-static void eval_arguments(ExprTree **t, Env_t *env, char in_fun) {
-    ExprTree *arg = *t;
+static int list_length(const ExprTree *tree, int node) {
+    int length = 0;
 
-    while (arg != NULL) {
-        eval_expr(&(arg->left), env, in_fun);
-        arg = arg->right;
+    for (; node != NO_NODE; node = right_child(tree, node)) {
+        length++;
     }
+
+    return length;
 }
 
-static int push_params(ExprTree *params, Env_t *env) {
-    if (params == NULL) {
-        return 0;
+static Symbol_t name_of(const ExprNode *n) {
+    return n->expr == Local ? n->value.local.id : n->value.id;
+}
+
+/*
+ * A call evaluates its arguments straight into a new frame on env's value stack, then evaluates the
+ * function's body from the tree it's bound to with that frame current, so the body's Locals read
+ * their arguments by index. Nothing gets bound in env, and nothing is allocated outside of out.
+ */
+static Value eval_application(const ExprTree *src, int node, Env_t *env, char in_fun, ExprTree *out) {
+    int mark = out->length, id = left_child(src, node), args = right_child(src, node);
+    int num_params = 0, num_args = list_length(src, args), frame, caller_frame, slot;
+    const ExprTree *fun = NULL;
+    Value name = node_value(src, id), callee, ret_val;
+    Memo *memo;
+
+    if (src->nodes[id].expr == Local) {
+        callee = env->stack[env->frame + src->nodes[id].value.local.slot];
+    } else {
+        Binding *binding = lookup(env, src->nodes[id].value.id);
+
+        /* lookup failed because the function is not in env */
+        if (binding == NULL) {
+            /* errno already set by lookup, but just to be clear there's an error */
+            errno = EINVAL;
+            return node_value(src, node);
+        }
+
+        callee = node_value(binding->data, expr_tree_root(binding->data));
+
+        /* applying a parameter of the function being defined */
+        if (is_node(callee, Local)) {
+            name = callee;
+        }
     }
 
-    extend_env_tmp(env, params->left->value.id);
+    /* a variable bound to something other than a function is applied as if it takes no params */
+    if (is_node(callee, Fun)) {
+        fun = callee.as.tree;
+        num_params = list_length(fun, left_child(fun, callee.node));
+    }
 
-    return 1 + push_params(params->right, env);
-}
+    if (fun == NULL || num_params != num_args || in_fun) {
+        id = push_value(out, name);
+        args = eval_arguments(src, args, env, in_fun, out);
 
-static int bind_args(ExprTree *args, ExprTree *params, Env_t *env) {
-    int num_args;
+        if (num_params != num_args) {
+            errno = EINVAL;
+            warnx(
+                "error: (E7008) in application of %s, received %d arguments but expected %d",
+                symbol_name(name_of(&(out->nodes[id]))),
+                num_args,
+                num_params
+            );
+        }
 
-    if (args == NULL) {
-        return 0;
+        return node_value(out, push_node(out, Application, id, args));
+    }
+
+    frame = push_frame(env, num_params);
+
+    for (slot = 0; args != NO_NODE; slot++, args = right_child(src, args)) {
+        /* not assigned directly, since evaluating it can move the stack */
+        Value value = eval_expr(src, left_child(src, args), env, 0, out);
+
+        env->stack[frame + slot] = value;
+    }
+
+    memo = env->memos != NULL ? find_memo(env, fun, callee.node) : NULL;
+
+    if (memo != NULL && memo_get(memo, &(env->stack[frame]), &ret_val) == 0) {
+        pop_frame(env, frame);
+        return keep_value(out, mark, ret_val);
+    }
+
+    /* the compiled body gives the same result whenever it can run to the end */
+    if (fun->code != NULL && callee.node == expr_tree_root(fun) && run_fun(fun->code, env, frame, &ret_val) == 0) {
+        if (memo != NULL) {
+            memo_put(memo, &(env->stack[frame]), ret_val);
+        }
+
+        pop_frame(env, frame);
+        return keep_value(out, mark, ret_val);
     }
 
-    if (params == NULL) {
-        return 1 + bind_args(args->right, params, env);
+    caller_frame = env->frame;
+    env->frame = frame;
+    ret_val = eval_expr(fun, right_child(fun, callee.node), env, 0, out);
+    env->frame = caller_frame;
+
+    if (memo != NULL) {
+        memo_put(memo, &(env->stack[frame]), ret_val);
     }
 
-    num_args = bind_args(args->right, params->right, env);
-    update_env(env, params->left->value.id, args->left);
+    pop_frame(env, frame);
 
-    return 1 + num_args;
+    return keep_value(out, mark, ret_val);
 }
 
-static void pop_params(ExprTree *params, int num_params, Env_t *env) {
-    char *top_param; /* first param in env (top of stack) */
+static int eval_arguments(const ExprTree *src, int node, Env_t *env, char in_fun, ExprTree *out) {
+    int mark = out->length, arg, rest;
+    Value value;
 
-    while (params->right != NULL) {
-        params = params->right;
+    if (node == NO_NODE) {
+        return NO_NODE;
     }
 
-    top_param = params->left->value.id;
-    shrink_env(env, top_param, num_params);
+    value = eval_expr(src, left_child(src, node), env, in_fun, out);
+    materialize(out, mark, &value, &arg, 1);
+    rest = eval_arguments(src, right_child(src, node), env, in_fun, out);
+
+    return push_node(out, Argument, arg, rest);
 }
 
-static int is_primary_expr(ExprTree *tree) {
-    if (tree == NULL) {
+/* binds each parameter's name to a Local for its slot while the function's body is evaluated */
+static void bind_locals(const ExprTree *src, int params, Env_t *env) {
+    ExprNode local = {0};
+    ExprTree local_data = {0};
+
+    local.expr = Local;
+    local.size = 1;
+
+    local_data.nodes = &local;
+    local_data.length = 1;
+    local_data.capacity = 1;
+
+    for (local.value.local.slot = 0; params != NO_NODE; local.value.local.slot++) {
+        local.value.local.id = src->nodes[left_child(src, params)].value.id;
+        extend_env(env, local.value.local.id, &local_data, 0);
+        params = right_child(src, params);
+    }
+}
+
+static int is_primary_expr(const ExprTree *tree, int node) {
+    if (node == NO_NODE) {
         return 0;
     }
 
-    return tree->expr == Int || tree->expr == Float || tree->expr == ID;
+    return tree->nodes[node].expr == Int || tree->nodes[node].expr == Float || tree->nodes[node].expr == ID
+           || tree->nodes[node].expr == Local;
 }
 
-static char *eval_result_to_str_aux(ExprTree *tree, int *size) {
+static char *eval_result_to_str_aux(const ExprTree *tree, int node, int *size) {
     char *str, *lstr, *rstr;
-    int lsize, rsize;
+    int lsize, rsize, left, right;
+    const ExprNode *n;
 
-    if (tree == NULL) {
+    if (node == NO_NODE) {
         str = calloc(1, 1);
         *size = 0;
         return str;
     }
 
-    if (tree->left != NULL || tree->right != NULL) {
-        lstr = eval_result_to_str_aux(tree->left, &lsize);
-        rstr = eval_result_to_str_aux(tree->right, &rsize);
+    n = &(tree->nodes[node]);
+    left = left_child(tree, node);
+    right = right_child(tree, node);
+
+    if (left != NO_NODE || right != NO_NODE) {
+        lstr = eval_result_to_str_aux(tree, left, &lsize);
+        rstr = eval_result_to_str_aux(tree, right, &rsize);
     } else {
         lstr = NULL;
         rstr = NULL;
@@ -669,23 +764,27 @@ static char *eval_result_to_str_aux(ExprTree *tree, int *size) {
         rsize = 0;
     }
 
-    str = malloc(MAX_NODE_VAL_LEN + lsize + rsize + 1);
+    /* a big float prints longer than MAX_NODE_VAL_LEN (e.g. 1e300 with all its digits) */
+    str = malloc(MAX_NODE_VAL_LEN + (n->expr == Float ? snprintf(NULL, 0, "%f", n->value.d) : 0) + lsize + rsize + 1);
 
-    switch (tree->expr) {
+    switch (n->expr) {
         case Int:
-            sprintf(str, "%ld", tree->value.i);
+            sprintf(str, "%ld", n->value.i);
             break;
         case Float:
-            sprintf(str, "%f", tree->value.d);
+            sprintf(str, "%f", n->value.d);
             break;
         case ID:
-            strcpy(str, tree->value.id);
+            strcpy(str, symbol_name(n->value.id));
+            break;
+        case Local:
+            strcpy(str, symbol_name(n->value.local.id));
             break;
         case Fun:
-            sprintf(str, "%s(%s) = %s", tree->value.id, lstr, rstr);
+            sprintf(str, "%s(%s) = %s", symbol_name(n->value.id), lstr, rstr);
             break;
         case Binop:
-            switch (tree->value.binop) {
+            switch (n->value.binop) {
                 case Add:
                     sprintf(str, "%s + %s", lstr, rstr);
                     break;
@@ -696,41 +795,16 @@ static char *eval_result_to_str_aux(ExprTree *tree, int *size) {
                     sprintf(str, "%s * %s", lstr, rstr);
                     break;
                 case Div: {
-                    char lexp[MAX_NODE_VAL_LEN + 1], rexp[MAX_NODE_VAL_LEN + 1];
-
-                    if (!is_primary_expr(tree->left)) {
-                        sprintf(lexp, "(%s)", lstr);
-                    } else {
-                        strcpy(lexp, lstr);
-                    }
+                    /* parenthesized in place, since operands can be any length */
+                    int lparen = !is_primary_expr(tree, left), rparen = !is_primary_expr(tree, right);
 
-                    if (!is_primary_expr(tree->right)) {
-                        sprintf(rexp, "(%s)", rstr);
-                    } else {
-                        strcpy(rexp, rstr);
-                    }
-
-                    sprintf(str, "%s / %s", lexp, rexp);
+                    sprintf(str, "%s%s%s / %s%s%s", lparen ? "(" : "", lstr, lparen ? ")" : "",
+                            rparen ? "(" : "", rstr, rparen ? ")" : "");
                     break;
                 }
-                case Exp: {
-                    char lexp[MAX_NODE_VAL_LEN + 1], rexp[MAX_NODE_VAL_LEN + 1];
-
-                    if (!is_primary_expr(tree->left)) {
-                        sprintf(lexp, "(%s)", lstr);
-                    } else {
-                        strcpy(lexp, lstr);
-                    }
-
-                    if (!is_primary_expr(tree->right)) {
-                        sprintf(rexp, "(%s)", rstr);
-                    } else {
-                        strcpy(rexp, rstr);
-                    }
-
+                case Exp:
                     sprintf(str, "%s^%s", lstr, rstr);
                     break;
-                }
                 default:
                     sprintf(str, "%s unknown-op %s", lstr, rstr);
             }
@@ -754,7 +828,7 @@ static char *eval_result_to_str_aux(ExprTree *tree, int *size) {
             strcpy(str, "Unrecognized expr");
     }
 
-    if (tree->left != NULL || tree->right != NULL) {
+    if (left != NO_NODE || right != NO_NODE) {
         free(lstr);
         free(rstr);
     }
@@ -763,8 +837,7 @@ static char *eval_result_to_str_aux(ExprTree *tree, int *size) {
     return str;
 }
 
-char *eval_result_to_str(ExprTree *tree) {
+char *eval_result_to_str(const ExprTree *tree) {
     int size;
-    return eval_result_to_str_aux(tree, &size);
+    return eval_result_to_str_aux(tree, expr_tree_root(tree), &size);
 }
-
@@ -2,17 +2,19 @@
 #define Eval_h
 
 #include "parser.h"
+#include "env.h"
 
-typedef struct env {
-    char *id;
-    ExprTree *data;
-    struct env *next;
-} Env_t;
+/* what compute_binop returns, the first three matching check_int_limits */
+#define BINOP_OK 0
+#define BINOP_OVERFLOW 1
+#define BINOP_UNDERFLOW 2
+#define BINOP_DIV_BY_ZERO 3
+#define BINOP_BAD_OP 4
 
-Env_t *init_env();
-char *env_to_str(Env_t *env);
-void free_env(Env_t *env);
-ExprTree *eval(ExprTree **tree, Env_t *env);
-char *eval_result_to_str(ExprTree *tree);
+ExprTree *eval(const ExprTree *tree, Env_t *env);
+Value node_value(const ExprTree *tree, int node);
+int check_int_limits(long v1, long v2, Operator_t op);
+int compute_binop(Operator_t op, Value n1, Value n2, Value *v);
+char *eval_result_to_str(const ExprTree *tree);
 
 #endif
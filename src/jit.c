@@ -0,0 +1,484 @@
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "jit.h"
+#include "vm.h"
+#include "env.h"
+#include "eval.h"
+#include "parser.h"
+
+#define MAX_NATIVE_SLOTS 1024  /* most values compiled code keeps on the machine stack, bigger bodies stay bytecode */
+#define GAVE_UP (-1)           /* a chunk's calls once it's not to be compiled (again) */
+#define BAIL_COST 64           /* runs of machine code that don't bail it takes to make up for one that does */
+#define MAX_BAIL_DEBT (8 * BAIL_COST) /* how far bails can outweigh the rest before the code's dropped */
+
+/* what a chunk compiles to. args is its frame, and it returns 0 having set result or -1 to bail */
+typedef int (*NativeFun)(const Value *args, Value *result, Env_t *env);
+
+/*
+ * Machine code is mapped a function at a time and only unmapped with the whole Jit, so code that
+ * gets dropped (see jit_run) stays valid for any call of it that's still in progress.
+ */
+typedef struct code_block {
+    void *code;
+    size_t size;
+    struct code_block *next;
+} CodeBlock;
+
+struct jit {
+    int threshold;
+    CodeBlock *blocks;
+};
+
+Jit *new_jit(int threshold) {
+    Jit *jit = malloc(sizeof(Jit));
+
+    jit->threshold = threshold;
+    jit->blocks = NULL;
+
+    return jit;
+}
+
+void free_jit(Jit *jit) {
+    if (jit == NULL) {
+        return;
+    }
+
+    while (jit->blocks != NULL) {
+        CodeBlock *next = jit->blocks->next;
+
+        munmap(jit->blocks->code, jit->blocks->size);
+        free(jit->blocks);
+        jit->blocks = next;
+    }
+
+    free(jit);
+}
+
+/* what compiled code calls out to for anything it doesn't do inline, returning -1 to bail */
+
+static int global_value(Env_t *env, Value *v, GlobalCache *global) {
+    if (global->version != env->version && resolve_global(env, global) != 0) {
+        return -1;
+    }
+
+    *v = global->value;
+    return 0;
+}
+
+static int binop_value(Value *operands, int op) {
+    if (operands[0].type == NODE_VALUE || operands[1].type == NODE_VALUE) {
+        return -1;
+    }
+
+    return compute_binop((Operator_t) op, operands[0], operands[1], &(operands[0])) == BINOP_OK ? 0 : -1;
+}
+
+/* the arguments follow the callee, whose place the result takes */
+static int call_value(Env_t *env, Value *callee, int num_args) {
+    Value result;
+
+    if (call_fun(env, *callee, callee + 1, num_args, &result) != 0) {
+        return -1;
+    }
+
+    *callee = result;
+    return 0;
+}
+
+#if defined(__x86_64__) && defined(MAP_ANONYMOUS)
+
+/* registers by their encoding */
+#define RAX 0
+#define RDX 2
+#define RSI 6
+#define RDI 7
+#define XMM0 0
+#define XMM1 1
+
+/* condition codes */
+#define CC_O 0x0
+#define CC_E 0x4
+#define CC_NE 0x5
+#define ALWAYS (-1)
+
+#define TYPE offsetof(Value, type)
+#define NODE offsetof(Value, node)
+#define AS offsetof(Value, as)
+
+typedef struct {
+    unsigned char *bytes;
+    int length;
+    int capacity;
+} Asm;
+
+static void byte(Asm *a, int b) {
+    if (a->length == a->capacity) {
+        a->capacity = a->capacity == 0 ? 1024 : a->capacity * 2;
+        a->bytes = realloc(a->bytes, a->capacity);
+    }
+
+    a->bytes[a->length++] = (unsigned char) b;
+}
+
+static void bytes(Asm *a, const char *s, int n) {
+    while (n-- > 0) {
+        byte(a, (unsigned char) *s++);
+    }
+}
+
+static void imm32(Asm *a, int32_t v) {
+    uint32_t u = (uint32_t) v;
+    int i;
+
+    for (i = 0; i < 4; i++, u >>= 8) {
+        byte(a, u & 0xff);
+    }
+}
+
+static void imm64(Asm *a, uint64_t u) {
+    int i;
+
+    for (i = 0; i < 8; i++, u >>= 8) {
+        byte(a, u & 0xff);
+    }
+}
+
+/* the ModRM, SIB and displacement bytes for an operand [rsp + disp] alongside register reg */
+static void at_rsp(Asm *a, int reg, int disp) {
+    byte(a, 0x84 | (reg & 7) << 3);
+    byte(a, 0x24);
+    imm32(a, disp);
+}
+
+/*
+ * Emits a jump, conditional on cc unless it's ALWAYS, to target, which is either an earlier offset
+ * or -1 for one to be set with patch. Returns where its displacement is.
+ */
+static int jump(Asm *a, int cc, int target) {
+    int at;
+
+    if (cc == ALWAYS) {
+        byte(a, 0xe9);
+    } else {
+        byte(a, 0x0f);
+        byte(a, 0x80 | cc);
+    }
+
+    at = a->length;
+    imm32(a, target < 0 ? 0 : target - (at + 4));
+
+    return at;
+}
+
+/* points the jump whose displacement is at at to the next instruction */
+static void patch(Asm *a, int at) {
+    int32_t rel = a->length - (at + 4);
+
+    memcpy(&(a->bytes[at]), &rel, 4);
+}
+
+/* calls fn, which is passed whatever's been put in rdi, rsi and rdx, and bails if it fails */
+static void call_out(Asm *a, void (*fn)(void), int bail) {
+    uint64_t addr;
+
+    memcpy(&addr, &fn, sizeof(addr));
+    bytes(a, "\x48\xb8", 2);        /* mov rax, fn */
+    imm64(a, addr);
+    bytes(a, "\xff\xd0", 2);        /* call rax */
+    bytes(a, "\x85\xc0", 2);        /* test eax, eax */
+    jump(a, CC_NE, bail);
+}
+
+/* mov dword [rsp + disp], v */
+static void store_imm32(Asm *a, int disp, int32_t v) {
+    byte(a, 0xc7);
+    at_rsp(a, RAX, disp);
+    imm32(a, v);
+}
+
+/* a number pushed from the code: its tag, no node, and the 8 bytes of it */
+static void push_number(Asm *a, int slot, Value_t type, uint64_t bits) {
+    store_imm32(a, slot + TYPE, type);
+    store_imm32(a, slot + NODE, NO_NODE);
+    bytes(a, "\x48\xb8", 2);        /* mov rax, bits */
+    imm64(a, bits);
+    bytes(a, "\x48\x89", 2);        /* mov [slot + AS], rax */
+    at_rsp(a, RAX, slot + AS);
+}
+
+/* loads the number in slot into xmm as a double, bailing if it isn't a number */
+static void load_double(Asm *a, int slot, int xmm, int bail) {
+    int is_float, loaded;
+
+    byte(a, 0x83);                  /* cmp dword [slot + TYPE], NODE_VALUE */
+    at_rsp(a, 7, slot + TYPE);
+    byte(a, NODE_VALUE);
+    jump(a, CC_E, bail);
+
+    byte(a, 0x83);                  /* cmp dword [slot + TYPE], INT_VALUE */
+    at_rsp(a, 7, slot + TYPE);
+    byte(a, INT_VALUE);
+    is_float = jump(a, CC_NE, -1);
+
+    bytes(a, "\xf2\x48\x0f\x2a", 4);    /* cvtsi2sd xmm, qword [slot + AS] */
+    at_rsp(a, xmm, slot + AS);
+    loaded = jump(a, ALWAYS, -1);
+
+    patch(a, is_float);
+    bytes(a, "\xf2\x0f\x10", 3);    /* movsd xmm, [slot + AS] */
+    at_rsp(a, xmm, slot + AS);
+    patch(a, loaded);
+}
+
+/*
+ * Add, Sub and Mult inline. Two ints use the machine's instruction and bail if it overflows, which
+ * is exactly when check_int_limits would report it, and any other two numbers are done in doubles.
+ */
+static void arith(Asm *a, Operator_t op, int left, int right, int bail) {
+    static const char int_ops[][3] = {"\x48\x03", "\x48\x2b", "\x48\x0f\xaf"};
+    static const char float_ops[] = {0x58, 0x5c, 0x59};
+    int not_ints, done;
+
+    byte(a, 0x8b);                  /* mov eax, [left + TYPE] */
+    at_rsp(a, RAX, left + TYPE);
+    byte(a, 0x0b);                  /* or eax, [right + TYPE] */
+    at_rsp(a, RAX, right + TYPE);
+    not_ints = jump(a, CC_NE, -1);  /* INT_VALUE is 0 */
+
+    bytes(a, "\x48\x8b", 2);        /* mov rax, [left + AS] */
+    at_rsp(a, RAX, left + AS);
+    bytes(a, int_ops[op], op == Mult ? 3 : 2);  /* add/sub/imul rax, [right + AS] */
+    at_rsp(a, RAX, right + AS);
+    jump(a, CC_O, bail);
+    bytes(a, "\x48\x89", 2);        /* mov [left + AS], rax */
+    at_rsp(a, RAX, left + AS);
+    done = jump(a, ALWAYS, -1);
+
+    patch(a, not_ints);
+    load_double(a, left, XMM0, bail);
+    load_double(a, right, XMM1, bail);
+    bytes(a, "\xf2\x0f", 2);        /* addsd/subsd/mulsd xmm0, xmm1 */
+    byte(a, float_ops[op]);
+    byte(a, 0xc1);
+    bytes(a, "\xf2\x0f\x11", 3);    /* movsd [left + AS], xmm0 */
+    at_rsp(a, XMM0, left + AS);
+    store_imm32(a, left + TYPE, FLOAT_VALUE);
+
+    patch(a, done);
+    store_imm32(a, left + NODE, NO_NODE);
+}
+
+static void *map_code(Jit *jit, const Asm *a) {
+    size_t page = sysconf(_SC_PAGESIZE), size = (a->length + page - 1) / page * page;
+    void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    CodeBlock *block;
+
+    if (code == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* never writable and executable at once */
+    memcpy(code, a->bytes, a->length);
+
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        return NULL;
+    }
+
+    block = malloc(sizeof(CodeBlock));
+    block->code = code;
+    block->size = size;
+    block->next = jit->blocks;
+    jit->blocks = block;
+
+    return code;
+}
+
+/*
+ * Translates a chunk's bytecode to x86-64 one instruction at a time. The depth of the VM's stack at
+ * each instruction is known from the bytecode, so its values get fixed 16 byte slots in the
+ * machine stack frame, with the arguments copied in above them. r13 holds result and r14 env
+ * throughout, both callee saved, so they survive calls out. Any bail jumps to one shared exit
+ * returning -1. Returns the code, or NULL if the chunk can't be compiled.
+ */
+static void *compile_native(Jit *jit, const Chunk *chunk) {
+    int num_slots = chunk->max_stack + chunk->num_params, frame_size, depth = 0, bail, epilogue, to_body, i;
+    const Word *w;
+    Asm a = {0};
+    void *code;
+
+    if (num_slots > MAX_NATIVE_SLOTS || sizeof(Value) != 16) {
+        return NULL;
+    }
+
+    /* the 8 keeps rsp 16 byte aligned at calls out, after the return address and two pushes */
+    frame_size = num_slots * 16 + 8;
+
+#define SLOT(i) ((i) * 16)
+#define PARAM(i) SLOT(chunk->max_stack + (i))
+
+    bytes(&a, "\x41\x55\x41\x56", 4);   /* push r13; push r14 */
+    bytes(&a, "\x48\x81\xec", 3);       /* sub rsp, frame_size */
+    imm32(&a, frame_size);
+    bytes(&a, "\x49\x89\xf5", 3);       /* mov r13, rsi */
+    bytes(&a, "\x49\x89\xd6", 3);       /* mov r14, rdx */
+
+    for (i = 0; i < chunk->num_params; i++) {
+        bytes(&a, "\xf3\x0f\x6f\x87", 4);   /* movdqu xmm0, [rdi + 16i] */
+        imm32(&a, SLOT(i));
+        bytes(&a, "\xf3\x0f\x7f", 3);       /* movdqu [PARAM(i)], xmm0 */
+        at_rsp(&a, XMM0, PARAM(i));
+    }
+
+    to_body = jump(&a, ALWAYS, -1);
+
+    bail = a.length;
+    bytes(&a, "\xb8\xff\xff\xff\xff", 5);   /* mov eax, -1 */
+
+    epilogue = a.length;
+    bytes(&a, "\x48\x81\xc4", 3);       /* add rsp, frame_size */
+    imm32(&a, frame_size);
+    bytes(&a, "\x41\x5e\x41\x5d\xc3", 5);   /* pop r14; pop r13; ret */
+
+    patch(&a, to_body);
+
+    for (w = chunk->code; w < chunk->code + chunk->length; w++) {
+        switch (w->op) {
+            case OP_INT: {
+                uint64_t bits;
+
+                memcpy(&bits, &((++w)->i), sizeof(bits));
+                push_number(&a, SLOT(depth++), INT_VALUE, bits);
+                break;
+            }
+            case OP_FLOAT: {
+                uint64_t bits;
+
+                memcpy(&bits, &((++w)->d), sizeof(bits));
+                push_number(&a, SLOT(depth++), FLOAT_VALUE, bits);
+                break;
+            }
+            case OP_LOCAL:
+                bytes(&a, "\xf3\x0f\x6f", 3);   /* movdqu xmm0, [PARAM(slot)] */
+                at_rsp(&a, XMM0, PARAM((++w)->arg));
+                bytes(&a, "\xf3\x0f\x7f", 3);   /* movdqu [SLOT(depth)], xmm0 */
+                at_rsp(&a, XMM0, SLOT(depth++));
+                break;
+            case OP_GLOBAL:
+                bytes(&a, "\x4c\x89\xf7", 3);   /* mov rdi, r14 */
+                bytes(&a, "\x48\x8d", 2);       /* lea rsi, [SLOT(depth)] */
+                at_rsp(&a, RSI, SLOT(depth++));
+                bytes(&a, "\x48\xba", 2);       /* mov rdx, global */
+                imm64(&a, (uint64_t) (uintptr_t) &(chunk->globals[(++w)->arg]));
+                call_out(&a, (void (*)(void)) global_value, bail);
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MULT:
+                arith(&a, (Operator_t) (w->op - OP_ADD), SLOT(depth - 2), SLOT(depth - 1), bail);
+                depth--;
+                break;
+            case OP_DIV:
+            case OP_EXP:
+                bytes(&a, "\x48\x8d", 2);       /* lea rdi, [SLOT(depth - 2)] */
+                at_rsp(&a, RDI, SLOT(depth - 2));
+                byte(&a, 0xbe);                 /* mov esi, op */
+                imm32(&a, w->op - OP_ADD);
+                call_out(&a, (void (*)(void)) binop_value, bail);
+                depth--;
+                break;
+            case OP_CALL: {
+                int num_args = (++w)->arg;
+
+                depth -= num_args;
+                bytes(&a, "\x4c\x89\xf7", 3);   /* mov rdi, r14 */
+                bytes(&a, "\x48\x8d", 2);       /* lea rsi, [SLOT(depth - 1)] */
+                at_rsp(&a, RSI, SLOT(depth - 1));
+                byte(&a, 0xba);                 /* mov edx, num_args */
+                imm32(&a, num_args);
+                call_out(&a, (void (*)(void)) call_value, bail);
+                break;
+            }
+            case OP_RETURN:
+                bytes(&a, "\xf3\x0f\x6f", 3);   /* movdqu xmm0, [SLOT(depth - 1)] */
+                at_rsp(&a, XMM0, SLOT(depth - 1));
+                bytes(&a, "\xf3\x41\x0f\x7f\x45\x00", 6);   /* movdqu [r13], xmm0 */
+                bytes(&a, "\x31\xc0", 2);       /* xor eax, eax */
+                jump(&a, ALWAYS, epilogue);
+                break;
+            default:
+                /* the specialized operations are only ever in the VM's versions of the code */
+                break;
+        }
+    }
+
+#undef SLOT
+#undef PARAM
+
+    code = map_code(jit, &a);
+    free(a.bytes);
+
+    return code;
+}
+
+#else
+
+/* only x86-64 code is generated, so elsewhere everything stays on the VM */
+static void *compile_native(Jit *jit, const Chunk *chunk) {
+    return NULL;
+}
+
+#endif
+
+/*
+ * Runs chunk's machine code on args (copied in before anything can move env's stack) if it has
+ * any, and otherwise counts the call, compiling it once it has been called jit->threshold times.
+ * Returns 0 with the call's value in result, or -1 when the VM should run the call instead. That
+ * includes when the code bails (say an int overflowed, or an operand was symbolic): since calls
+ * have no side effects redoing it gives the same result. The code's kept for the calls after, so
+ * one bad argument doesn't cost a hot function its machine code, unless bails come more often
+ * than once every BAIL_COST runs for long enough to build up MAX_BAIL_DEBT, when it's dropped and
+ * the chunk is run by the VM from then on. A function that gets redefined has a new chunk, so it
+ * starts out on the VM again too.
+ */
+int jit_run(Jit *jit, Chunk *chunk, Env_t *env, const Value *args, Value *result) {
+    NativeFun fun;
+
+    if (chunk->native == NULL) {
+        if (chunk->calls == GAVE_UP || ++chunk->calls < jit->threshold) {
+            return -1;
+        }
+
+        chunk->native = compile_native(jit, chunk);
+
+        if (chunk->native == NULL) {
+            chunk->calls = GAVE_UP;
+            return -1;
+        }
+    }
+
+    memcpy(&fun, &(chunk->native), sizeof(fun));
+
+    if (fun(args, result, env) != 0) {
+        chunk->bail_debt += BAIL_COST;
+
+        if (chunk->bail_debt >= MAX_BAIL_DEBT) {
+            chunk->native = NULL;
+            chunk->calls = GAVE_UP;
+        }
+
+        return -1;
+    }
+
+    if (chunk->bail_debt > 0) {
+        chunk->bail_debt--;
+    }
+
+    return 0;
+}
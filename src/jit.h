@@ -0,0 +1,15 @@
+#ifndef Jit_h
+#define Jit_h
+
+#include "env.h"
+#include "vm.h"
+
+#define JIT_THRESHOLD 1000  /* calls a function is run by the VM for before mint --jit compiles it */
+
+typedef struct jit Jit;
+
+Jit *new_jit(int threshold);
+void free_jit(Jit *jit);
+int jit_run(Jit *jit, Chunk *chunk, Env_t *env, const Value *args, Value *result);
+
+#endif
@@ -1,237 +1,298 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <regex.h>
 #include <errno.h>
 #include <err.h>
 #include "lexer.h"
+#include "number.h"
 
 #define MAX_TOK_LEN 11     /* longest tok is TOK_COMMENT = 11 chars                  */
 #define MAX_TOK_VAL_LEN 50 /* arbitrary upper limit on token value size (e.g. an id) */
-#define MAX_TOK_STR_LEN MAX_TOK_LEN + MAX_TOK_VAL_LEN
-
-regex_t add_re, comma_re, comment_re, dot_re, div_re, equal_re, exp_re, float_re;
-regex_t fun_re, id_re, int_re, l_paren_re, mult_re, r_paren_re, sub_re; 
-regex_t whitespace_re;
-static TokenList *tok(const char *input, unsigned int pos, unsigned int length);
-
-TokenList *tokenize(const char *input) {
-    TokenList *tok_l = NULL;
-    int len;
+#define MAX_TOK_STR_LEN (MAX_TOK_LEN + MAX_TOK_VAL_LEN)
+
+/*
+ * The scanner is a hand-built DFA. Every input byte is mapped to a character class once, and the
+ * class drives a single state transition, so the cost of a token is proportional to its length
+ * rather than to how many token kinds are tried before one matches. Matching is maximal munch:
+ * the scanner runs until it falls into S_DEAD and then backs up to the last accepting state.
+ */
+typedef enum {
+    C_OTHER,  /* anything that can't start or continue a token */
+    C_SPACE,
+    C_ALPHA,
+    C_DIGIT,
+    C_UNDERSCORE,
+    C_DOT,
+    C_MINUS,
+    C_HASH,
+    C_PLUS,
+    C_COMMA,
+    C_SLASH,
+    C_EQUAL,
+    C_CARET,
+    C_LPAREN,
+    C_RPAREN,
+    C_STAR,
+    NUM_CLASSES
+} CharClass_t;
+
+typedef enum {
+    S_DEAD,
+    S_START,
+    S_SPACE,
+    S_ID,
+    S_MINUS,
+    S_MINUS_DOT, /* "-." can only become a float, so it doesn't accept on its own */
+    S_DOT,
+    S_INT,
+    S_INT_DOT,   /* "5." is a float */
+    S_FRAC,
+    S_COMMENT,
+    S_ADD,
+    S_COMMA,
+    S_DIV,
+    S_EQUAL,
+    S_EXP,
+    S_LPAREN,
+    S_RPAREN,
+    S_MULT,
+    NUM_STATES
+} ScanState_t;
+
+#define ACCEPT_NONE -1
+#define ACCEPT_SKIP -2
+
+#define O C_OTHER
+#define W C_SPACE
+#define A C_ALPHA
+#define D C_DIGIT
+static const unsigned char char_class[256] = {
+/*  \0 ...                                       \t \n                                        */
+    O, O, O, O, O, O, O, O, O, W, O, O, O, O, O, O,
+    O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+/*  sp  !  "  #        $  %  &  '  (         )         *       +       ,        -        .     /       */
+    W, O, O, C_HASH, O, O, O, O, C_LPAREN, C_RPAREN, C_STAR, C_PLUS, C_COMMA, C_MINUS, C_DOT, C_SLASH,
+/*  0  1  2  3  4  5  6  7  8  9  :  ;  <  =        >  ?  */
+    D, D, D, D, D, D, D, D, D, D, O, O, O, C_EQUAL, O, O,
+/*  @  A  B  C  D  E  F  G  H  I  J  K  L  M  N  O  */
+    O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+/*  P  Q  R  S  T  U  V  W  X  Y  Z  [  \  ]  ^        _             */
+    A, A, A, A, A, A, A, A, A, A, A, O, O, O, C_CARET, C_UNDERSCORE,
+/*  `  a  b  c  d  e  f  g  h  i  j  k  l  m  n  o  */
+    O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A,
+/*  p  q  r  s  t  u  v  w  x  y  z  {  |  }  ~  DEL */
+    A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, O
+    /* bytes >= 128 are zero initialized to C_OTHER */
+};
+#undef O
+#undef W
+#undef A
+#undef D
+
+static const unsigned char transitions[NUM_STATES][NUM_CLASSES] = {
+    [S_START] = {
+        [C_SPACE] = S_SPACE, [C_ALPHA] = S_ID, [C_DIGIT] = S_INT, [C_DOT] = S_DOT, [C_MINUS] = S_MINUS,
+        [C_HASH] = S_COMMENT, [C_PLUS] = S_ADD, [C_COMMA] = S_COMMA, [C_SLASH] = S_DIV, [C_EQUAL] = S_EQUAL,
+        [C_CARET] = S_EXP, [C_LPAREN] = S_LPAREN, [C_RPAREN] = S_RPAREN, [C_STAR] = S_MULT
+    },
+    [S_SPACE]     = {[C_SPACE] = S_SPACE},
+    [S_ID]        = {[C_ALPHA] = S_ID, [C_DIGIT] = S_ID, [C_UNDERSCORE] = S_ID},
+    [S_MINUS]     = {[C_DIGIT] = S_INT, [C_DOT] = S_MINUS_DOT},
+    [S_MINUS_DOT] = {[C_DIGIT] = S_FRAC},
+    [S_DOT]       = {[C_DIGIT] = S_FRAC},
+    [S_INT]       = {[C_DIGIT] = S_INT, [C_DOT] = S_INT_DOT},
+    [S_INT_DOT]   = {[C_DIGIT] = S_FRAC},
+    [S_FRAC]      = {[C_DIGIT] = S_FRAC},
+    [S_COMMENT]   = {
+        [C_OTHER] = S_COMMENT, [C_SPACE] = S_COMMENT, [C_ALPHA] = S_COMMENT, [C_DIGIT] = S_COMMENT,
+        [C_UNDERSCORE] = S_COMMENT, [C_DOT] = S_COMMENT, [C_MINUS] = S_COMMENT, [C_HASH] = S_COMMENT,
+        [C_PLUS] = S_COMMENT, [C_COMMA] = S_COMMENT, [C_SLASH] = S_COMMENT, [C_EQUAL] = S_COMMENT,
+        [C_CARET] = S_COMMENT, [C_LPAREN] = S_COMMENT, [C_RPAREN] = S_COMMENT, [C_STAR] = S_COMMENT
+    }
+    /* single character tokens have no outgoing transitions */
+};
+
+static const int accepts[NUM_STATES] = {
+    [S_DEAD]      = ACCEPT_NONE,
+    [S_START]     = ACCEPT_NONE,
+    [S_SPACE]     = ACCEPT_SKIP,
+    [S_ID]        = TOK_ID,
+    [S_MINUS]     = TOK_SUB,
+    [S_MINUS_DOT] = ACCEPT_NONE,
+    [S_DOT]       = TOK_DOT,
+    [S_INT]       = TOK_INT,
+    [S_INT_DOT]   = TOK_FLOAT,
+    [S_FRAC]      = TOK_FLOAT,
+    [S_COMMENT]   = TOK_COMMENT,
+    [S_ADD]       = TOK_ADD,
+    [S_COMMA]     = TOK_COMMA,
+    [S_DIV]       = TOK_DIV,
+    [S_EQUAL]     = TOK_EQUAL,
+    [S_EXP]       = TOK_EXP,
+    [S_LPAREN]    = TOK_LPAREN,
+    [S_RPAREN]    = TOK_RPAREN,
+    [S_MULT]      = TOK_MULT
+};
+
+#define INITIAL_TOK_CAPACITY 16
+
+static size_t tok(const char *input, size_t pos, size_t length, TokenList *tok_l);
+
+/*
+ * Tokens are appended to the list's buffer in a flat loop, so lexing uses constant stack space
+ * no matter how many tokens a line holds. On error the tokens lexed so far are returned.
+ *
+ * Only the length bytes at input are read and no terminator is needed, so lines can be lexed in
+ * place inside a larger buffer, e.g. a memory-mapped script.
+ */
+TokenList *tokenize(const char *input, size_t length) {
+    TokenList *tok_l;
+    size_t pos = 0;
 
     if (!input) {
         errno = EINVAL;
         warnx("error: (E0005) input is NULL");
         return NULL;
     }
-    
-    len = strlen(input);
-    tok_l = tok(input, 0, len);
 
-    return tok_l;
-}
+    tok_l = malloc(sizeof(TokenList));
+    tok_l->length = 0;
+    tok_l->capacity = INITIAL_TOK_CAPACITY;
+    tok_l->toks = malloc(tok_l->capacity * sizeof(Token));
 
-static TokenList *tok(const char *input, unsigned int pos, unsigned int length) {
-    const char *str = input + pos;
-    regmatch_t re_match;
-    TokenList *t;
+    while (pos < length) {
+        size_t consumed;
 
-    if (pos >= length) {
-        return NULL;
-    }
-
-    if (regexec(&whitespace_re, str, 1, &re_match, 0) == 0) {
-        int match_length = re_match.rm_eo - re_match.rm_so;
-        return tok(input, pos + match_length, length);
-    } else if (regexec(&id_re, str, 1, &re_match, 0) == 0) {
-        int match_length = re_match.rm_eo - re_match.rm_so;
-        t = malloc(sizeof(TokenList));
-
-        if (match_length > MAX_TOK_VAL_LEN) {
-            errno = ENAMETOOLONG;  /* originally for file names but cmon */
-            warnx("error: (E0003) name too long");
-            free(t);
-            return NULL;
+        /* whitespace between tokens is common enough to skip without going through the DFA */
+        if (input[pos] == ' ' || input[pos] == '\t') {
+            pos++;
+            continue;
         }
 
-        if (strncmp(str, "fn", 2) == 0) {
-            t->token = TOK_FUN;
-            t->next = tok(input, pos + 2, length);
-            return t;
-        }
+        consumed = tok(input, pos, length, tok_l);
 
-        t->token = TOK_ID;
-        t->value.id = calloc(1, match_length + 1);
-        strncpy(t->value.id, str, match_length);
-        t->next = tok(input, pos + match_length, length);
-        return t;
-    } else if (regexec(&float_re, str, 1, &re_match, 0) == 0) {
-        int match_length = re_match.rm_eo - re_match.rm_so;
-        double num;
-        char *float_str = calloc(1, match_length + 1);
-
-        strncpy(float_str, str, match_length);
-        num = atof(float_str);
-        free(float_str);
-        t = malloc(sizeof(TokenList));
-
-        t->token = TOK_FLOAT;
-        t->value.d = num;
-        t->next = tok(input, pos + match_length, length);
-        return t;
-    } else if (regexec(&int_re, str, 1, &re_match, 0) == 0) {
-        int match_length = re_match.rm_eo - re_match.rm_so;
-        long int num;
-        char *int_str = calloc(1, match_length + 1);
-
-        strncpy(int_str, str, match_length);
-        num = atol(int_str);
-
-        if (errno == ERANGE) {
-            warnx(
-                "error: (E0001) int %s does not fall within storable range of -9223372036854775808 to "
-                "9223372036854775807\ntry declaring it as a float instead (i.e. %s.0)",
-                int_str,
-                int_str
-            );
-            free(int_str);
-            return NULL;
+        if (consumed == 0) {
+            break;
         }
 
-        free(int_str);
-        t = malloc(sizeof(TokenList));
-
-        t->token = TOK_INT;
-        t->value.i = num;
-        t->next = tok(input, pos + match_length, length);
-        return t;
-    } else if (regexec(&l_paren_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_LPAREN;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&r_paren_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_RPAREN;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&dot_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_DOT;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&equal_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_EQUAL;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&add_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_ADD;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&sub_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_SUB;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&mult_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_MULT;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&div_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_DIV;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&exp_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_EXP;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else if (regexec(&comment_re, str, 1, &re_match, 0) == 0) {
-        int match_length = re_match.rm_eo - re_match.rm_so;
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_COMMENT;
-        t->next = tok(input, pos + match_length, length);
-        return t;
-    } else if (regexec(&comma_re, str, 0, NULL, 0) == 0) {
-        t = malloc(sizeof(TokenList));
-        t->token = TOK_COMMA;
-        t->next = tok(input, pos + 1, length);
-        return t;
-    } else {
-        errno = EINVAL;
-        warnx("error: (E0002) Invalid token starting with \"%c\" at index %u", str[0], pos);
-        return NULL;
+        pos += consumed;
     }
-}
 
-void compile_regexs() {
-    regcomp(&add_re,        "^\\+",                                 REG_EXTENDED);
-    regcomp(&comma_re,      "^,",                                   REG_EXTENDED);
-    regcomp(&comment_re,    "^(#.*)$",                              REG_EXTENDED);
-    regcomp(&div_re,        "^/",                                   REG_EXTENDED);
-    regcomp(&dot_re,        "^\\.",                                 REG_EXTENDED);
-    regcomp(&equal_re,      "^=",                                   REG_EXTENDED);
-    regcomp(&exp_re,        "^\\^",                                 REG_EXTENDED);
-    regcomp(&float_re,      "^-?([0-9]+\\.[0-9]*|[0-9]*\\.[0-9]+)", REG_EXTENDED);
-    regcomp(&fun_re,        "^fn",                                  REG_EXTENDED);
-    regcomp(&id_re,         "^[a-zA-Z][a-zA-Z0-9_]*",               REG_EXTENDED);
-    regcomp(&int_re,        "^-?[0-9]+",                            REG_EXTENDED);
-    regcomp(&l_paren_re,    "^\\(",                                 REG_EXTENDED);
-    regcomp(&mult_re,       "^\\*",                                 REG_EXTENDED);
-    regcomp(&r_paren_re,    "^\\)",                                 REG_EXTENDED);
-    regcomp(&sub_re,        "^-",                                   REG_EXTENDED);
-    regcomp(&whitespace_re, "^([ \t])+",                            REG_EXTENDED);
+    return tok_l;
 }
 
-void free_regexs() {
-    regfree(&add_re);
-    regfree(&comma_re);
-    regfree(&comment_re);
-    regfree(&div_re);
-    regfree(&dot_re);
-    regfree(&equal_re);
-    regfree(&exp_re);
-    regfree(&float_re);
-    regfree(&fun_re);
-    regfree(&id_re);
-    regfree(&int_re);
-    regfree(&l_paren_re);
-    regfree(&mult_re);
-    regfree(&r_paren_re);
-    regfree(&sub_re);
-    regfree(&whitespace_re);
-}
+static Token *push_token(TokenList *tok_l, Tok_t kind) {
+    Token *t;
 
-static void free_token(TokenList *tok_l) {
-    if (tok_l->token == TOK_ID) {
-        free(tok_l->value.id);
+    if (tok_l->length == tok_l->capacity) {
+        tok_l->capacity *= 2;
+        tok_l->toks = realloc(tok_l->toks, tok_l->capacity * sizeof(Token));
     }
 
-    free(tok_l);
+    t = &(tok_l->toks[tok_l->length++]);
+    t->token = kind;
+
+    return t;
 }
 
-void free_token_list(TokenList *tok_l) {
-    if (tok_l == NULL) {
-        return;
+/*
+ * Runs the DFA from the start of str and returns the length of the longest token found there
+ * (0 if there is none). The accepted token kind (or ACCEPT_SKIP for whitespace) is stored in
+ * *accepted.
+ */
+static size_t scan(const char *str, size_t remaining, int *accepted) {
+    int state = S_START, last_accepted = ACCEPT_NONE;
+    size_t i, match_length = 0;
+
+    for (i = 0; i < remaining; i++) {
+        state = transitions[state][char_class[(unsigned char) str[i]]];
+
+        if (state == S_DEAD) {
+            break;
+        }
+
+        if (accepts[state] != ACCEPT_NONE) {
+            last_accepted = accepts[state];
+            match_length = i + 1;
+        }
     }
 
-    free_token_list(tok_l->next);
-    free_token(tok_l);
+    *accepted = last_accepted;
+    return match_length;
 }
 
-static int count_tokens(const TokenList *tok_l) {
-    int num_tok = 0;
+/*
+ * Lexes the token starting at input[pos] onto the end of tok_l (whitespace adds nothing) and
+ * returns how many bytes it consumed. Returns 0 and sets errno if no valid token starts there.
+ */
+static size_t tok(const char *input, size_t pos, size_t length, TokenList *tok_l) {
+    const char *str = input + pos;
+    size_t match_length;
+    int accepted;
+    Token *t;
+
+    match_length = scan(str, length - pos, &accepted);
+
+    switch (accepted) {
+        case ACCEPT_SKIP:
+            return match_length;
+        case TOK_ID:
+            if (match_length > MAX_TOK_VAL_LEN) {
+                errno = ENAMETOOLONG;  /* originally for file names but cmon */
+                warnx("error: (E0003) name too long");
+                return 0;
+            }
+
+            t = push_token(tok_l, TOK_ID);
+            t->value.id = intern(str, match_length);
+
+            if (t->value.id == SYM_FN) {
+                t->token = TOK_FUN;
+            }
+
+            return match_length;
+        case TOK_FLOAT:
+            t = push_token(tok_l, TOK_FLOAT);
+            t->value.d = parse_float(str, match_length);
+            return match_length;
+        case TOK_INT: {
+            long int num;
+
+            if (parse_int(str, match_length, &num) != 0) {
+                errno = ERANGE;
+                warnx(
+                    "error: (E0001) int %.*s does not fall within storable range of -9223372036854775808 to "
+                    "9223372036854775807\ntry declaring it as a float instead (i.e. %.*s.0)",
+                    (int) match_length,
+                    str,
+                    (int) match_length,
+                    str
+                );
+                return 0;
+            }
+
+            t = push_token(tok_l, TOK_INT);
+            t->value.i = num;
+            return match_length;
+        }
+        case ACCEPT_NONE:
+            errno = EINVAL;
+            warnx("error: (E0002) Invalid token starting with \"%c\" at index %zu", str[0], pos);
+            return 0;
+        default:
+            /* every other token is fully described by its kind */
+            push_token(tok_l, accepted);
+            return match_length;
+    }
+}
 
-    while (tok_l != NULL) {
-        num_tok++;
-        tok_l = tok_l->next;
+void free_token_list(TokenList *tok_l) {
+    if (tok_l == NULL) {
+        return;
     }
 
-    return num_tok;
+    free(tok_l->toks);
+    free(tok_l);
 }
 
 void print_token_list(const TokenList *tok_l) {
@@ -240,16 +301,19 @@ void print_token_list(const TokenList *tok_l) {
     free(tok_l_str);
 }
 
-char *token_to_str(const TokenList *tok_l) {
+char *token_to_str(const TokenList *tok_l, int i) {
     char *str = malloc(MAX_TOK_STR_LEN + 1);
-    char s[MAX_TOK_VAL_LEN] = {0};
+    char s[MAX_TOK_STR_LEN + 1] = {0};
+    const Token *t;
 
-    if (tok_l == NULL) {
+    if (tok_l == NULL || i >= tok_l->length) {
         str[0] = '\0';
         return str;
     }
-    
-    switch (tok_l->token) {
+
+    t = &(tok_l->toks[i]);
+
+    switch (t->token) {
         case TOK_ADD:
             strcpy(str, "TOK_ADD");
             break;
@@ -272,18 +336,18 @@ char *token_to_str(const TokenList *tok_l) {
             strcpy(str, "TOK_EXP");
             break;
         case TOK_FLOAT:
-            sprintf(s, "TOK_FLOAT %f", tok_l->value.d);
+            sprintf(s, "TOK_FLOAT %f", t->value.d);
             strcpy(str, s);
             break;
         case TOK_FUN:
             strcpy(str, "TOK_FUN");
             break;
         case TOK_ID:
-            sprintf(s, "TOK_ID %s", tok_l->value.id);
+            sprintf(s, "TOK_ID %s", symbol_name(t->value.id));
             strcpy(str, s);
             break;
         case TOK_INT:
-            sprintf(s, "TOK_INT %ld", tok_l->value.i);
+            sprintf(s, "TOK_INT %ld", t->value.i);
             strcpy(str, s);
             break;
         case TOK_LPAREN:
@@ -307,39 +371,39 @@ char *token_to_str(const TokenList *tok_l) {
 
 char *token_list_to_str(const TokenList *tok_l) {
     char *str;
-    int num_tok = count_tokens(tok_l);
+    int i, num_tok = tok_l == NULL ? 0 : tok_l->length;
 
     /* + 2 for brackets [] and then + 1 for null terminator */
-    str = malloc(num_tok * MAX_TOK_STR_LEN + 3); 
+    str = malloc(num_tok * (MAX_TOK_STR_LEN + 2) + 3);
 
     strcpy(str, "[");
-    while (tok_l != NULL) {
-        char *token_str = token_to_str(tok_l);
+    for (i = 0; i < num_tok; i++) {
+        char *token_str = token_to_str(tok_l, i);
 
         strcat(str, token_str);
         free(token_str);
 
-        if (tok_l->next != NULL) {
+        if (i + 1 < num_tok) {
             strcat(str, ", ");
         }
-
-        tok_l = tok_l->next;
     }
 
     strcat(str, "]");
     return str;
 }
 
-char *token_value_to_str(const TokenList *tok_l) {
+char *token_value_to_str(const TokenList *tok_l, int i) {
     char *str, s[MAX_TOK_VAL_LEN + 1] = {0};
+    const Token *t;
 
-    if (tok_l == NULL) {
+    if (tok_l == NULL || i >= tok_l->length) {
         return calloc(1,1);
     }
 
     str = malloc(MAX_TOK_STR_LEN + 1);
+    t = &(tok_l->toks[i]);
 
-    switch (tok_l->token) {
+    switch (t->token) {
         case TOK_ADD:
             strcpy(str, " + ");
             break;
@@ -362,18 +426,18 @@ char *token_value_to_str(const TokenList *tok_l) {
             strcpy(str, "^");
             break;
         case TOK_FLOAT:
-            sprintf(s, "%f", tok_l->value.d);
+            sprintf(s, "%f", t->value.d);
             strcpy(str, s);
             break;
         case TOK_FUN:
             strcpy(str, "fn ");
             break;
         case TOK_ID:
-            sprintf(s, "%s", tok_l->value.id);
+            sprintf(s, "%s", symbol_name(t->value.id));
             strcpy(str, s);
             break;
         case TOK_INT:
-            sprintf(s, "%ld", tok_l->value.i);
+            sprintf(s, "%ld", t->value.i);
             strcpy(str, s);
             break;
         case TOK_LPAREN:
@@ -395,20 +459,18 @@ char *token_value_to_str(const TokenList *tok_l) {
     return str;
 }
 
-char *token_values_to_str(const TokenList *tok_l) {
+char *token_values_to_str(const TokenList *tok_l, int start) {
     char *str;
-    int num_tok = count_tokens(tok_l);
+    int i, num_tok = (tok_l == NULL || start >= tok_l->length) ? 0 : tok_l->length - start;
 
     str = malloc(num_tok * MAX_TOK_STR_LEN + 1); 
     str[0] = '\0';
 
-    while (tok_l != NULL) {
-        char *tok_str = token_value_to_str(tok_l);
+    for (i = start; i < start + num_tok; i++) {
+        char *tok_str = token_value_to_str(tok_l, i);
 
         strcat(str, tok_str);
         free(tok_str);
-
-        tok_l = tok_l->next;
     }
 
     return str;
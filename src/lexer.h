@@ -1,6 +1,9 @@
 #ifndef Lexer_h
 #define Lexer_h
 
+#include <stddef.h>
+#include "symbol.h"
+
 typedef enum {
     TOK_ADD,
     TOK_COMMA,
@@ -24,19 +27,23 @@ typedef struct token {
     union {
         long int i;
         double d;
-        char *id;
+        Symbol_t id;
     } value;
-    struct token *next;
+} Token;
+
+/* tokens are stored contiguously and walked by index */
+typedef struct token_list {
+    Token *toks;
+    int length;
+    int capacity;
 } TokenList;
 
-TokenList *tokenize(const char *input);
-void compile_regexs();
-void free_regexs();
+TokenList *tokenize(const char *input, size_t length);
 void free_token_list(TokenList *tok_l);
 void print_token_list(const TokenList *tok_l);
-char *token_to_str(const TokenList *tok_l);
+char *token_to_str(const TokenList *tok_l, int i);
 char *token_list_to_str(const TokenList *tok_l);
-char *token_value_to_str(const TokenList *tok_l);
-char *token_values_to_str(const TokenList *tok_l);
+char *token_value_to_str(const TokenList *tok_l, int i);
+char *token_values_to_str(const TokenList *tok_l, int start);
 
 #endif
@@ -3,25 +3,59 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <err.h>
+#include <fcntl.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "lexer.h"
 #include "parser.h"
 #include "eval.h"
+#include "symbol.h"
+#include "reader.h"
+#include "jit.h"
+#include "emit.h"
+#include "optimize.h"
+#include "memo.h"
+#include "demand.h"
 
 #define TEAL "\033[38;5;49m"
 #define END_COLOR "\033[0m"
 #define PROMPT TEAL "mint" END_COLOR "|> "
-#define BUF_SIZE 1024
 #define VERSION_MSG "mint 0.1.0\n"
 #define HELP_MSG "Usage: mint\n" \
     "   or: mint EXPRESSION\n" \
     "   or: mint < FILE\n" \
+    "   or: mint -f FILE\n" \
     "   or: mint OPTION\n" \
+    "   or: mint [--jit] [-O0 | -O1 | -O2] [--verbose] [--share] [--memo NAME]...\n" \
+    "            [--demand] [EXPRESSION | -f FILE]\n" \
+    "   or: mint --emit-c FILE\n" \
     "Start an interactive session, evaluate a math EXPRESSION when given as an\n" \
     "argument, evaluate EXPRESSIONs from a FILE, or print help or version info.\n" \
     "\n" \
     "Available OPTIONs are:\n" \
+    "  -f FILE    evaluate EXPRESSIONs from FILE, same as mint < FILE\n" \
+    "  --jit      compile functions to machine code once they've been called often\n" \
+    "             (x86-64 only, elsewhere it does nothing)\n" \
+    "  -O1        optimize function bodies when they're defined, in ways that never\n" \
+    "             change a result: fold constants, drop x * 1, x / 1 and x - 0, turn\n" \
+    "             division by a power of two into multiplication, and inline calls to\n" \
+    "             small functions (redefining one redefines what it's inlined into)\n" \
+    "  -O2        also drop x + 0 and x^1, turn x^2 into x * x, and combine constants\n" \
+    "             like (x + 1) + 2 into x + 3, which can change how a float rounds or\n" \
+    "             where an int overflow is caught (-O0, no optimization, is the default)\n" \
+    "  --verbose  report every change the optimizer makes, and how each --memo did\n" \
+    "  --share    evaluate an expression repeated within a line only once, which\n" \
+    "             saves time and memory on long generated expressions\n" \
+    "  --memo NAME  remember what calls to the function NAME give for the arguments\n" \
+    "             used most recently, so calling it the same way again costs a lookup\n" \
+    "             (until it or anything it uses is redefined), given for each NAME\n" \
+    "  --demand   when evaluating a FILE, parse all of it first and only evaluate\n" \
+    "             the lines what gets printed depends on, skipping assignments and\n" \
+    "             functions it never reads (only their errors go unreported), which\n" \
+    "             holds the whole parsed FILE in memory\n" \
+    "  --emit-c FILE  print a C program that computes what mint -f FILE prints, for\n" \
+    "             scripts whose every result is a number, to build with cc FILE.c -lm\n" \
     "  --help     print this help message and exit\n" \
     "  --version  print version info and exit\n" \
     "\n" \
@@ -62,37 +96,81 @@
     "\n" \
     "When input redirection is used to read from a FILE, the functionality is the\n" \
     "same as an interactive session, but only the result of the last expression is\n" \
-    "printed.\n" \
+    "printed. Files are memory-mapped rather than copied, so scripts of any size run\n" \
+    "in a small, flat amount of memory.\n" \
     "\n" \
     "For more info see the online wiki: <https://github.com/Eric-McKinney/mint/wiki>\n"
 
-static char *process_input(char *input, Env_t *env);
+static char *process_input(const char *input, size_t length, Env_t *env);
 static char *aggregate_args(int argc, char **argv);
-static void process_file(FILE *file, Env_t *env);
+static void process_file(int fd, Env_t *env, int demand);
 static void repl_loop(Env_t *env);
 
 int main(int argc, char **argv) {
     Env_t *env = init_env();
-    compile_regexs();
+    Jit *jit = NULL;
+    int demand = 0;
+
+    /* options for how everything after them is evaluated, in any order */
+    for (; argc >= 2; argc--, argv++) {
+        if (strcmp(argv[1], "--jit") == 0) {
+            if (jit == NULL) {
+                env->jit = jit = new_jit(JIT_THRESHOLD);
+            }
+        } else if (strncmp(argv[1], "-O", 2) == 0 && argv[1][2] >= '0' && argv[1][2] <= '0' + MAX_OPT_LEVEL
+                   && argv[1][3] == '\0') {
+            env->opt_level = argv[1][2] - '0';
+        } else if (strcmp(argv[1], "--verbose") == 0) {
+            env->opt_verbose = 1;
+        } else if (strcmp(argv[1], "--share") == 0) {
+            env->share = 1;
+        } else if (strcmp(argv[1], "--memo") == 0 && argc >= 3) {
+            add_memo(env, intern(argv[2], strlen(argv[2])), MEMO_CAPACITY);
+            argc--;
+            argv++;
+        } else if (strcmp(argv[1], "--demand") == 0) {
+            demand = 1;
+        } else {
+            break;
+        }
+    }
 
     /* determine invocation method */
     if (argc >= 2 && strcmp(argv[1], "--help") == 0) {
         printf(HELP_MSG);
     } else if (argc >= 2 && strcmp(argv[1], "--version") == 0) {
         printf(VERSION_MSG);
+    } else if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+        int fd = open(argv[2], O_RDONLY);
+
+        if (fd < 0) {
+            warnx("error: (E0015) couldn't open %s: %s", argv[2], strerror(errno));
+        } else {
+            process_file(fd, env, demand);
+            close(fd);
+        }
+    } else if (argc == 3 && strcmp(argv[1], "--emit-c") == 0) {
+        int fd = open(argv[2], O_RDONLY);
+
+        if (fd < 0) {
+            warnx("error: (E0015) couldn't open %s: %s", argv[2], strerror(errno));
+        } else {
+            emit_c(fd, env, stdout);
+            close(fd);
+        }
     } else if (argc == 1) {
         if (isatty(0)) {
             repl_loop(env);
         } else {
             /* input redirection */
-            process_file(stdin, env);
+            process_file(STDIN_FILENO, env, demand);
         }
     } else if (argc > 1) {
         char *expr, *result;
 
         /* process args as expr */
         expr = aggregate_args(argc, argv);
-        result = process_input(expr, env);
+        result = process_input(expr, strlen(expr), env);
 
         if (result != NULL) {
             printf("%s\n", result);
@@ -102,8 +180,14 @@ int main(int argc, char **argv) {
         free(result);
     }
 
+    if (env->opt_verbose) {
+        report_memos(env->memos);
+    }
+
+    free_memos(env->memos);
     free_env(env);
-    free_regexs();
+    free_jit(jit);
+    free_symbols();
     return 0;
 }
 
@@ -127,7 +211,7 @@ static void repl_loop(Env_t *env) {
             break;
         }
 
-        result = process_input(line, env);
+        result = process_input(line, strlen(line), env);
 
         if (result != NULL && strcmp(result, "") != 0) {
             printf("%s\n", result);
@@ -161,13 +245,27 @@ static char *aggregate_args(int argc, char **argv) {
     return expr;
 }
 
-static void process_file(FILE *file, Env_t *env) {
-    char line[BUF_SIZE] = {0}, *result = NULL, *result_to_print = NULL;
+static void process_file(int fd, Env_t *env, int demand) {
+    LineReader *reader;
+    const char *line;
+    char *result = NULL, *result_to_print = NULL;
+    size_t length;
 
-    while(fgets(line, BUF_SIZE, file)) {
-        line[strlen(line) - 1] = '\0'; /* strip newline */
+    if (demand) {
+        result_to_print = eval_on_demand(fd, env);
 
-        result = process_input(line, env);
+        if (result_to_print != NULL) {
+            printf("%s\n", result_to_print);
+        }
+
+        free(result_to_print);
+        return;
+    }
+
+    reader = open_reader(fd);
+
+    while ((line = next_line(reader, &length))) {
+        result = process_input(line, length, env);
 
         if (result != NULL && strcmp(result, "") != 0) {
             free(result_to_print);
@@ -182,16 +280,16 @@ static void process_file(FILE *file, Env_t *env) {
     }
 
     free(result_to_print);
-    fclose(file);
+    close_reader(reader);
 }
 
-static char *process_input(char *input, Env_t *env) {
+static char *process_input(const char *input, size_t length, Env_t *env) {
     TokenList *tok_l;
-    ExprTree *tree;
+    ExprTree *tree, *value;
     char *result;
 
     errno = 0;
-    tok_l = tokenize(input);
+    tok_l = tokenize(input, length);
 
     if (errno != 0) {
         free_token_list(tok_l);
@@ -206,18 +304,22 @@ static char *process_input(char *input, Env_t *env) {
         return NULL;
     }
     
-    eval(&tree, env);
-
-    if (errno != 0) {
-        free_token_list(tok_l);
-        free_expr_tree(tree);
-        return NULL;
+    if (env->share) {
+        share_subtrees(tree);
     }
 
-    result = eval_result_to_str(tree);
+    value = eval(tree, env);
 
     free_token_list(tok_l);
     free_expr_tree(tree);
 
+    if (errno != 0) {
+        free_expr_tree(value);
+        return NULL;
+    }
+
+    result = eval_result_to_str(value);
+    free_expr_tree(value);
+
     return result;
 }
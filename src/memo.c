@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include "memo.h"
+#include "env.h"
+#include "parser.h"
+#include "symbol.h"
+
+/*
+ * Calls have no side effects, so what one gives depends only on its arguments and on what the
+ * names its function reads are bound to. A memo keeps those names, found by following the
+ * definition through every function it calls, and its results hold until one of them is bound,
+ * rebound or unbound. That includes the function's own name, so redefining it starts the memo
+ * over. Bindings change all the time (every assignment), so the names are only looked at again
+ * once the env's version has moved on since they last were, and nothing is thrown away unless
+ * one of them is among what changed.
+ *
+ * Only calls on numbers that give a number without an error are remembered, so a hit never
+ * hides an error a call would have reported. Entries are chained in buckets by their arguments'
+ * hash, and listed from most to least recently used, the least being evicted once it's full.
+ */
+
+Memo *add_memo(Env_t *env, Symbol_t fun, int capacity) {
+    Memo *memo = calloc(1, sizeof(Memo));
+    int i;
+
+    memo->fun = fun;
+    memo->capacity = capacity;
+    memo->entries = malloc(capacity * sizeof(MemoEntry));
+
+    memo->num_buckets = 1;
+
+    while (memo->num_buckets < capacity) {
+        memo->num_buckets *= 2;
+    }
+
+    memo->buckets = malloc(memo->num_buckets * sizeof(int));
+
+    for (i = 0; i < memo->num_buckets; i++) {
+        memo->buckets[i] = -1;
+    }
+
+    memo->newest = -1;
+    memo->oldest = -1;
+    memo->next = env->memos;
+    env->memos = memo;
+
+    return memo;
+}
+
+void free_memos(Memo *memos) {
+    while (memos != NULL) {
+        Memo *next = memos->next;
+
+        free(memos->deps);
+        free(memos->entries);
+        free(memos->args);
+        free(memos->buckets);
+        free(memos);
+        memos = next;
+    }
+}
+
+/* warns how each memo did, in the order they were added */
+void report_memos(const Memo *memos) {
+    if (memos == NULL) {
+        return;
+    }
+
+    report_memos(memos->next);
+    warnx("%s: %ld hits, %ld misses, %ld evictions", symbol_name(memos->fun), memos->hits, memos->misses,
+          memos->evictions);
+}
+
+static void add_dep(Memo *memo, Symbol_t id) {
+    int i;
+
+    for (i = 0; i < memo->num_deps; i++) {
+        if (memo->deps[i] == id) {
+            return;
+        }
+    }
+
+    if (memo->num_deps == memo->deps_capacity) {
+        memo->deps_capacity = memo->deps_capacity == 0 ? 8 : memo->deps_capacity * 2;
+        memo->deps = realloc(memo->deps, memo->deps_capacity * sizeof(Symbol_t));
+    }
+
+    memo->deps[memo->num_deps++] = id;
+}
+
+/* adds every name value reads, which for a function is every name in its body */
+static void add_deps_of(Memo *memo, const ExprTree *value) {
+    int root = expr_tree_root(value), end = root, i;
+
+    if (value->nodes[root].expr == Fun) {
+        end = right_child(value, root);
+    }
+
+    for (i = end - value->nodes[end].size + 1; i <= end; i++) {
+        if (value->nodes[i].expr == ID) {
+            add_dep(memo, value->nodes[i].value.id);
+        }
+    }
+}
+
+/* drops every entry and starts over from what the memo's function is bound to now */
+static void flush_memo(Env_t *env, Memo *memo) {
+    Binding *binding = env_find(env, memo->fun);
+    const ExprTree *def = binding != NULL ? binding->data : NULL;
+    int params, i;
+
+    memo->def = def != NULL && def->nodes[expr_tree_root(def)].expr == Fun ? def : NULL;
+    memo->num_entries = 0;
+    memo->newest = -1;
+    memo->oldest = -1;
+
+    for (i = 0; i < memo->num_buckets; i++) {
+        memo->buckets[i] = -1;
+    }
+
+    /* deps doubles as the list of names still to follow */
+    memo->num_deps = 0;
+    add_dep(memo, memo->fun);
+
+    for (i = 0; i < memo->num_deps; i++) {
+        binding = env_find(env, memo->deps[i]);
+
+        if (binding != NULL) {
+            add_deps_of(memo, binding->data);
+        }
+    }
+
+    if (memo->def == NULL) {
+        return;
+    }
+
+    memo->num_params = 0;
+
+    for (params = left_child(memo->def, expr_tree_root(memo->def)); params != NO_NODE;
+         params = right_child(memo->def, params)) {
+        memo->num_params++;
+    }
+
+    memo->args = realloc(memo->args, memo->capacity * memo->num_params * sizeof(Value));
+}
+
+/*
+ * Returns the memo for calls to the Fun node fun in tree, or NULL if its function hasn't got one.
+ * That includes when tree isn't what the function is bound to now, e.g. an old definition still
+ * bound to another name.
+ */
+Memo *find_memo(Env_t *env, const ExprTree *tree, int fun) {
+    Memo *memo = env->memos;
+    int current, i;
+
+    while (memo != NULL && memo->fun != tree->nodes[fun].value.id) {
+        memo = memo->next;
+    }
+
+    if (memo == NULL) {
+        return NULL;
+    }
+
+    if (memo->def == NULL || memo->checked != env->version) {
+        current = memo->def != NULL;
+
+        for (i = 0; i < memo->num_deps && current; i++) {
+            current = env_changed(env, memo->deps[i]) <= memo->checked;
+        }
+
+        if (!current) {
+            flush_memo(env, memo);
+        }
+
+        memo->checked = env->version;
+    }
+
+    return memo->def == tree && fun == expr_tree_root(tree) ? memo : NULL;
+}
+
+static int are_numbers(const Value *values, int num_values) {
+    int i;
+
+    for (i = 0; i < num_values; i++) {
+        if (values[i].type == NODE_VALUE) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static unsigned int args_hash(const Value *args, int num_args) {
+    unsigned long long hash = 0;
+    int i;
+
+    /* as.i is all of a float's bits too, so 0.0 and -0.0 (say) are different arguments */
+    for (i = 0; i < num_args; i++) {
+        hash = (hash ^ (unsigned long long) args[i].type) * 0x9E3779B97F4A7C15ull;
+        hash = (hash ^ (unsigned long long) args[i].as.i) * 0x9E3779B97F4A7C15ull;
+    }
+
+    return (unsigned int) (hash >> 32);
+}
+
+static int same_args(const Value *a, const Value *b, int num_args) {
+    int i;
+
+    for (i = 0; i < num_args; i++) {
+        if (a[i].type != b[i].type || a[i].as.i != b[i].as.i) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* takes entry e out of the list by recency */
+static void unlink_entry(Memo *memo, int e) {
+    MemoEntry *entry = &(memo->entries[e]);
+
+    if (entry->newer != -1) {
+        memo->entries[entry->newer].older = entry->older;
+    } else {
+        memo->newest = entry->older;
+    }
+
+    if (entry->older != -1) {
+        memo->entries[entry->older].newer = entry->newer;
+    } else {
+        memo->oldest = entry->newer;
+    }
+}
+
+/* puts entry e first in the list by recency */
+static void link_newest(Memo *memo, int e) {
+    memo->entries[e].newer = -1;
+    memo->entries[e].older = memo->newest;
+
+    if (memo->newest != -1) {
+        memo->entries[memo->newest].newer = e;
+    } else {
+        memo->oldest = e;
+    }
+
+    memo->newest = e;
+}
+
+/* takes entry e out of its bucket */
+static void unchain_entry(Memo *memo, int e) {
+    int *link = &(memo->buckets[memo->entries[e].hash & (memo->num_buckets - 1)]);
+
+    while (*link != e) {
+        link = &(memo->entries[*link].chain);
+    }
+
+    *link = memo->entries[e].chain;
+}
+
+/* puts what the call on args gave in result and returns 0 if it's remembered, or returns -1 */
+int memo_get(Memo *memo, const Value *args, Value *result) {
+    unsigned int hash;
+    int e;
+
+    if (!are_numbers(args, memo->num_params)) {
+        return -1;
+    }
+
+    hash = args_hash(args, memo->num_params);
+
+    for (e = memo->buckets[hash & (memo->num_buckets - 1)]; e != -1; e = memo->entries[e].chain) {
+        if (memo->entries[e].hash == hash && same_args(&(memo->args[e * memo->num_params]), args, memo->num_params)) {
+            unlink_entry(memo, e);
+            link_newest(memo, e);
+            memo->hits++;
+            *result = memo->entries[e].result;
+            return 0;
+        }
+    }
+
+    memo->misses++;
+    return -1;
+}
+
+/* remembers what the call on args gave, if it's a number and there's been no error */
+void memo_put(Memo *memo, const Value *args, Value result) {
+    MemoEntry *entry;
+    int e;
+
+    if (result.type == NODE_VALUE || errno != 0 || !are_numbers(args, memo->num_params)) {
+        return;
+    }
+
+    if (memo->num_entries < memo->capacity) {
+        e = memo->num_entries++;
+    } else {
+        e = memo->oldest;
+        unlink_entry(memo, e);
+        unchain_entry(memo, e);
+        memo->evictions++;
+    }
+
+    entry = &(memo->entries[e]);
+    entry->hash = args_hash(args, memo->num_params);
+    entry->result = result;
+    memcpy(&(memo->args[e * memo->num_params]), args, memo->num_params * sizeof(Value));
+
+    entry->chain = memo->buckets[entry->hash & (memo->num_buckets - 1)];
+    memo->buckets[entry->hash & (memo->num_buckets - 1)] = e;
+    link_newest(memo, e);
+}
@@ -0,0 +1,51 @@
+#ifndef Memo_h
+#define Memo_h
+
+#include "env.h"
+#include "parser.h"
+#include "symbol.h"
+
+#define MEMO_CAPACITY 4096  /* calls mint --memo remembers the results of per function */
+
+typedef struct {
+    int newer;          /* the entries used just after and before this one, or -1 for none */
+    int older;
+    int chain;          /* the next entry in the same bucket, or -1 */
+    unsigned int hash;
+    Value result;
+} MemoEntry;
+
+/*
+ * The results of calls to one function, by their arguments. The env's memos are a list of these,
+ * one per function opted in.
+ */
+typedef struct memo {
+    Symbol_t fun;
+    const ExprTree *def;  /* the definition the results are from, or NULL for none */
+    unsigned long checked; /* the env's version when def and deps were last found to be current */
+    Symbol_t *deps;       /* every name def reads, itself and through the functions it calls included */
+    int num_deps;
+    int deps_capacity;
+    int num_params;
+    int capacity;
+    int num_entries;
+    MemoEntry *entries;
+    Value *args;          /* num_params arguments per entry */
+    int *buckets;         /* each the first entry in it or -1 */
+    int num_buckets;      /* a power of 2, at least capacity */
+    int newest;           /* the most and least recently used entries, or -1 when there are none */
+    int oldest;
+    long int hits;
+    long int misses;
+    long int evictions;
+    struct memo *next;
+} Memo;
+
+Memo *add_memo(Env_t *env, Symbol_t fun, int capacity);
+void free_memos(Memo *memos);
+void report_memos(const Memo *memos);
+Memo *find_memo(Env_t *env, const ExprTree *tree, int fun);
+int memo_get(Memo *memo, const Value *args, Value *result);
+void memo_put(Memo *memo, const Value *args, Value result);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef Number_h
+#define Number_h
+
+/*
+ * Conversions for numeric literals, reading straight out of the input with no copies or
+ * allocations. Both expect a slice the lexer has already matched: an optional leading '-', digits,
+ * and for floats a single '.'. Neither needs the slice to be null terminated.
+ */
+
+/* returns 0 on success, or ERANGE (leaving *num untouched) if the value doesn't fit in a long */
+int parse_int(const char *str, int length, long int *num);
+
+/* correctly rounded, i.e. gives the same double strtod would */
+double parse_float(const char *str, int length);
+
+#endif
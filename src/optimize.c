@@ -0,0 +1,615 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <err.h>
+#include "optimize.h"
+#include "eval.h"
+#include "vm.h"
+#include "memo.h"
+#include "env.h"
+#include "parser.h"
+#include "symbol.h"
+
+/*
+ * Rewrites of function bodies, done once when a function is defined. At level 1 they never change
+ * what a call on numbers gives:
+ *   constant folding     2 * 3 => 6 (mostly done by eval already, but rewrites make more)
+ *   identities           x * 1, 1 * x, x / 1, x - 0 => x (only for an int 1 or 0, since a float
+ *                        one would make an int argument a float)
+ *   strength reduction   x / 4.0 => x * 0.25, for divisors whose reciprocal is exact
+ * Level 2 adds rewrites that hold for real numbers but not always for ints and floats, much like
+ * a C compiler's fast math: x + 0 is 0 rather than -0 for x = -0.0, x^1 and x^2 go through pow
+ * (which rounds large ints) but x and x * x don't, and combining constants can change where an
+ * int overflow is caught or how a float rounds.
+ *   identities           x + 0, 0 + x, x^1 => x
+ *   strength reduction   x^2 => x * x, for a parameter or global x
+ *   reassociation        (x + 1) + 2 => x + 3, 2 * (x * 3) => x * 6, (x - 1) - 2 => x - 3, ...
+ * Results that aren't numbers (e.g. a call on a symbolic argument) come out simplified too.
+ *
+ * Before any of that, from level 1 on, calls to small functions are inlined: the call is replaced
+ * by the body the function is bound to at the time, with the call's arguments in place of its
+ * parameters, so a chain of helpers each calling the one before it collapses into one body as
+ * they're defined. Names are bound when a call is made rather than when the caller is defined,
+ * so the caller's definition is kept and it's defined over again whenever a function inlined into
+ * it is (see respecialize). A call is only inlined when it gives what the call would have:
+ *   - the function isn't the one being defined, nor has a memo (see memo.c)
+ *   - it takes as many parameters as the call has arguments
+ *   - its body has at most INLINE_SIZE nodes, and no call to one of its parameters
+ *   - an argument other than a number or a parameter of the caller is used exactly once, after
+ *     those before it, so it's still evaluated once and nothing can go without its errors
+ * Errors the body reports may then come before those of a later argument, rather than after.
+ */
+#define INLINE_SIZE 32
+#define MAX_REDEFINITIONS 16 /* how deep redefining a function redefines the ones it's inlined into */
+
+typedef struct {
+    ExprTree *tree;     /* where the body's rewritten, its subtree being the last in it */
+    ExprTree *scratch;  /* for printing a subtree in reports */
+    int level;
+    int verbose;        /* whether to report every rewrite */
+    Symbol_t fun;
+    Env_t *env;         /* what calls are to, when inlining */
+    Inlining *inlining; /* the functions inlined so far */
+} Optimizer;
+
+static int is_number(const ExprTree *tree, int node) {
+    return tree->nodes[node].expr == Int || tree->nodes[node].expr == Float;
+}
+
+static int is_int(const ExprTree *tree, int node, long int i) {
+    return tree->nodes[node].expr == Int && tree->nodes[node].value.i == i;
+}
+
+static int start_of(const ExprTree *tree, int node) {
+    return node - tree->nodes[node].size + 1;
+}
+
+static char *subtree_str(Optimizer *o, const ExprTree *tree, int node) {
+    truncate_expr_tree(o->scratch, 0);
+    copy_subtree(o->scratch, tree, node);
+
+    return eval_result_to_str(o->scratch);
+}
+
+static void report(Optimizer *o, const char *before, int node, const char *rewrite) {
+    char *after = subtree_str(o, o->tree, node);
+
+    warnx("%s: %s => %s (%s)", symbol_name(o->fun), before, after, rewrite);
+    free(after);
+}
+
+/* replaces the subtree at node with the subtree at sub, one of its own */
+static int replace_with_subtree(Optimizer *o, int node, int sub) {
+    int start = start_of(o->tree, node), size = o->tree->nodes[sub].size;
+
+    memmove(&(o->tree->nodes[start]), &(o->tree->nodes[start_of(o->tree, sub)]), size * sizeof(ExprNode));
+    truncate_expr_tree(o->tree, start + size);
+
+    return start + size - 1;
+}
+
+static int push_number(ExprTree *tree, Value v) {
+    int node = push_node(tree, v.type == INT_VALUE ? Int : Float, NO_NODE, NO_NODE);
+
+    if (v.type == INT_VALUE) {
+        tree->nodes[node].value.i = v.as.i;
+    } else {
+        tree->nodes[node].value.d = v.as.d;
+    }
+
+    return node;
+}
+
+/*
+ * Whether op on two constants gives a plain number, in *v, so it can be done now rather than at
+ * every call. Not if doing it sets errno (e.g. pow's ERANGE), which a call would fail on.
+ */
+static int fold(Operator_t op, Value n1, Value n2, Value *v) {
+    int saved = errno, folded;
+
+    errno = 0;
+    folded = compute_binop(op, n1, n2, v) == BINOP_OK && errno == 0;
+    errno = saved;
+
+    return folded;
+}
+
+/* whether x / d is always x * (1 / d), i.e. d is a power of two with a representable reciprocal */
+static int has_exact_reciprocal(double d) {
+    int exponent;
+
+    return d != 0 && isfinite(d) && isfinite(1 / d) && fabs(frexp(d, &exponent)) == 0.5;
+}
+
+/* splits a binop with a number on exactly one side into that number and the other side */
+static int split(const ExprTree *tree, int node, int *number, int *other) {
+    int left, right;
+
+    if (tree->nodes[node].expr != Binop) {
+        return 0;
+    }
+
+    left = left_child(tree, node);
+    right = right_child(tree, node);
+
+    if (is_number(tree, left) == is_number(tree, right)) {
+        return 0;
+    }
+
+    *number = is_number(tree, left) ? left : right;
+    *other = is_number(tree, left) ? right : left;
+
+    return 1;
+}
+
+/*
+ * Combines the constants of two nested operations, each with a number on one side, into one:
+ * (y op1 c1) op c2 => y new_op c. Returns 0 if there's nothing to do, or combining the constants
+ * doesn't give a plain number (e.g. it would overflow), and 1 with *node rewritten otherwise.
+ */
+static int reassociate(Optimizer *o, int *node) {
+    ExprTree *tree = o->tree;
+    int outer_number, inner, inner_number, y, y_left, sum;
+    Operator_t op = tree->nodes[*node].value.binop, inner_op, fold_op, new_op;
+    Value c1, c2, c;
+
+    if (!split(tree, *node, &outer_number, &inner) || !split(tree, inner, &inner_number, &y)) {
+        return 0;
+    }
+
+    inner_op = tree->nodes[inner].value.binop;
+    y_left = y == left_child(tree, inner);
+    c1 = node_value(tree, inner_number);
+    c2 = node_value(tree, outer_number);
+
+    if (op == Sub && outer_number != right_child(tree, *node)) {
+        return 0;
+    }
+
+    if ((op == Add && inner_op == Add) || (op == Mult && inner_op == Mult)) {
+        fold_op = op;          /* c2 + (y + c1), (c1 * y) * c2, ... */
+        new_op = op;
+    } else if (op == Sub && inner_op == Add) {
+        fold_op = Sub;         /* (y + c1) - c2 => y + (c1 - c2) */
+        new_op = Add;
+    } else if (op == Sub && inner_op == Sub && y_left) {
+        fold_op = Add;         /* (y - c1) - c2 => y - (c1 + c2) */
+        new_op = Sub;
+    } else if (op == Add && inner_op == Sub && y_left) {
+        fold_op = Sub;         /* (y - c1) + c2 => y + (c2 - c1) */
+        new_op = Add;
+        c = c1;
+        c1 = c2;
+        c2 = c;
+    } else {
+        return 0;
+    }
+
+    if (!fold(fold_op, c1, c2, &c)) {
+        return 0;
+    }
+
+    y = replace_with_subtree(o, *node, y);
+    sum = push_number(tree, c);
+    *node = push_node(tree, Binop, y, sum);
+    tree->nodes[*node].value.binop = new_op;
+
+    return 1;
+}
+
+/* applies a rewrite to the binop at *node, returning its name, or NULL if none applies */
+static const char *rewrite_once(Optimizer *o, int *node) {
+    ExprTree *tree = o->tree;
+    Operator_t op = tree->nodes[*node].value.binop;
+    int left = left_child(tree, *node), right = right_child(tree, *node);
+    Value v;
+
+    if (is_number(tree, left) && is_number(tree, right)) {
+        if (!fold(op, node_value(tree, left), node_value(tree, right), &v)) {
+            return NULL;
+        }
+
+        truncate_expr_tree(tree, start_of(tree, *node));
+        *node = push_number(tree, v);
+        return "constant folding";
+    }
+
+    if (((op == Mult || op == Div) && is_int(tree, right, 1)) || (op == Sub && is_int(tree, right, 0))) {
+        *node = replace_with_subtree(o, *node, left);
+        return "identity";
+    } else if (op == Mult && is_int(tree, left, 1)) {
+        *node = replace_with_subtree(o, *node, right);
+        return "identity";
+    }
+
+    if (op == Div && tree->nodes[right].expr == Float && has_exact_reciprocal(tree->nodes[right].value.d)) {
+        tree->nodes[right].value.d = 1 / tree->nodes[right].value.d;
+        tree->nodes[*node].value.binop = Mult;
+        return "strength reduction";
+    }
+
+    if (o->level < 2) {
+        return NULL;
+    }
+
+    if ((op == Add && is_int(tree, right, 0)) || (op == Exp && is_int(tree, right, 1))) {
+        *node = replace_with_subtree(o, *node, left);
+        return "identity";
+    } else if (op == Add && is_int(tree, left, 0)) {
+        *node = replace_with_subtree(o, *node, right);
+        return "identity";
+    }
+
+    /* a leaf, so it's just copied over the 2 next to it */
+    if (op == Exp && is_int(tree, right, 2) && (tree->nodes[left].expr == Local || tree->nodes[left].expr == ID)) {
+        tree->nodes[right] = tree->nodes[left];
+        tree->nodes[*node].value.binop = Mult;
+        return "strength reduction";
+    }
+
+    return reassociate(o, node) ? "reassociation" : NULL;
+}
+
+/* rewrites the binop at node (the last in the tree) until nothing more applies, returning the new root */
+static int simplify(Optimizer *o, int node) {
+    while (o->tree->nodes[node].expr == Binop) {
+        char *before = o->verbose ? subtree_str(o, o->tree, node) : NULL;
+        const char *rewrite = rewrite_once(o, &node);
+
+        if (rewrite != NULL && o->verbose) {
+            report(o, before, node, rewrite);
+        }
+
+        free(before);
+
+        if (rewrite == NULL) {
+            break;
+        }
+    }
+
+    return node;
+}
+
+/* copies the subtree of src at node to the end of the optimizer's tree, rewriting its binops */
+static int rewrite(Optimizer *o, const ExprTree *src, int node) {
+    const ExprNode *n = &(src->nodes[node]);
+    int left = left_child(src, node), right = right_child(src, node), copy;
+
+    left = left != NO_NODE ? rewrite(o, src, left) : NO_NODE;
+    right = right != NO_NODE ? rewrite(o, src, right) : NO_NODE;
+    copy = push_node(o->tree, n->expr, left, right);
+    o->tree->nodes[copy].value = n->value;
+
+    return n->expr == Binop ? simplify(o, copy) : copy;
+}
+
+/*
+ * Rewrites the body of the Fun node fun, the last node in tree, at the given level (0 for none),
+ * reporting each rewrite if verbose. Returns where fun ends up, which is still the last node.
+ */
+int optimize_fun(ExprTree *tree, int fun, int level, int verbose) {
+    Optimizer o;
+    ExprTree *src;
+
+    if (level <= 0) {
+        return fun;
+    }
+
+    src = new_expr_tree(tree->nodes[fun].size);
+    copy_subtree(src, tree, fun);
+    truncate_expr_tree(tree, start_of(tree, fun));
+
+    o.tree = tree;
+    o.scratch = new_expr_tree(src->length);
+    o.level = level;
+    o.verbose = verbose;
+    o.fun = src->nodes[expr_tree_root(src)].value.id;
+
+    fun = rewrite(&o, src, expr_tree_root(src));
+
+    free_expr_tree(o.scratch);
+    free_expr_tree(src);
+
+    return fun;
+}
+
+/* whether an argument can stand in for a parameter however often the body uses it */
+static int is_trivial(const ExprTree *tree, int node) {
+    return is_number(tree, node) || tree->nodes[node].expr == Local;
+}
+
+/*
+ * Returns the Fun node of what the call at app in src is to, with its tree in *callee and the
+ * call's arguments by parameter in args, if the call can be inlined (see above), or NO_NODE.
+ */
+static int find_inlinable(Optimizer *o, const ExprTree *src, int app, const ExprTree **callee, int *args) {
+    Symbol_t id = src->nodes[left_child(src, app)].value.id;
+    int fun, body, params, num_args = 0, last = -1, inlinable = 1, i;
+    const Memo *memo;
+    Binding *binding;
+    int *uses;
+
+    /* a call to a parameter has a Local rather than an ID */
+    if (src->nodes[left_child(src, app)].expr != ID || id == o->fun) {
+        return NO_NODE;
+    }
+
+    for (memo = o->env->memos; memo != NULL; memo = memo->next) {
+        if (memo->fun == id) {
+            return NO_NODE;
+        }
+    }
+
+    binding = env_find(o->env, id);
+
+    if (binding == NULL || binding->data->nodes[expr_tree_root(binding->data)].expr != Fun) {
+        return NO_NODE;
+    }
+
+    *callee = binding->data;
+    fun = expr_tree_root(*callee);
+    body = right_child(*callee, fun);
+
+    if ((*callee)->nodes[body].size > INLINE_SIZE) {
+        return NO_NODE;
+    }
+
+    for (i = right_child(src, app), params = left_child(*callee, fun); i != NO_NODE && params != NO_NODE;
+         i = right_child(src, i), params = right_child(*callee, params)) {
+        args[num_args++] = left_child(src, i);
+    }
+
+    if (i != NO_NODE || params != NO_NODE) {
+        return NO_NODE;
+    }
+
+    uses = calloc(num_args + 1, sizeof(int));
+
+    for (i = start_of(*callee, body); i <= body && inlinable; i++) {
+        const ExprNode *n = &((*callee)->nodes[i]);
+
+        switch (n->expr) {
+            case Int:
+            case Float:
+            case ID:
+            case Binop:
+            case Argument:
+                break;
+            case Application:
+                inlinable = (*callee)->nodes[left_child(*callee, i)].expr == ID;
+                break;
+            case Local:
+                uses[n->value.local.slot]++;
+
+                if (!is_trivial(src, args[n->value.local.slot])) {
+                    inlinable = n->value.local.slot > last;
+                    last = n->value.local.slot;
+                }
+
+                break;
+            default:
+                inlinable = 0;
+                break;
+        }
+    }
+
+    for (i = 0; i < num_args && inlinable; i++) {
+        inlinable = uses[i] == 1 || is_trivial(src, args[i]);
+    }
+
+    free(uses);
+
+    return inlinable ? fun : NO_NODE;
+}
+
+static void add_callee(Inlining *inlining, Symbol_t id) {
+    int i;
+
+    for (i = 0; i < inlining->num_callees; i++) {
+        if (inlining->callees[i] == id) {
+            return;
+        }
+    }
+
+    inlining->callees = realloc(inlining->callees, (inlining->num_callees + 1) * sizeof(Symbol_t));
+    inlining->callees[inlining->num_callees++] = id;
+}
+
+static int inline_expr(Optimizer *o, const ExprTree *src, int node);
+
+/* copies the subtree of callee at node to the end of the optimizer's tree, each Local becoming its argument */
+static int substitute(Optimizer *o, const ExprTree *callee, int node, const ExprTree *src, const int *args) {
+    const ExprNode *n = &(callee->nodes[node]);
+    int left = left_child(callee, node), right = right_child(callee, node), copy;
+
+    if (n->expr == Local) {
+        return inline_expr(o, src, args[n->value.local.slot]);
+    }
+
+    left = left != NO_NODE ? substitute(o, callee, left, src, args) : NO_NODE;
+    right = right != NO_NODE ? substitute(o, callee, right, src, args) : NO_NODE;
+    copy = push_node(o->tree, n->expr, left, right);
+    o->tree->nodes[copy].value = n->value;
+
+    return copy;
+}
+
+/* copies the subtree of src at node to the end of the optimizer's tree, inlining what calls it can */
+static int inline_expr(Optimizer *o, const ExprTree *src, int node) {
+    const ExprNode *n = &(src->nodes[node]);
+    int left = left_child(src, node), right = right_child(src, node), copy;
+
+    if (n->expr == Application) {
+        const ExprTree *callee;
+        int *args = malloc((src->nodes[node].size + 1) * sizeof(int));
+        int fun = find_inlinable(o, src, node, &callee, args);
+
+        if (fun != NO_NODE) {
+            char *before = o->verbose ? subtree_str(o, src, node) : NULL;
+
+            copy = substitute(o, callee, right_child(callee, fun), src, args);
+            add_callee(o->inlining, src->nodes[left].value.id);
+
+            if (o->verbose) {
+                report(o, before, copy, "inlining");
+            }
+
+            free(before);
+            free(args);
+            return copy;
+        }
+
+        free(args);
+    }
+
+    left = left != NO_NODE ? inline_expr(o, src, left) : NO_NODE;
+    right = right != NO_NODE ? inline_expr(o, src, right) : NO_NODE;
+    copy = push_node(o->tree, n->expr, left, right);
+    o->tree->nodes[copy].value = n->value;
+
+    return copy;
+}
+
+/*
+ * Inlines what calls it can in the body of the Fun node fun, the last node in tree, if env's
+ * optimization level is 1 or more and inlining isn't turned off. The functions inlined are put in
+ * inlining, along with fun as it was if there were any, and which is for respecialize once fun's
+ * bound. Returns where fun ends up, which is still the last node.
+ */
+int inline_calls(ExprTree *tree, int fun, Env_t *env, Inlining *inlining) {
+    Optimizer o;
+    ExprTree *src;
+
+    inlining->fun = tree->nodes[fun].value.id;
+    inlining->source = NULL;
+    inlining->callees = NULL;
+    inlining->num_callees = 0;
+
+    if (env->opt_level <= 0 || env->no_inlining) {
+        return fun;
+    }
+
+    src = new_expr_tree(tree->nodes[fun].size);
+    copy_subtree(src, tree, fun);
+    truncate_expr_tree(tree, start_of(tree, fun));
+
+    o.tree = tree;
+    o.scratch = new_expr_tree(src->length);
+    o.level = env->opt_level;
+    o.verbose = env->opt_verbose;
+    o.fun = inlining->fun;
+    o.env = env;
+    o.inlining = inlining;
+
+    fun = inline_expr(&o, src, expr_tree_root(src));
+
+    free_expr_tree(o.scratch);
+
+    if (inlining->num_callees > 0) {
+        inlining->source = src;
+    } else {
+        free_expr_tree(src);
+    }
+
+    return fun;
+}
+
+static int has_callee(const Inlining *inlining, Symbol_t id) {
+    int i;
+
+    for (i = 0; i < inlining->num_callees; i++) {
+        if (inlining->callees[i] == id) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void redefine_callers(Env_t *env, Symbol_t id, int depth);
+
+/*
+ * Defines the function of env's i-th inlining over from its source, inlining what its callees are
+ * bound to now, then does the same for those it's inlined into. Past MAX_REDEFINITIONS nothing is
+ * inlined, which ends redefinitions going round functions inlined into each other.
+ */
+static void redefine(Env_t *env, int i, int depth) {
+    Inlining *inlining = &(env->inlinings[i]), redone;
+    ExprTree *tree, *bound;
+    int fun;
+
+    if (env_find(env, inlining->fun) == NULL) {
+        return;
+    }
+
+    tree = new_expr_tree(inlining->source->length);
+    fun = copy_subtree(tree, inlining->source, expr_tree_root(inlining->source));
+
+    if (depth < MAX_REDEFINITIONS) {
+        fun = inline_calls(tree, fun, env, &redone);
+    } else {
+        redone.source = NULL;
+        redone.callees = NULL;
+        redone.num_callees = 0;
+    }
+
+    fun = optimize_fun(tree, fun, env->opt_level, env->opt_verbose);
+
+    update_env(env, inlining->fun, tree, fun);
+    bound = env_find(env, inlining->fun)->data;
+    bound->code = compile_fun(bound, expr_tree_root(bound));
+
+    /* the source's kept, and the callees are now just those inlined this time */
+    free(inlining->callees);
+    inlining->callees = redone.callees;
+    inlining->num_callees = redone.num_callees;
+
+    free_expr_tree(redone.source);
+    free_expr_tree(tree);
+
+    redefine_callers(env, inlining->fun, depth + 1);
+}
+
+static void redefine_callers(Env_t *env, Symbol_t id, int depth) {
+    int i;
+
+    /* redefining only changes an inlining's callees, never which inlinings there are */
+    for (i = 0; i < env->num_inlinings; i++) {
+        if (has_callee(&(env->inlinings[i]), id)) {
+            redefine(env, i, depth);
+        }
+    }
+}
+
+/*
+ * To be called once id's been bound to something new, with how it was inlined into if it's a
+ * function (see inline_calls), or NULL. Keeps the inlining, which env then owns, in place of what
+ * id had before, and defines every function with id's old body inlined into it over again.
+ */
+void respecialize(Env_t *env, Symbol_t id, const Inlining *inlining) {
+    int i;
+
+    i = 0;
+
+    while (i < env->num_inlinings && env->inlinings[i].fun != id) {
+        i++;
+    }
+
+    if (i < env->num_inlinings) {
+        free_expr_tree(env->inlinings[i].source);
+        free(env->inlinings[i].callees);
+        env->inlinings[i] = env->inlinings[--env->num_inlinings];
+    }
+
+    if (inlining != NULL && inlining->num_callees > 0) {
+        if (env->num_inlinings == env->inlinings_capacity) {
+            env->inlinings_capacity = env->inlinings_capacity == 0 ? 8 : env->inlinings_capacity * 2;
+            env->inlinings = realloc(env->inlinings, env->inlinings_capacity * sizeof(Inlining));
+        }
+
+        env->inlinings[env->num_inlinings++] = *inlining;
+    }
+
+    redefine_callers(env, id, 0);
+}
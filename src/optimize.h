@@ -0,0 +1,13 @@
+#ifndef Optimize_h
+#define Optimize_h
+
+#include "env.h"
+#include "parser.h"
+
+#define MAX_OPT_LEVEL 2
+
+int optimize_fun(ExprTree *tree, int fun, int level, int verbose);
+int inline_calls(ExprTree *tree, int fun, Env_t *env, Inlining *inlining);
+void respecialize(Env_t *env, Symbol_t id, const Inlining *inlining);
+
+#endif
@@ -5,19 +5,25 @@
 #include <err.h>
 #include "parser.h"
 #include "lexer.h"
+#include "symbol.h"
 
 #define MAX_NODE_LEN 6      /* longest node name is Assign = 6 chars                           */
-#define MAX_NODE_VAL_LEN 50 /* arbitrary upper limit on node value size (e.g. a variable name) */
+#define MAX_NODE_VAL_LEN 64 /* arbitrary upper limit on node value size (e.g. a Local's name and slot) */
 #define MAX_NODE_STR_LEN MAX_NODE_LEN + MAX_NODE_VAL_LEN
 
-static TokenList *match_token(TokenList *tok_l, Tok_t tok) {
+/* returns the kind of the token at pos, or -1 once pos is past the end of the list */
+static int peek(const TokenList *tok_l, int pos) {
+    return pos < tok_l->length ? (int) tok_l->toks[pos].token : -1;
+}
+
+static int match_token(const TokenList *tok_l, int pos, Tok_t tok) {
     char *expected, *input, *arg;
     
     if (errno != 0) {
-        return NULL;
+        return tok_l->length;
     }
-    if (tok_l != NULL && tok_l->token == tok) {
-        return tok_l->next;
+    if (peek(tok_l, pos) == tok) {
+        return pos + 1;
     }
 
     switch (tok) {
@@ -31,15 +37,19 @@ static TokenList *match_token(TokenList *tok_l, Tok_t tok) {
             strcpy(expected, "a number");
             break;
         default: {
-            TokenList t = {0};
+            Token t = {0};
+            TokenList t_l = {0};
+
             t.token = tok;
+            t_l.toks = &t;
+            t_l.length = 1;
 
-            expected = token_value_to_str(&t);
+            expected = token_value_to_str(&t_l, 0);
         }
     }
 
-    input = token_values_to_str(tok_l);
-    arg = token_value_to_str(tok_l);
+    input = token_values_to_str(tok_l, pos);
+    arg = token_value_to_str(tok_l, pos);
 
     errno = EINVAL;
     warnx("error: (E1001) expected %s from remaining input \"%s\", but got \"%s\" instead", expected, input, arg);
@@ -48,49 +58,63 @@ static TokenList *match_token(TokenList *tok_l, Tok_t tok) {
     free(input);
     free(arg);
 
-    return NULL;
+    return tok_l->length;
 }
 
-static ExprTree *parse_input(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_function_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_parameter_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_assignment_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_additive_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_multiplicative_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_exponent_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_application_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_arg_expr(TokenList *tok_l, TokenList **out_tl);
-static ExprTree *parse_primary_expr(TokenList *tok_l, TokenList **out_tl);
+static int parse_input(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree);
+static int parse_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree);
+static int parse_function_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree);
+static int parse_parameter_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree);
+static int parse_assignment_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree);
+static int parse_additive_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree);
+static int parse_primary_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree);
 
+/*
+ * Every node is built from a token of its own (an operator, a literal, fn, a paren or a comma),
+ * so the arena is sized from the token count up front and a parse makes a single allocation for
+ * all of its nodes.
+ *
+ * The parse functions push nodes in post-order and return the index of the root they built, or
+ * NO_NODE. A function that returns NO_NODE leaves the arena as it found it.
+ */
 ExprTree *parse(TokenList *tok_l) {
-    TokenList *t;
-    return parse_input(tok_l, &t);
+    ExprTree *tree;
+    int t;
+
+    if (tok_l == NULL) {
+        return NULL;
+    }
+
+    tree = new_expr_tree(tok_l->length);
+
+    if (parse_input(tok_l, 0, &t, tree) == NO_NODE) {
+        truncate_expr_tree(tree, 0);
+    }
+
+    return tree;
 }
 
 /*
  * Input -> Expr \n | Comment \n | Expr Comment \n
  */
-static ExprTree *parse_input(TokenList *tok_l, TokenList **out_tl) {
-    ExprTree *expr = NULL;
-    TokenList *t = tok_l;
+static int parse_input(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree) {
+    int expr = NO_NODE, t = pos;
 
-    if (tok_l == NULL) {
-        return NULL;
+    if (peek(tok_l, pos) == -1) {
+        *out_pos = pos;
+        return NO_NODE;
     }
 
-    if (tok_l->token != TOK_COMMENT) {
-        expr = parse_expr(tok_l, &t);
-    } else {
-        t = tok_l;
+    if (peek(tok_l, pos) != TOK_COMMENT) {
+        expr = parse_expr(tok_l, pos, &t, tree);
     }
 
-    if (t != NULL && t->token == TOK_COMMENT) {
-        t = match_token(t, TOK_COMMENT);
+    if (peek(tok_l, t) == TOK_COMMENT) {
+        t = match_token(tok_l, t, TOK_COMMENT);
     }
 
-    if (errno == 0 && t != NULL) {
-        char *tok_l_str = token_values_to_str(t);
+    if (errno == 0 && t < tok_l->length) {
+        char *tok_l_str = token_values_to_str(tok_l, t);
 
         errno = EINVAL;
         warnx("error: (E1002) parsing ended early with remaining tokens: \"%s\"", tok_l_str);
@@ -98,507 +122,739 @@ static ExprTree *parse_input(TokenList *tok_l, TokenList **out_tl) {
         free(tok_l_str);
     }
     
+    *out_pos = t;
     return expr;
 }
 
 /*
  * Expr -> FunctionExpr | AssignmentExpr | AdditiveExpr
  */
-static ExprTree *parse_expr(TokenList *tok_l, TokenList **out_tl) {
-    ExprTree *add_expr;
-    TokenList *t;
-
+static int parse_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree) {
     if (errno != 0) {
-        return NULL;
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    switch (tok_l->token) {
+    switch (peek(tok_l, pos)) {
         case TOK_FUN:
-            return parse_function_expr(tok_l, out_tl);
+            return parse_function_expr(tok_l, pos, out_pos, tree);
         case TOK_ID:
             #pragma GCC diagnostic push
             #pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
             /* The above is to ignore a warning for implicit fall through caused by this case */
-            if (tok_l->next != NULL && tok_l->next->token == TOK_EQUAL) {
-                return parse_assignment_expr(tok_l, out_tl);
+            if (peek(tok_l, pos + 1) == TOK_EQUAL) {
+                return parse_assignment_expr(tok_l, pos, out_pos, tree);
             }
             #pragma GCC diagnostic pop
         default:
-            add_expr = parse_additive_expr(tok_l, &t);
-
-            *out_tl = t;
-            return add_expr;
+            return parse_additive_expr(tok_l, pos, out_pos, tree);
     }
 }
 
 /*
  * FunctionExpr -> fn ID(ParamExpr) = AdditiveExpr \n
  */
-static ExprTree *parse_function_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2, *t3, *t4, *t5, *t6, *t7;
-    ExprTree *fun_expr, *param_expr, *body_expr;
-    char *id, *id_cpy;
+static int parse_function_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree) {
+    int t, t2, t3, t4, t5, t6, t7, mark = tree->length;
+    int fun_expr, param_expr, body_expr;
+    Symbol_t id;
 
     if (errno != 0) {
-        return NULL;
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    t = match_token(tok_l, TOK_FUN);
-    t2 = match_token(t, TOK_ID);
+    t = match_token(tok_l, pos, TOK_FUN);
+    t2 = match_token(tok_l, t, TOK_ID);
 
     if (errno != 0) {
-        *out_tl = NULL;
-        return NULL;
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    id = t->value.id;
-    id_cpy = malloc(strlen(id) + 1);
-    strcpy(id_cpy, id);
+    id = tok_l->toks[t].value.id;
 
-    t3 = match_token(t2, TOK_LPAREN);
+    t3 = match_token(tok_l, t2, TOK_LPAREN);
 
-    param_expr = parse_parameter_expr(t3, &t4);
+    param_expr = parse_parameter_expr(tok_l, t3, &t4, tree);
 
     if (errno != 0) {
-        free(id_cpy);
-        free_expr_tree(param_expr);
-        return NULL;
+        truncate_expr_tree(tree, mark);
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    t5 = match_token(t4, TOK_RPAREN);
-    t6 = match_token(t5, TOK_EQUAL);
+    t5 = match_token(tok_l, t4, TOK_RPAREN);
+    t6 = match_token(tok_l, t5, TOK_EQUAL);
 
-    body_expr = parse_additive_expr(t6, &t7);
+    body_expr = parse_additive_expr(tok_l, t6, &t7, tree);
 
-    fun_expr = malloc(sizeof(ExprTree));
-    fun_expr->expr = Fun;
-    fun_expr->value.id = id_cpy;
-    fun_expr->left = param_expr;
-    fun_expr->right = body_expr;
+    fun_expr = push_node(tree, Fun, param_expr, body_expr);
+    tree->nodes[fun_expr].value.id = id;
 
-    *out_tl = t7;
+    *out_pos = t7;
     return fun_expr;
 }
 
 /*
  * ParameterExpr -> ID, ParamExpr | ID
+ *
+ * The IDs are pushed first and the Param chain is then built from the last one back, which
+ * leaves each Param's subtree contiguous (its ID, the IDs after it, then their Params).
  */
-static ExprTree *parse_parameter_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2, *t3;
-    ExprTree *parameter_expr, *param_expr, *id_expr;
+static int parse_parameter_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree) {
+    int t = pos, mark = tree->length, num_params = 0, param_expr = NO_NODE, i;
 
     if (errno != 0) {
-        return NULL;
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    if (tok_l != NULL && tok_l->token != TOK_ID) {
-        char *tok_str = token_value_to_str(tok_l);
-
-        errno = EINVAL;
-        warnx("error: (E1003) malformed parameter \"%s\"", tok_str);
+    do {
+        if (num_params > 0) {
+            t = match_token(tok_l, t, TOK_COMMA);
+        }
 
-        free(tok_str);
-        *out_tl = NULL;
-        return NULL;
-    }
+        if (t < tok_l->length && peek(tok_l, t) != TOK_ID) {
+            char *tok_str = token_value_to_str(tok_l, t);
 
-    id_expr = parse_primary_expr(tok_l, &t);
+            errno = EINVAL;
+            warnx("error: (E1003) malformed parameter \"%s\"", tok_str);
 
-    if (errno != 0) {
-        free_expr_tree(id_expr);
-        return NULL;
-    }
+            free(tok_str);
+        } else {
+            parse_primary_expr(tok_l, t, &t, tree);
+            num_params++;
+        }
 
-    if (t != NULL && t->token == TOK_COMMA) {
-        t2 = match_token(t, TOK_COMMA);
-        param_expr = parse_parameter_expr(t2, &t3);
+        if (errno != 0) {
+            truncate_expr_tree(tree, mark);
+            *out_pos = tok_l->length;
+            return NO_NODE;
+        }
+    } while (peek(tok_l, t) == TOK_COMMA);
 
-        *out_tl = t3;
-    } else {
-        param_expr = NULL;
-        
-        *out_tl = t;
+    for (i = num_params - 1; i >= 0; i--) {
+        param_expr = push_node(tree, Parameter, mark + i, param_expr);
     }
 
-    parameter_expr = malloc(sizeof(ExprTree));
-    parameter_expr->expr = Parameter;
-    parameter_expr->left = id_expr;
-    parameter_expr->right = param_expr;
-
-    return parameter_expr;
+    *out_pos = t;
+    return param_expr;
 }
 
 /*
  * AssignmentExpr -> ID = AdditiveExpr \n
  */
-static ExprTree *parse_assignment_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2, *t3;
-    ExprTree *assign_expr, *id_expr, *val_expr;
+static int parse_assignment_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree) {
+    int t, t2, t3;
+    int id_expr, val_expr;
 
     if (errno != 0) {
-        return NULL;
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    id_expr = parse_primary_expr(tok_l, &t);
-    t2 = match_token(t, TOK_EQUAL);
-    val_expr = parse_additive_expr(t2, &t3);
-
-    assign_expr = malloc(sizeof(ExprTree));
-    assign_expr->expr = Assign;
-    assign_expr->left = id_expr;
-    assign_expr->right = val_expr;
+    id_expr = parse_primary_expr(tok_l, pos, &t, tree);
+    t2 = match_token(tok_l, t, TOK_EQUAL);
+    val_expr = parse_additive_expr(tok_l, t2, &t3, tree);
 
-    *out_tl = t3;
-    return assign_expr;
+    *out_pos = t3;
+    return push_node(tree, Assign, id_expr, val_expr);
 }
 
-/*
- * AdditiveExpr -> AdditiveExpr AdditiveOperator MultiplicativeExpr | MultiplicativeExpr
- * AdditiveOperator -> + | -
- */
-static ExprTree *parse_additive_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2;
-    ExprTree *additive_expr, *add_expr, *mult_expr;
+typedef enum {
+    FRAME_BINOP, /* an operator waiting on its right operand */
+    FRAME_PAREN, /* an open paren waiting on its ) */
+    FRAME_APP    /* a function application waiting on its next argument or its ) */
+} Frame_t;
+
+typedef struct {
+    Frame_t frame;
+    Operator_t op;
+    int base;     /* operands below this index belong to enclosing frames (for FRAME_APP, its ID) */
+    int num_args; /* arguments parsed so far (FRAME_APP only) */
+    int mark;     /* tree length where the argument being parsed starts (FRAME_APP only) */
+} Frame;
+
+/* the operand and frame stacks that stand in for recursion in parse_additive_expr */
+typedef struct {
+    Frame *frames;
+    int num_frames;
+    int *operands;
+    int num_operands;
+} ParseStack;
+
+static int precedence(Operator_t op) {
+    switch (op) {
+        case Add:
+        case Sub:
+            return 1;
+        case Mult:
+        case Div:
+            return 2;
+        default:
+            return 3;
+    }
+}
 
-    if (errno != 0) {
-        return NULL;
+/* returns the operator a token stands for, or -1 if it isn't a binary operator */
+static int binop_of(int tok) {
+    switch (tok) {
+        case TOK_ADD:
+            return Add;
+        case TOK_SUB:
+            return Sub;
+        case TOK_MULT:
+            return Mult;
+        case TOK_DIV:
+            return Div;
+        case TOK_EXP:
+            return Exp;
+        default:
+            return -1;
     }
+}
 
-    mult_expr = parse_multiplicative_expr(tok_l, &t);
+static Frame *push_frame(ParseStack *stack, Frame_t frame) {
+    Frame *f = &(stack->frames[stack->num_frames++]);
 
-    if (t == NULL || (t->token != TOK_ADD && t->token != TOK_SUB)) {
-        *out_tl = t;
-        return mult_expr;
-    }
+    f->frame = frame;
+    f->base = stack->num_operands;
+    f->num_args = 0;
 
-    add_expr = mult_expr;
-    while (t != NULL && (t->token == TOK_ADD || t->token == TOK_SUB)) {
-        Tok_t op = t->token;
+    return f;
+}
 
-        t2 = match_token(t, op);
-        mult_expr = parse_multiplicative_expr(t2, &t);
+/*
+ * Pops an operator frame and replaces its operands on the operand stack with a Binop over them.
+ * The right operand is missing when parsing failed before reaching it.
+ */
+static void reduce_binop(ParseStack *stack, ExprTree *tree) {
+    Frame *f = &(stack->frames[--stack->num_frames]);
+    int right = stack->num_operands > f->base ? stack->operands[--stack->num_operands] : NO_NODE;
+    int left = stack->operands[stack->num_operands - 1];
+    int binop = push_node(tree, Binop, left, right);
+
+    tree->nodes[binop].value.binop = f->op;
+    stack->operands[stack->num_operands - 1] = binop;
+}
+
+/*
+ * Pops an application frame and replaces its ID and arguments on the operand stack with an App.
+ * Like parameters, the Arg chain is built from the last argument back. If parsing failed part way
+ * through an argument, that argument's nodes are dropped and the App keeps the ones before it.
+ */
+static void reduce_application(ParseStack *stack, ExprTree *tree) {
+    Frame *f = &(stack->frames[--stack->num_frames]);
+    int arg_expr = NO_NODE, app_expr, i;
 
-        additive_expr = malloc(sizeof(ExprTree));
-        additive_expr->expr = Binop;
-        additive_expr->value.binop = (op == TOK_ADD) ? Add : Sub;
-        additive_expr->left = add_expr;
-        additive_expr->right = mult_expr;
+    truncate_expr_tree(tree, f->mark);
+    stack->num_operands = f->base + f->num_args;
 
-        add_expr = additive_expr;
+    for (i = f->num_args - 1; i >= 0; i--) {
+        arg_expr = push_node(tree, Argument, stack->operands[f->base + i], arg_expr);
     }
 
-    *out_tl = t;
-    return additive_expr;
+    stack->num_operands = f->base;
+    app_expr = push_node(tree, Application, stack->operands[f->base - 1], arg_expr);
+    stack->operands[f->base - 1] = app_expr;
 }
 
 /*
- * MultiplicativeExpr -> MultiplicativeExpr MultiplicativeOperator ApplicationExpr | ApplicationExpr
+ * AdditiveExpr -> AdditiveExpr AdditiveOperator MultiplicativeExpr | MultiplicativeExpr
+ * AdditiveOperator -> + | -
+ * MultiplicativeExpr -> MultiplicativeExpr MultiplicativeOperator ExponentExpr | ExponentExpr
  * MultiplicativeOperator -> * | /
+ * ExponentExpr -> ApplicationExpr ^ ApplicationExpr | ApplicationExpr
+ * ApplicationExpr -> ID(ArgExpr) | PrimaryExpr
+ * ArgExpr -> AdditiveExpr, ArgExpr | AdditiveExpr
+ * PrimaryExpr -> int | float | ID | (AdditiveExpr)
+ *
+ * All of the above are parsed here by precedence climbing over explicit operand and frame
+ * stacks instead of one C call per production, so parsing takes linear time and constant C stack
+ * however deeply the input nests. Both stacks are bounded by the number of tokens left.
+ *
+ * The loop alternates between expecting an operand and expecting an operator. An operator first
+ * reduces any operators on the stack that bind at least as tightly (so + - * / group left to
+ * right), except that ^ doesn't chain: a ^ right after an exponent's right operand ends the
+ * expression the same way any other unexpected token does. At the end of an expression the
+ * innermost open frame decides what comes next: a paren wants a ), an application wants a , or
+ * a ), and with no frames open the expression is done and the caller handles what follows.
  */
-static ExprTree *parse_multiplicative_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2;
-    ExprTree *multiplicative_expr, *mult_expr, *exp_expr;
+static int parse_additive_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree) {
+    int t = pos, expect_operand = 1, add_expr, op;
+    ParseStack stack;
+    Frame *top;
 
     if (errno != 0) {
-        return NULL;
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    exp_expr = parse_exponent_expr(tok_l, &t);
+    stack.frames = malloc((tok_l->length - pos + 1) * sizeof(Frame));
+    stack.operands = malloc((tok_l->length - pos + 1) * sizeof(int));
+    stack.num_frames = 0;
+    stack.num_operands = 0;
 
-    if (t == NULL || (t->token != TOK_MULT && t->token != TOK_DIV)) {
-        *out_tl = t;
-        return exp_expr;
-    }
+    while (errno == 0) {
+        top = stack.num_frames > 0 ? &(stack.frames[stack.num_frames - 1]) : NULL;
 
-    mult_expr = exp_expr;
-    while (t != NULL && (t->token == TOK_MULT || t->token == TOK_DIV)) {
-        Tok_t op = t->token;
+        if (expect_operand) {
+            if (t >= tok_l->length) {
+                errno = EINVAL;
+                warnx("error: (E1004) incomplete expression");
+                break;
+            }
 
-        t2 = match_token(t, op);
-        exp_expr = parse_exponent_expr(t2, &t);
+            switch (tok_l->toks[t].token) {
+                case TOK_LPAREN:
+                    push_frame(&stack, FRAME_PAREN);
+                    t++;
+                    continue;
+                case TOK_ID:
+                    #pragma GCC diagnostic push
+                    #pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
+                    /* ignoring warning because IDs can mean fn application (so continue) or just a variable (so fallthrough) */
+                    if (peek(tok_l, t + 1) == TOK_LPAREN) {
+                        stack.operands[stack.num_operands++] = parse_primary_expr(tok_l, t, &t, tree);
+                        push_frame(&stack, FRAME_APP)->mark = tree->length;
+                        t++;
+                        continue;
+                    }
+                    #pragma GCC diagnostic pop
+                case TOK_INT:
+                case TOK_FLOAT:
+                    stack.operands[stack.num_operands++] = parse_primary_expr(tok_l, t, &t, tree);
+                    expect_operand = 0;
+                    continue;
+                default: {
+                    char *tok_l_str = token_values_to_str(tok_l, t);
+
+                    errno = EINVAL;
+                    warnx("error: (E1006) failed to find ID or number with remaining input: \"%s\"", tok_l_str);
+                    free(tok_l_str);
+                    break;
+                }
+            }
 
-        multiplicative_expr = malloc(sizeof(ExprTree));
-        multiplicative_expr->expr = Binop;
-        multiplicative_expr->value.binop = (op == TOK_MULT) ? Mult : Div;
-        multiplicative_expr->left = mult_expr;
-        multiplicative_expr->right = exp_expr;
+            break;
+        }
 
-        mult_expr = multiplicative_expr;
-    }
+        op = binop_of(peek(tok_l, t));
 
-    *out_tl = t;
-    return multiplicative_expr;
-}
+        if (op != -1 && !(op == Exp && top != NULL && top->frame == FRAME_BINOP && top->op == Exp)) {
+            while (top != NULL && top->frame == FRAME_BINOP && precedence(top->op) >= precedence(op)) {
+                reduce_binop(&stack, tree);
+                top = stack.num_frames > 0 ? &(stack.frames[stack.num_frames - 1]) : NULL;
+            }
 
-/*
- * ExponentExpr -> ApplicationExpr ^ ApplicationExpr | ApplicationExpr
- */
-static ExprTree *parse_exponent_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2, *t3;
-    ExprTree *exponent_expr, *app_expr1, *app_expr2;
+            push_frame(&stack, FRAME_BINOP)->op = op;
+            expect_operand = 1;
+            t++;
+            continue;
+        }
 
-    if (errno != 0) {
-        return NULL;
-    }
+        /* the expression (or argument, or parenthesized expression) ends here */
+        while (top != NULL && top->frame == FRAME_BINOP) {
+            reduce_binop(&stack, tree);
+            top = stack.num_frames > 0 ? &(stack.frames[stack.num_frames - 1]) : NULL;
+        }
 
-    app_expr1 = parse_application_expr(tok_l, &t);
+        if (top == NULL) {
+            break;
+        }
+
+        if (top->frame == FRAME_PAREN) {
+            t = match_token(tok_l, t, TOK_RPAREN);
 
-    if (t == NULL || t->token != TOK_EXP) {
-        *out_tl = t;
-        return app_expr1;
+            if (errno == 0) {
+                stack.num_frames--;
+            }
+        } else {
+            top->num_args++;
+            top->mark = tree->length;
+
+            if (peek(tok_l, t) == TOK_COMMA) {
+                expect_operand = 1;
+                t++;
+            } else {
+                t = match_token(tok_l, t, TOK_RPAREN);
+
+                if (errno == 0) {
+                    reduce_application(&stack, tree);
+                }
+            }
+        }
     }
 
-    t2 = match_token(t, TOK_EXP);
-    app_expr2 = parse_application_expr(t2, &t3);
+    /* on errors, close every open frame with whatever was parsed so far */
+    while (stack.num_frames > 0) {
+        switch (stack.frames[stack.num_frames - 1].frame) {
+            case FRAME_BINOP:
+                reduce_binop(&stack, tree);
+                break;
+            case FRAME_PAREN:
+                stack.num_frames--;
+                break;
+            case FRAME_APP:
+                reduce_application(&stack, tree);
+                break;
+        }
+    }
+
+    add_expr = stack.num_operands > 0 ? stack.operands[0] : NO_NODE;
 
-    exponent_expr = malloc(sizeof(ExprTree));
-    exponent_expr->expr = Binop;
-    exponent_expr->value.binop = Exp;
-    exponent_expr->left = app_expr1;
-    exponent_expr->right = app_expr2;
+    free(stack.frames);
+    free(stack.operands);
 
-    *out_tl = t3;
-    return exponent_expr;
+    *out_pos = errno == 0 ? t : tok_l->length;
+    return add_expr;
 }
 
 /*
- * ApplicationExpr -> ID(ArgExpr) | PrimaryExpr
+ * PrimaryExpr -> int | float | ID
+ * ID -> string which matches the following regex: ^[a-zA-Z][a-zA-Z0-9_]*$
+ *
+ * Parenthesized expressions are handled by parse_additive_expr, so this only parses the leaves.
  */
-static ExprTree *parse_application_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2, *t3, *t4;
-    ExprTree *application_expr, *primary_expr, *id_expr, *arg_expr;
+static int parse_primary_expr(const TokenList *tok_l, int pos, int *out_pos, ExprTree *tree) {
+    int t, p_expr;
+    const Token *tok;
 
     if (errno != 0) {
-        return NULL;
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    if (tok_l == NULL) {
+    if (pos >= tok_l->length) {
         errno = EINVAL;
-        warnx("error: (E1004) incomplete expression");
+        warnx("error: (E1007) input ended before expected");
 
-        *out_tl = NULL;
-        return NULL;
+        *out_pos = tok_l->length;
+        return NO_NODE;
     }
 
-    switch (tok_l->token) {
-        case TOK_ID:
-            #pragma GCC diagnostic push
-            #pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
-            /* ignoring warning because IDs can mean fn application (so break) or just a variable (so fallthrough) */
-            if (tok_l->next != NULL && tok_l->next->token == TOK_LPAREN) {
-                break;
-            }
-            #pragma GCC diagnostic pop
+    tok = &(tok_l->toks[pos]);
+
+    switch (tok->token) {
         case TOK_INT:
+            t = match_token(tok_l, pos, TOK_INT);
+
+            p_expr = push_node(tree, Int, NO_NODE, NO_NODE);
+            tree->nodes[p_expr].value.i = tok->value.i;
+            break;
         case TOK_FLOAT:
-        case TOK_LPAREN:
-            primary_expr = parse_primary_expr(tok_l, &t);
+            t = match_token(tok_l, pos, TOK_FLOAT);
+
+            p_expr = push_node(tree, Float, NO_NODE, NO_NODE);
+            tree->nodes[p_expr].value.d = tok->value.d;
+            break;
+        case TOK_ID:
+            t = match_token(tok_l, pos, TOK_ID);
 
-            *out_tl = t;
-            return primary_expr;
+            p_expr = push_node(tree, ID, NO_NODE, NO_NODE);
+            tree->nodes[p_expr].value.id = tok->value.id;
+            break;
         default: {
-            char *tok_l_str = token_values_to_str(tok_l);
+            char *tok_l_str = token_values_to_str(tok_l, pos);
 
             errno = EINVAL;
-            warnx("error: (E1006) failed to find ID or number with remaining input: \"%s\"", tok_l_str);
+            warnx("error: (E1008) unrecognized primary expression with remaining tokens:\"%s\"", tok_l_str);
             free(tok_l_str);
 
-            *out_tl = NULL;
-            return NULL;
+            *out_pos = tok_l->length;
+            return NO_NODE;
         }
     }
-    
 
-    id_expr = parse_primary_expr(tok_l, &t);
-    t2 = match_token(t, TOK_LPAREN);
-    arg_expr = parse_arg_expr(t2, &t3);
-    t4 = match_token(t3, TOK_RPAREN);
+    *out_pos = t;
+    return p_expr;
+}
+
+#define INITIAL_NODE_CAPACITY 8
+
+ExprTree *new_expr_tree(int capacity) {
+    ExprTree *tree = malloc(sizeof(ExprTree));
 
-    application_expr = malloc(sizeof(ExprTree));
-    application_expr->expr = Application;
-    application_expr->left = id_expr;
-    application_expr->right = arg_expr;
+    tree->length = 0;
+    tree->refs = 0;
+    tree->code = NULL;
+    tree->capacity = capacity > 0 ? capacity : INITIAL_NODE_CAPACITY;
+    tree->nodes = malloc(tree->capacity * sizeof(ExprNode));
 
-    *out_tl = t4;
-    return application_expr;
+    return tree;
 }
 
-/*
- * ArgExpr -> AdditiveExpr, ArgExpr | AdditiveExpr
- */
-static ExprTree *parse_arg_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2, *t3;
-    ExprTree *argument_expr, *add_expr, *arg_expr;
+/* returns the index of the root node, or NO_NODE for an empty tree */
+int expr_tree_root(const ExprTree *tree) {
+    return tree != NULL && tree->length > 0 ? tree->length - 1 : NO_NODE;
+}
 
-    if (errno != 0) {
-        return NULL;
-    }
+int left_child(const ExprTree *tree, int node) {
+    return node == NO_NODE || tree->nodes[node].left == 0 ? NO_NODE : node - tree->nodes[node].left;
+}
 
-    add_expr = parse_additive_expr(tok_l, &t);
+int right_child(const ExprTree *tree, int node) {
+    return node == NO_NODE || tree->nodes[node].right == 0 ? NO_NODE : node - tree->nodes[node].right;
+}
 
-    if (errno != 0) {
-        free_expr_tree(add_expr);
+static ExprNode *grow_expr_tree(ExprTree *tree, int num_nodes) {
+    if (tree->length + num_nodes > tree->capacity) {
+        while (tree->length + num_nodes > tree->capacity) {
+            tree->capacity *= 2;
+        }
 
-        *out_tl = NULL;
-        return NULL;
+        tree->nodes = realloc(tree->nodes, tree->capacity * sizeof(ExprNode));
     }
 
-    if (t != NULL && t->token == TOK_COMMA) {
-        t2 = match_token(t, TOK_COMMA);
-        arg_expr = parse_arg_expr(t2, &t3);
-        
-        *out_tl = t3;
-    } else {
-        arg_expr = NULL;
+    tree->length += num_nodes;
+    return &(tree->nodes[tree->length - num_nodes]);
+}
 
-        *out_tl = t;
-    }
+/*
+ * Appends a node whose children are the subtrees rooted at left and right (either may be
+ * NO_NODE), and returns its index. Those subtrees have to be the last ones built, left first, so
+ * the arena stays in post-order.
+ */
+int push_node(ExprTree *tree, Expr_t expr, int left, int right) {
+    int index = tree->length, size = 1;
+    ExprNode *node;
 
-    argument_expr = malloc(sizeof(ExprTree));
-    argument_expr->expr = Argument;
-    argument_expr->left = add_expr;
-    argument_expr->right = arg_expr;
+    size += left != NO_NODE ? tree->nodes[left].size : 0;
+    size += right != NO_NODE ? tree->nodes[right].size : 0;
 
-    return argument_expr;
+    node = grow_expr_tree(tree, 1);
+    node->expr = expr;
+    node->left = left != NO_NODE ? index - left : 0;
+    node->right = right != NO_NODE ? index - right : 0;
+    node->size = size;
+    node->value.i = 0;
+
+    return index;
 }
 
 /*
- * PrimaryExpr -> int | float | ID | (AdditiveExpr)
- * ID -> string which matches the following regex: ^[a-zA-Z][a-zA-Z0-9_]*$
+ * Appends a copy of the subtree of src rooted at node (NO_NODE copies nothing), returns its root.
+ * src may be dst itself.
  */
-static ExprTree *parse_primary_expr(TokenList *tok_l, TokenList **out_tl) {
-    TokenList *t, *t2, *t3;
-    ExprTree *p_expr, *add_expr;
-    char *id, *id_cpy;
+int copy_subtree(ExprTree *dst, const ExprTree *src, int node) {
+    ExprNode *copy;
+    int size;
 
-    if (errno != 0) {
-        return NULL;
+    if (node == NO_NODE) {
+        return NO_NODE;
     }
 
-    if (tok_l == NULL) {
-        errno = EINVAL;
-        warnx("error: (E1007) input ended before expected");
+    size = src->nodes[node].size;
+    copy = grow_expr_tree(dst, size); /* may move src's nodes when src is dst */
+    memcpy(copy, &(src->nodes[node - size + 1]), size * sizeof(ExprNode));
 
-        *out_tl = NULL;
-        return NULL;
-    }
+    return dst->length - 1;
+}
 
-    p_expr = malloc(sizeof(ExprTree));
+/* drops every node from index length on, i.e. the subtrees built since the tree was that long */
+void truncate_expr_tree(ExprTree *tree, int length) {
+    tree->length = length;
+}
 
-    switch (tok_l->token) {
-        case TOK_INT:
-            t = match_token(tok_l, TOK_INT);
+/*
+ * Hash-consing, for share_subtrees. A node is the same as another when they have the same expr
+ * and value and their children are the same, so each node is looked up by that key in an open
+ * addressing table (with linear probing, kept at most half full) holding the first node of every
+ * key. same[node] is that first node, which is node itself if there was none before it.
+ */
+typedef struct {
+    ExprTree *tree; /* the tree being built */
+    int *same;
+    int *slots;     /* node + 1, so that 0 can mark an empty slot */
+    unsigned int mask;
+} Sharer;
+
+static int first_same(const Sharer *s, int node) {
+    return node == NO_NODE ? NO_NODE : s->same[node];
+}
 
-            p_expr->expr = Int;
-            p_expr->value.i = tok_l->value.i;
-            break;
-        case TOK_FLOAT:
-            t = match_token(tok_l, TOK_FLOAT);
+static unsigned int node_hash(const Sharer *s, int node) {
+    const ExprNode *n = &(s->tree->nodes[node]);
+    unsigned long long hash = n->expr;
 
-            p_expr->expr = Float;
-            p_expr->value.d = tok_l->value.d;
-            break;
-        case TOK_ID:
-            t = match_token(tok_l, TOK_ID);
+    /* every value is either all 8 bytes or pushed with them zeroed, so value.i covers it */
+    hash = (hash ^ (unsigned long long) n->value.i) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (unsigned int) first_same(s, left_child(s->tree, node))) * 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (unsigned int) first_same(s, right_child(s->tree, node))) * 0x9E3779B97F4A7C15ull;
 
-            id = tok_l->value.id;
-            id_cpy = malloc(strlen(id) + 1);
-            strcpy(id_cpy, id);
+    return (unsigned int) (hash >> 32);
+}
 
-            p_expr->expr = ID;
-            p_expr->value.id = id_cpy;
-            break;
-        case TOK_LPAREN:
-            t = match_token(tok_l, TOK_LPAREN);
-            add_expr = parse_additive_expr(t, &t2);
-            t3 = match_token(t2, TOK_RPAREN);
-
-            free(p_expr);
-            *out_tl = t3;
-            return add_expr;
-        default: {
-            char *tok_l_str = token_values_to_str(tok_l);
-            free(p_expr);
+static int is_same(const Sharer *s, int a, int b) {
+    const ExprNode *m = &(s->tree->nodes[a]), *n = &(s->tree->nodes[b]);
 
-            errno = EINVAL;
-            warnx("error: (E1008) unrecognized primary expression with remaining tokens:\"%s\"", tok_l_str);
-            free(tok_l_str);
+    return m->expr == n->expr && m->value.i == n->value.i
+           && first_same(s, left_child(s->tree, a)) == first_same(s, left_child(s->tree, b))
+           && first_same(s, right_child(s->tree, a)) == first_same(s, right_child(s->tree, b));
+}
 
-            *out_tl = NULL;
-            return NULL;
+/* returns the first node the same as node, adding node to the table if it's the first */
+static int find_same(Sharer *s, int node) {
+    unsigned int slot = node_hash(s, node) & s->mask;
+
+    while (s->slots[slot] != 0) {
+        if (is_same(s, s->slots[slot] - 1, node)) {
+            return s->slots[slot] - 1;
         }
+
+        slot = (slot + 1) & s->mask;
     }
 
-    p_expr->left = NULL;
-    p_expr->right = NULL;
+    s->slots[slot] = node + 1;
+    return node;
+}
+
+static int push_shared(Sharer *s, int first) {
+    int node = push_node(s->tree, Shared, NO_NODE, NO_NODE);
 
-    *out_tl = t;
-    return p_expr;
+    s->tree->nodes[node].value.i = node - first;
+    s->same[node] = first;
+
+    return node;
 }
 
-static void free_tree_node(ExprTree *tree) {
-    if (tree->expr == ID || tree->expr == Fun) {
-        free(tree->value.id);
+/*
+ * Rebuilds tree, in place, with every operation or application that repeats an earlier one
+ * (e.g. the second a * b + c in (a * b + c) / (a * b + c)) replaced by a Shared node referring
+ * back to it. The tree becomes a DAG, whose nodes eval evaluates only once each, and its
+ * expr_tree_to_str is unchanged. Returns how many nodes were dropped.
+ *
+ * The tree is rebuilt node by node in post-order, so a repeat is only found once it's been
+ * copied, and then it's cut off again. Every node below a repeat repeats one below the first
+ * occurrence, so none of the nodes cut off is in the table.
+ */
+int share_subtrees(ExprTree *tree) {
+    Sharer s;
+    int *copies, i, dropped;
+    unsigned int num_slots = 1;
+
+    if (tree == NULL || tree->length == 0) {
+        return 0;
     }
 
-    free(tree);
+    while (num_slots < 2u * tree->length) {
+        num_slots *= 2;
+    }
+
+    s.tree = new_expr_tree(tree->length);
+    s.same = malloc(tree->length * sizeof(int));
+    s.slots = calloc(num_slots, sizeof(int));
+    s.mask = num_slots - 1;
+    copies = malloc(tree->length * sizeof(int)); /* where each of tree's nodes was copied to */
+
+    for (i = 0; i < tree->length; i++) {
+        const ExprNode *n = &(tree->nodes[i]);
+        int left = left_child(tree, i), right = right_child(tree, i), copy, first;
+
+        /* already shared, so it only has to refer to where its subtree now is */
+        if (n->expr == Shared) {
+            copies[i] = push_shared(&s, s.same[copies[i - n->value.i]]);
+            continue;
+        }
+
+        copy = push_node(s.tree, n->expr, left != NO_NODE ? copies[left] : NO_NODE,
+                         right != NO_NODE ? copies[right] : NO_NODE);
+        s.tree->nodes[copy].value = n->value;
+        first = find_same(&s, copy);
+        s.same[copy] = first;
+
+        /* only operations and applications are shared, since a leaf is as small as a Shared node */
+        if (first != copy && (n->expr == Binop || n->expr == Application)) {
+            truncate_expr_tree(s.tree, copy - s.tree->nodes[copy].size + 1);
+            copy = push_shared(&s, first);
+        }
+
+        copies[i] = copy;
+    }
+
+    dropped = tree->length - s.tree->length;
+    free(tree->nodes);
+    tree->nodes = realloc(s.tree->nodes, s.tree->length * sizeof(ExprNode));
+    tree->length = tree->capacity = s.tree->length;
+
+    free(s.tree);
+    free(s.same);
+    free(s.slots);
+    free(copies);
+
+    return dropped;
 }
 
 void free_expr_tree(ExprTree *tree) {
     if (tree == NULL) {
         return;
     }
-    
-    free_expr_tree(tree->left);
-    free_expr_tree(tree->right);
-    free_tree_node(tree);
+
+    free(tree->code);
+    free(tree->nodes);
+    free(tree);
 }
 
-static char *expr_tree_to_str_aux(ExprTree *tree, int *size) {
-    char *str, *lstr, *rstr;
-    int lsize, rsize;
+static char *expr_tree_to_str_aux(const ExprTree *tree, int node) {
+    char *str, *lstr = NULL, *rstr = NULL;
+    size_t length = MAX_NODE_STR_LEN + 3; /* +2 for parens () and then +1 for null terminator */
+    int left, right;
+    const ExprNode *n;
 
-    if (tree == NULL) {
+    if (node == NO_NODE) {
         str = malloc(3);
         strcpy(str, "()");
 
-        *size = 0;
         return str;
     }
 
-    if (tree->left != NULL || tree->right != NULL) {
-        lstr = expr_tree_to_str_aux(tree->left, &lsize);
-        rstr = expr_tree_to_str_aux(tree->right, &rsize);
-    } else {
-        lsize = 0;
-        rsize = 0;
+    n = &(tree->nodes[node]);
+
+    /* printed as what it repeats, so sharing subtrees doesn't change a tree's string */
+    if (n->expr == Shared) {
+        return expr_tree_to_str_aux(tree, node - n->value.i);
     }
 
-    /* +2 for parens () and then +1 for null terminator */
-    str = malloc(MAX_NODE_STR_LEN*(1 + lsize + rsize) + 3);
+    left = left_child(tree, node);
+    right = right_child(tree, node);
 
-    strcpy(str, "(");
-    switch (tree->expr) {
-        char s[MAX_NODE_VAL_LEN + 1];
+    if (left != NO_NODE || right != NO_NODE) {
+        lstr = expr_tree_to_str_aux(tree, left);
+        rstr = expr_tree_to_str_aux(tree, right);
+        length += strlen(lstr) + strlen(rstr);
+    }
 
+    /* names and big floats (e.g. 1e300 with all its digits) can be longer than MAX_NODE_VAL_LEN */
+    if (n->expr == Float) {
+        length += snprintf(NULL, 0, "%f", n->value.d);
+    } else if (n->expr == ID || n->expr == Fun) {
+        length += symbol_length(n->value.id);
+    } else if (n->expr == Local) {
+        length += symbol_length(n->value.local.id);
+    }
+
+    str = malloc(length);
+
+    strcpy(str, "(");
+    switch (n->expr) {
         case Int:
-            sprintf(s, "Int %ld", tree->value.i);
-            strcat(str, s);
+            sprintf(str + 1, "Int %ld", n->value.i);
             break;
         case Float:
-            sprintf(s, "Float %f", tree->value.d);
-            strcat(str, s);
+            sprintf(str + 1, "Float %f", n->value.d);
             break;
         case ID:
-            sprintf(s, "ID %s", tree->value.id);
-            strcat(str, s);
+            sprintf(str + 1, "ID %s", symbol_name(n->value.id));
+            break;
+        case Local:
+            sprintf(str + 1, "Local %s %d", symbol_name(n->value.local.id), n->value.local.slot);
             break;
         case Fun:
-            sprintf(s, "Fun %s ", tree->value.id);
-            strcat(str, s);
+            sprintf(str + 1, "Fun %s ", symbol_name(n->value.id));
             break;
         case Binop:
-            switch (tree->value.binop) {
+            switch (n->value.binop) {
                 case Add:
                     strcat(str, "Add");
                     break;
@@ -634,7 +890,7 @@ static char *expr_tree_to_str_aux(ExprTree *tree, int *size) {
             strcat(str, "Unrecognized expr");
     }
 
-    if (tree->left != NULL || tree->right != NULL) {
+    if (left != NO_NODE || right != NO_NODE) {
         strcat(str, lstr);
         strcat(str, rstr);
 
@@ -644,11 +900,9 @@ static char *expr_tree_to_str_aux(ExprTree *tree, int *size) {
     
     strcat(str, ")");
 
-    *size = 1 + lsize + rsize;
     return str;
 }
 
-char *expr_tree_to_str(ExprTree *tree) {
-    int size;
-    return expr_tree_to_str_aux(tree, &size);
+char *expr_tree_to_str(const ExprTree *tree) {
+    return expr_tree_to_str_aux(tree, expr_tree_root(tree));
 }
@@ -1,7 +1,9 @@
 #ifndef Parser_h
 #define Parser_h
 
+#include <stdint.h>
 #include "lexer.h"
+#include "symbol.h"
 
 typedef enum {
     Add,
@@ -20,23 +22,54 @@ typedef enum {
     Assign,
     Application,
     Argument,
-    Parameter
+    Parameter,
+    Local,      /* a parameter used in its function's body, read from a slot in the call's frame */
+    Shared      /* a repeat of the subtree value.i nodes back, which is evaluated once (see share_subtrees) */
 } Expr_t;
 
-typedef struct expr_tree {
+#define NO_NODE (-1)
+
+/*
+ * A tree's nodes live contiguously in one arena, in post-order: every subtree is a run of nodes
+ * ending with its root, and the root of the whole tree is the last node. Children are 32 bit
+ * distances back from their parent (0 means no child) rather than pointers, so a subtree means
+ * the same thing wherever it sits and copying one into another tree is a single memcpy.
+ */
+typedef struct {
     Expr_t expr;
+    int32_t left;  /* parent index - left child index, or 0 for no left child */
+    int32_t right; /* parent index - right child index, or 0 for no right child */
+    int32_t size;  /* number of nodes in the subtree rooted here */
     union {
         long int i;
         double d;
-        char *id;
+        Symbol_t id;
         Operator_t binop;
+        struct {
+            Symbol_t id;
+            int32_t slot; /* the parameter's position in its function's parameter list */
+        } local;
     } value;
-    struct expr_tree *left;
-    struct expr_tree *right;
+} ExprNode;
+
+typedef struct expr_tree {
+    ExprNode *nodes;
+    int length;
+    int capacity;
+    int refs; /* bindings sharing this tree as their value (see env.c), 0 for any other tree */
+    struct chunk *code; /* bytecode compiled from the function this tree holds, if any (see vm.c) */
 } ExprTree;
 
 ExprTree *parse(TokenList *tok_l);
+ExprTree *new_expr_tree(int capacity);
+int expr_tree_root(const ExprTree *tree);
+int left_child(const ExprTree *tree, int node);
+int right_child(const ExprTree *tree, int node);
+int push_node(ExprTree *tree, Expr_t expr, int left, int right);
+int copy_subtree(ExprTree *dst, const ExprTree *src, int node);
+void truncate_expr_tree(ExprTree *tree, int length);
+int share_subtrees(ExprTree *tree);
 void free_expr_tree(ExprTree *tree);
-char *expr_tree_to_str(ExprTree *tree);
+char *expr_tree_to_str(const ExprTree *tree);
 
 #endif
@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200112L /* sysconf, posix_madvise */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "reader.h"
+
+#define STREAM_BLOCK_SIZE (64 * 1024)        /* pipes and terminals hand over data in small pieces anyway */
+#define FILE_BLOCK_SIZE (1024 * 1024)        /* redirected files can be read in big gulps                 */
+#define UNMAP_CHUNK_SIZE (16 * 1024 * 1024)  /* how far behind a mapped reader can get before unmapping   */
+
+static int map_file(LineReader *reader, const struct stat *st) {
+    void *map;
+
+    if (st->st_size <= 0 || (unsigned long long) st->st_size > (size_t) -1) {
+        return 0;
+    }
+
+    map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    posix_madvise(map, st->st_size, POSIX_MADV_SEQUENTIAL);
+
+    reader->map = map;
+    reader->map_length = st->st_size;
+    reader->end = st->st_size;
+    reader->eof = 1;
+
+    return 1;
+}
+
+LineReader *open_reader(int fd) {
+    LineReader *reader = malloc(sizeof(LineReader));
+    struct stat st;
+    int is_file = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+    reader->fd = fd;
+    reader->map = NULL;
+    reader->map_length = 0;
+    reader->unmapped = 0;
+    reader->buf = NULL;
+    reader->capacity = 0;
+    reader->start = 0;
+    reader->scanned = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    reader->block_size = is_file ? FILE_BLOCK_SIZE : STREAM_BLOCK_SIZE;
+
+    if (is_file && map_file(reader, &st)) {
+        return reader;
+    }
+
+    reader->capacity = reader->block_size;
+    reader->buf = malloc(reader->capacity);
+
+    return reader;
+}
+
+/*
+ * Makes room for at least one more block after end. The unread part of the buffer is slid to the
+ * front when that frees up enough space, and the buffer doubles otherwise, so a line of n bytes
+ * costs O(n) copying in total no matter how long it is.
+ */
+static void make_room(LineReader *reader) {
+    size_t unread = reader->end - reader->start;
+
+    if (reader->start > 0 && reader->capacity - unread >= reader->block_size) {
+        memmove(reader->buf, reader->buf + reader->start, unread);
+        reader->start = 0;
+        reader->end = unread;
+        return;
+    }
+
+    while (reader->capacity - reader->end < reader->block_size) {
+        reader->capacity *= 2;
+    }
+
+    reader->buf = realloc(reader->buf, reader->capacity);
+}
+
+/* returns the number of bytes read, 0 at end of input, or -1 if the read failed */
+static ssize_t fill(LineReader *reader) {
+    ssize_t num_read;
+
+    if (reader->capacity - reader->end < reader->block_size) {
+        make_room(reader);
+    }
+
+    do {
+        num_read = read(reader->fd, reader->buf + reader->end, reader->block_size);
+    } while (num_read < 0 && errno == EINTR);
+
+    if (num_read < 0) {
+        warnx("error: (E0010) failed to read input: %s", strerror(errno));
+        return -1;
+    }
+
+    reader->end += num_read;
+    return num_read;
+}
+
+/* gives back whole pages of the mapping that only hold lines already returned */
+static void release_mapped(LineReader *reader) {
+    size_t page_size = sysconf(_SC_PAGESIZE), done = reader->start / page_size * page_size;
+
+    if (done - reader->unmapped >= UNMAP_CHUNK_SIZE) {
+        munmap((char *) reader->map + reader->unmapped, done - reader->unmapped);
+        reader->unmapped = done;
+    }
+}
+
+const char *next_line(LineReader *reader, size_t *length) {
+    const char *data, *newline;
+
+    if (reader->map != NULL) {
+        release_mapped(reader);
+    }
+
+    for (;;) {
+        size_t unread = reader->end - reader->start;
+
+        data = reader->map != NULL ? reader->map : reader->buf;
+        newline = memchr(data + reader->start + reader->scanned, '\n', unread - reader->scanned);
+
+        if (newline != NULL || reader->eof) {
+            break;
+        }
+
+        /* the whole unread part has been searched, so the next search starts where new data lands */
+        reader->scanned = unread;
+
+        switch (fill(reader)) {
+            case -1:
+                return NULL;
+            case 0:
+                reader->eof = 1;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (newline != NULL) {
+        *length = newline - (data + reader->start);
+    } else if (reader->end > reader->start) {
+        /* the last line doesn't need a newline */
+        *length = reader->end - reader->start;
+    } else {
+        return NULL;
+    }
+
+    data += reader->start;
+    reader->start += *length + (newline != NULL);
+    reader->scanned = 0;
+
+    return data;
+}
+
+void close_reader(LineReader *reader) {
+    if (reader == NULL) {
+        return;
+    }
+
+    if (reader->map != NULL && reader->map_length > reader->unmapped) {
+        munmap((char *) reader->map + reader->unmapped, reader->map_length - reader->unmapped);
+    }
+
+    free(reader->buf);
+    free(reader);
+}
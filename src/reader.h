@@ -0,0 +1,41 @@
+#ifndef Reader_h
+#define Reader_h
+
+#include <stddef.h>
+
+/*
+ * Reads a file descriptor one line at a time, with no limit on line length.
+ *
+ * Regular files are memory-mapped and lines are handed out in place, so a script is never copied
+ * and the parts already run are unmapped as the reader moves past them, keeping memory use flat
+ * however big the file is. Anything else (pipes, terminals, or a file that can't be mapped) is
+ * streamed: input is pulled in with large read() calls into one buffer and lines are handed out
+ * as pointers into it. Either way each byte is scanned for a newline once and moved at most a
+ * constant number of times (amortized).
+ */
+typedef struct {
+    int fd;
+    const char *map;   /* the mapped file, or NULL when streaming          */
+    size_t map_length;
+    size_t unmapped;   /* bytes at the front of map already given back     */
+    char *buf;         /* the stream buffer, or NULL when mapped           */
+    size_t capacity;
+    size_t start;      /* first byte of the line being returned next       */
+    size_t scanned;    /* bytes from start already known to hold no newline */
+    size_t end;        /* one past the last byte available                 */
+    size_t block_size; /* how much to read at a time                       */
+    int eof;
+} LineReader;
+
+LineReader *open_reader(int fd);
+
+/*
+ * Returns the next line (without its newline) and sets *length to its length, or returns NULL
+ * once the input runs out or a read fails (with errno set). Lines aren't null terminated. A line
+ * is only valid until the next call.
+ */
+const char *next_line(LineReader *reader, size_t *length);
+
+void close_reader(LineReader *reader);
+
+#endif
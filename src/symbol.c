@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <string.h>
+#include "symbol.h"
+
+#define INITIAL_SLOTS 256 /* must be a power of 2 */
+
+typedef struct {
+    char *name;
+    int length;
+    unsigned int hash;
+} SymbolEntry;
+
+/*
+ * Open addressing with linear probing. slots holds symbol + 1 so that 0 can mark an empty slot,
+ * and the table is kept at most half full.
+ */
+static Symbol_t *slots = NULL;
+static unsigned int num_slots = 0;
+static SymbolEntry *symbols = NULL;
+static int num_symbols = 0;
+static int symbols_capacity = 0;
+
+static unsigned int hash_name(const char *name, int length) {
+    unsigned int hash = 2166136261u; /* FNV-1a */
+    int i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void grow_slots() {
+    unsigned int i, mask;
+
+    free(slots);
+    num_slots = num_slots == 0 ? INITIAL_SLOTS : num_slots * 2;
+    slots = calloc(num_slots, sizeof(Symbol_t));
+    mask = num_slots - 1;
+
+    for (i = 0; i < (unsigned int) num_symbols; i++) {
+        unsigned int slot = symbols[i].hash & mask;
+
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+
+        slots[slot] = i + 1;
+    }
+}
+
+static Symbol_t add_symbol(const char *name, int length, unsigned int hash) {
+    SymbolEntry *entry;
+
+    if (num_symbols == symbols_capacity) {
+        symbols_capacity = symbols_capacity == 0 ? INITIAL_SLOTS / 2 : symbols_capacity * 2;
+        symbols = realloc(symbols, symbols_capacity * sizeof(SymbolEntry));
+    }
+
+    entry = &(symbols[num_symbols]);
+    entry->name = malloc(length + 1);
+    memcpy(entry->name, name, length);
+    entry->name[length] = '\0';
+    entry->length = length;
+    entry->hash = hash;
+
+    return num_symbols++;
+}
+
+static Symbol_t intern_aux(const char *name, int length) {
+    unsigned int hash = hash_name(name, length);
+    unsigned int mask = num_slots - 1;
+    unsigned int slot = hash & mask;
+    Symbol_t sym;
+
+    while (slots[slot] != 0) {
+        SymbolEntry *entry = &(symbols[slots[slot] - 1]);
+
+        if (entry->hash == hash && entry->length == length && memcmp(entry->name, name, length) == 0) {
+            return slots[slot] - 1;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    sym = add_symbol(name, length, hash);
+    slots[slot] = sym + 1;
+
+    if ((unsigned int) num_symbols * 2 > num_slots) {
+        grow_slots();
+    }
+
+    return sym;
+}
+
+Symbol_t intern(const char *name, int length) {
+    if (slots == NULL) {
+        grow_slots();
+        intern_aux("fn", 2); /* SYM_FN */
+    }
+
+    return intern_aux(name, length);
+}
+
+const char *symbol_name(Symbol_t sym) {
+    return symbols[sym].name;
+}
+
+int symbol_length(Symbol_t sym) {
+    return symbols[sym].length;
+}
+
+void free_symbols() {
+    int i;
+
+    for (i = 0; i < num_symbols; i++) {
+        free(symbols[i].name);
+    }
+
+    free(symbols);
+    free(slots);
+
+    symbols = NULL;
+    slots = NULL;
+    num_symbols = 0;
+    symbols_capacity = 0;
+    num_slots = 0;
+}
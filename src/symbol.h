@@ -0,0 +1,21 @@
+#ifndef Symbol_h
+#define Symbol_h
+
+/*
+ * Symbols are small integers standing in for identifier names. Every name is interned once into
+ * a process-wide table, so names compare with == and are stored only once no matter how many
+ * tokens, trees, and environment entries refer to them.
+ */
+typedef int Symbol_t;
+
+/* keywords are interned before anything else, so they always get these symbols */
+enum {
+    SYM_FN
+};
+
+Symbol_t intern(const char *name, int length);
+const char *symbol_name(Symbol_t sym);
+int symbol_length(Symbol_t sym);
+void free_symbols();
+
+#endif
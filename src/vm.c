@@ -0,0 +1,568 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include "vm.h"
+#include "jit.h"
+#include "env.h"
+#include "eval.h"
+#include "parser.h"
+#include "memo.h"
+
+#define MAX_CALL_DEPTH 256  /* arbitrary upper limit on calls nested in one run, deeper ones go back to eval */
+#define MAX_SIGNATURE_PARAMS 32 /* a bit of an unsigned int per argument */
+#define VERSION(chunk, i) ((chunk)->code + ((i) + 1) * (chunk)->length)
+
+/* what's known about a value on the stack in specialized code */
+typedef enum {
+    ANY_TYPE,
+    INT_TYPE,
+    FLOAT_TYPE
+} Type_t;
+
+static int list_length(const ExprTree *tree, int node) {
+    int length = 0;
+
+    for (; node != NO_NODE; node = right_child(tree, node)) {
+        length++;
+    }
+
+    return length;
+}
+
+/* the index of the cache for reads of id, which is added if it's the first */
+static int global_index(Chunk *chunk, Symbol_t id) {
+    int i;
+
+    for (i = 0; i < chunk->num_globals; i++) {
+        if (chunk->globals[i].id == id) {
+            return i;
+        }
+    }
+
+    chunk->globals[i].id = id;
+    chunk->globals[i].version = ULONG_MAX;
+    chunk->num_globals++;
+
+    return i;
+}
+
+/*
+ * Compiles the body of the Fun node fun to bytecode for a stack machine. The nodes are already in
+ * post-order, which is the order their code runs in, so this is one pass over the body's nodes.
+ * Arguments are pushed in order after the function they're applied to, which leaves them where
+ * the callee's frame goes. Returns NULL for a body that can't be compiled (e.g. one with an
+ * incomplete subtree left by an error), which eval just keeps walking.
+ */
+Chunk *compile_fun(const ExprTree *tree, int fun) {
+    int body = right_child(tree, fun), depth = 0, num_words, node;
+    Chunk *chunk;
+    Word *w;
+
+    if (body == NO_NODE) {
+        return NULL;
+    }
+
+    /*
+     * at most an opcode and an operand per node, plus the return, for the generic code and each
+     * version, then at most a global per node
+     */
+    num_words = (MAX_VERSIONS + 1) * (2 * tree->nodes[body].size + 1);
+    chunk = malloc(sizeof(Chunk) + num_words * sizeof(Word) + tree->nodes[body].size * sizeof(GlobalCache));
+    chunk->num_params = list_length(tree, left_child(tree, fun));
+    chunk->max_stack = 0;
+    chunk->calls = 0;
+    chunk->bail_debt = 0;
+    chunk->native = NULL;
+    chunk->num_versions = 0;
+    chunk->num_globals = 0;
+    chunk->globals = (GlobalCache *) (chunk->code + num_words);
+    w = chunk->code;
+
+    for (node = body - tree->nodes[body].size + 1; node <= body; node++) {
+        const ExprNode *n = &(tree->nodes[node]);
+
+        switch (n->expr) {
+            case Int:
+                (w++)->op = OP_INT;
+                (w++)->i = n->value.i;
+                depth++;
+                break;
+            case Float:
+                (w++)->op = OP_FLOAT;
+                (w++)->d = n->value.d;
+                depth++;
+                break;
+            case Local:
+                (w++)->op = OP_LOCAL;
+                (w++)->arg = n->value.local.slot;
+                depth++;
+                break;
+            case ID:
+                (w++)->op = OP_GLOBAL;
+                (w++)->arg = global_index(chunk, n->value.id);
+                depth++;
+                break;
+            case Binop:
+                if (n->left == 0 || n->right == 0 || n->value.binop > Exp) {
+                    free(chunk);
+                    return NULL;
+                }
+
+                (w++)->op = (Opcode_t) (OP_ADD + n->value.binop);
+                depth--;
+                break;
+            case Argument:
+                break;
+            case Application:
+                (w++)->op = OP_CALL;
+                (w++)->arg = list_length(tree, right_child(tree, node));
+                depth -= w[-1].arg;
+                break;
+            default:
+                free(chunk);
+                return NULL;
+        }
+
+        if (depth > chunk->max_stack) {
+            chunk->max_stack = depth;
+        }
+    }
+
+    (w++)->op = OP_RETURN;
+    chunk->length = w - chunk->code;
+
+    return chunk;
+}
+
+/* promotes the int pushed by the OP_INT at code[at] to a float, as compute_binop would */
+static Type_t promote(Word *code, int at) {
+    code[at].op = OP_FLOAT;
+    code[at + 1].d = (double) code[at + 1].i;
+
+    return FLOAT_TYPE;
+}
+
+/*
+ * Copies chunk's code to out, specialized to the argument types in signature. Types are inferred
+ * in one pass over the code, since it has no branches: literals and arguments have known types,
+ * and so does what an operation on them gives. Operations on two ints or two floats become ones
+ * without the dispatch on type (ints still checked for overflow), and int literals used with
+ * floats are made floats where they're pushed. Anything involving a global, a call, or a division
+ * of ints (which can give either) is left generic.
+ */
+static void specialize(const Chunk *chunk, unsigned int signature, Word *out) {
+    Type_t *types = malloc((chunk->max_stack + 1) * sizeof(Type_t));
+    int *literals = malloc((chunk->max_stack + 1) * sizeof(int));  /* where an int literal was pushed, or -1 */
+    int depth = 0;
+    Word *w;
+
+    memcpy(out, chunk->code, chunk->length * sizeof(Word));
+
+    for (w = out; w < out + chunk->length; w++) {
+        switch (w->op) {
+            case OP_INT:
+                literals[depth] = w - out;
+                types[depth++] = INT_TYPE;
+                w++;
+                break;
+            case OP_FLOAT:
+                literals[depth] = -1;
+                types[depth++] = FLOAT_TYPE;
+                w++;
+                break;
+            case OP_LOCAL:
+                literals[depth] = -1;
+                types[depth++] = signature >> (++w)->arg & 1 ? FLOAT_TYPE : INT_TYPE;
+                break;
+            case OP_GLOBAL:
+                literals[depth] = -1;
+                types[depth++] = ANY_TYPE;
+                w++;
+                break;
+            case OP_CALL:
+                depth -= (++w)->arg;
+                literals[depth - 1] = -1;
+                types[depth - 1] = ANY_TYPE;
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MULT:
+            case OP_DIV:
+            case OP_EXP: {
+                Type_t *left = &(types[depth - 2]), *right = &(types[depth - 1]), type = ANY_TYPE;
+
+                if (*left == FLOAT_TYPE && *right == INT_TYPE && literals[depth - 1] >= 0) {
+                    *right = promote(out, literals[depth - 1]);
+                } else if (*left == INT_TYPE && *right == FLOAT_TYPE && literals[depth - 2] >= 0) {
+                    *left = promote(out, literals[depth - 2]);
+                }
+
+                if (*left == INT_TYPE && *right == INT_TYPE) {
+                    if (w->op <= OP_MULT) {
+                        w->op = (Opcode_t) (OP_ADD_INT + (w->op - OP_ADD));
+                        type = INT_TYPE;
+                    } else if (w->op == OP_EXP && literals[depth - 1] >= 0 && out[literals[depth - 1] + 1].i >= 0) {
+                        type = INT_TYPE;
+                    }
+                } else if (*left == FLOAT_TYPE && *right == FLOAT_TYPE) {
+                    w->op = (Opcode_t) (OP_ADD_FLOAT + (w->op - OP_ADD));
+                    type = FLOAT_TYPE;
+                } else if (*left != ANY_TYPE && *right != ANY_TYPE) {
+                    type = FLOAT_TYPE;
+                }
+
+                depth--;
+                literals[depth - 1] = -1;
+                types[depth - 1] = type;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    free(types);
+    free(literals);
+}
+
+/*
+ * The code to run chunk with for the arguments in args. The first few signatures of argument
+ * types it's called with get versions of its code specialized to them, made the first time each
+ * shows up. Other signatures, and symbolic arguments, run the generic code.
+ */
+static const Word *entry(Chunk *chunk, const Value *args) {
+    unsigned int signature = 0;
+    int i;
+
+    if (chunk->num_params > MAX_SIGNATURE_PARAMS) {
+        return chunk->code;
+    }
+
+    for (i = 0; i < chunk->num_params; i++) {
+        if (args[i].type == NODE_VALUE) {
+            return chunk->code;
+        }
+
+        signature |= (unsigned int) (args[i].type == FLOAT_VALUE) << i;
+    }
+
+    for (i = 0; i < chunk->num_versions; i++) {
+        if (chunk->signatures[i] == signature) {
+            return VERSION(chunk, i);
+        }
+    }
+
+    if (chunk->num_versions == MAX_VERSIONS) {
+        return chunk->code;
+    }
+
+    specialize(chunk, signature, VERSION(chunk, chunk->num_versions));
+    chunk->signatures[chunk->num_versions] = signature;
+
+    return VERSION(chunk, chunk->num_versions++);
+}
+
+/* finds what global is bound to now and caches it, returning -1 if it's unbound */
+int resolve_global(Env_t *env, GlobalCache *global) {
+    Binding *binding = env_find(env, global->id);
+
+    if (binding == NULL) {
+        return -1;
+    }
+
+    global->value = node_value(binding->data, expr_tree_root(binding->data));
+    global->version = env->version;
+
+    return 0;
+}
+
+typedef struct {
+    Chunk *chunk;
+    const Word *ip;
+    int frame;
+    int stack_length;
+    Memo *memo;     /* where to remember what the callee returns, or NULL */
+} Call;
+
+static int is_fun(Value v) {
+    return v.type == NODE_VALUE && v.node != NO_NODE && v.node == expr_tree_root(v.as.tree)
+           && v.as.tree->nodes[v.node].expr == Fun;
+}
+
+/*
+ * Dispatch jumps straight from one instruction's code to the next one's through a table of label
+ * addresses when the compiler supports it (a GNU extension, hence the pragmas around the table
+ * and the dispatch in run_code), and goes around a switch otherwise (or when built with
+ * -DNO_COMPUTED_GOTO).
+ */
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#define TARGET(op) L_##op
+#define DISPATCH() goto *targets[(ip++)->op]
+#else
+#define TARGET(op) case op
+#define DISPATCH() break
+#endif
+
+#define BINOP(op)                                                                                  \
+    do {                                                                                           \
+        if (stack[sp - 2].type == NODE_VALUE || stack[sp - 1].type == NODE_VALUE                   \
+            || compute_binop(op, stack[sp - 2], stack[sp - 1], &(stack[sp - 2])) != BINOP_OK) {     \
+            goto bail;                                                                             \
+        }                                                                                          \
+        sp--;                                                                                      \
+    } while (0)
+
+/* the specialized operations, on operands of the types they're for */
+#define INT_BINOP(op, operator)                                                                    \
+    do {                                                                                           \
+        if (check_int_limits(stack[sp - 2].as.i, stack[sp - 1].as.i, op) != BINOP_OK) {             \
+            goto bail;                                                                             \
+        }                                                                                          \
+        stack[sp - 2].as.i = stack[sp - 2].as.i operator stack[sp - 1].as.i;                       \
+        stack[sp - 2].node = NO_NODE;                                                              \
+        sp--;                                                                                      \
+    } while (0)
+
+#define FLOAT_BINOP(operator)                                                                      \
+    do {                                                                                           \
+        stack[sp - 2].as.d = stack[sp - 2].as.d operator stack[sp - 1].as.d;                       \
+        stack[sp - 2].node = NO_NODE;                                                              \
+        sp--;                                                                                      \
+    } while (0)
+
+/*
+ * Runs a compiled function with its arguments already in the frame starting at frame, and puts
+ * what it returns in result. Values go on env's stack past the frame, and calls within the
+ * function get their own frames there too, so this makes no allocations once the stack is big
+ * enough. Anything the code can't do by itself, like an operation on a symbolic value, an unbound
+ * name, or anything that would be an error, stops it and returns -1 so eval redoes the call by
+ * walking the tree. Evaluating a function body has no side effects, so that always gives the same
+ * result (and the same errors) as never having run the code. Returns 0 otherwise.
+ */
+static int run_code(Chunk *chunk, Env_t *env, int frame, Value *result) {
+#ifdef COMPUTED_GOTO
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wpedantic"
+    static const void *targets[] = {
+        &&L_OP_INT, &&L_OP_FLOAT, &&L_OP_LOCAL, &&L_OP_GLOBAL, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MULT,
+        &&L_OP_DIV, &&L_OP_EXP, &&L_OP_CALL, &&L_OP_RETURN, &&L_OP_ADD_INT, &&L_OP_SUB_INT,
+        &&L_OP_MULT_INT, &&L_OP_ADD_FLOAT, &&L_OP_SUB_FLOAT, &&L_OP_MULT_FLOAT, &&L_OP_DIV_FLOAT,
+        &&L_OP_EXP_FLOAT
+    };
+#endif
+    Call calls[MAX_CALL_DEPTH];
+    int depth = 0, entry_length, sp;
+    const Word *ip;
+    Value *stack;
+
+    entry_length = env->stack_length;
+    sp = push_frame(env, chunk->max_stack);
+    stack = env->stack;
+    ip = entry(chunk, &(stack[frame]));
+
+    /* the instructions are the same blocks either way, only how they're reached differs */
+#ifdef COMPUTED_GOTO
+    DISPATCH();
+    {
+        {
+#else
+    for (;;) {
+        switch ((ip++)->op) {
+#endif
+            TARGET(OP_INT):
+                stack[sp].type = INT_VALUE;
+                stack[sp].node = NO_NODE;
+                stack[sp++].as.i = (ip++)->i;
+                DISPATCH();
+            TARGET(OP_FLOAT):
+                stack[sp].type = FLOAT_VALUE;
+                stack[sp].node = NO_NODE;
+                stack[sp++].as.d = (ip++)->d;
+                DISPATCH();
+            TARGET(OP_LOCAL):
+                stack[sp] = stack[frame + (ip++)->arg];
+                sp++;
+                DISPATCH();
+            TARGET(OP_GLOBAL): {
+                GlobalCache *global = &(chunk->globals[(ip++)->arg]);
+
+                if (global->version != env->version && resolve_global(env, global) != 0) {
+                    goto bail;
+                }
+
+                stack[sp++] = global->value;
+                DISPATCH();
+            }
+            TARGET(OP_ADD):
+                BINOP(Add);
+                DISPATCH();
+            TARGET(OP_SUB):
+                BINOP(Sub);
+                DISPATCH();
+            TARGET(OP_MULT):
+                BINOP(Mult);
+                DISPATCH();
+            TARGET(OP_DIV):
+                BINOP(Div);
+                DISPATCH();
+            TARGET(OP_EXP):
+                BINOP(Exp);
+                DISPATCH();
+            TARGET(OP_CALL): {
+                int num_args = (ip++)->arg;
+                Value callee = stack[sp - num_args - 1], value;
+                Chunk *code = is_fun(callee) ? callee.as.tree->code : NULL;
+                Memo *memo;
+
+                if (code == NULL || code->num_params != num_args) {
+                    goto bail;
+                }
+
+                memo = env->memos != NULL ? find_memo(env, callee.as.tree, callee.node) : NULL;
+
+                if (memo != NULL && memo_get(memo, &(stack[sp - num_args]), &value) == 0) {
+                    stack[sp - num_args - 1] = value;
+                    sp -= num_args;
+                    DISPATCH();
+                }
+
+                if (env->jit != NULL) {
+                    int ran = jit_run(env->jit, code, env, &(stack[sp - num_args]), &value);
+
+                    stack = env->stack;
+
+                    if (ran == 0) {
+                        if (memo != NULL) {
+                            memo_put(memo, &(stack[sp - num_args]), value);
+                        }
+
+                        stack[sp - num_args - 1] = value;
+                        sp -= num_args;
+                        DISPATCH();
+                    }
+                }
+
+                if (depth == MAX_CALL_DEPTH) {
+                    goto bail;
+                }
+
+                calls[depth].chunk = chunk;
+                calls[depth].ip = ip;
+                calls[depth].frame = frame;
+                calls[depth].stack_length = env->stack_length;
+                calls[depth].memo = memo;
+                depth++;
+
+                /* the arguments are already where the callee's frame goes */
+                chunk = code;
+                frame = sp - num_args;
+                ip = entry(chunk, &(stack[frame]));
+                env->stack_length = sp;
+                sp = push_frame(env, chunk->max_stack);
+                stack = env->stack;
+                DISPATCH();
+            }
+            TARGET(OP_RETURN):
+                if (depth == 0) {
+                    *result = stack[sp - 1];
+                    env->stack_length = entry_length;
+                    return 0;
+                }
+
+                /* the return value replaces the callee under the frame */
+                stack[frame - 1] = stack[sp - 1];
+                sp = frame;
+                depth--;
+
+                if (calls[depth].memo != NULL) {
+                    memo_put(calls[depth].memo, &(stack[frame]), stack[frame - 1]);
+                }
+
+                chunk = calls[depth].chunk;
+                ip = calls[depth].ip;
+                frame = calls[depth].frame;
+                env->stack_length = calls[depth].stack_length;
+                DISPATCH();
+            TARGET(OP_ADD_INT):
+                INT_BINOP(Add, +);
+                DISPATCH();
+            TARGET(OP_SUB_INT):
+                INT_BINOP(Sub, -);
+                DISPATCH();
+            TARGET(OP_MULT_INT):
+                INT_BINOP(Mult, *);
+                DISPATCH();
+            TARGET(OP_ADD_FLOAT):
+                FLOAT_BINOP(+);
+                DISPATCH();
+            TARGET(OP_SUB_FLOAT):
+                FLOAT_BINOP(-);
+                DISPATCH();
+            TARGET(OP_MULT_FLOAT):
+                FLOAT_BINOP(*);
+                DISPATCH();
+            TARGET(OP_DIV_FLOAT):
+                if (stack[sp - 1].as.d == 0) {
+                    goto bail;
+                }
+
+                FLOAT_BINOP(/);
+                DISPATCH();
+            TARGET(OP_EXP_FLOAT):
+                stack[sp - 2].as.d = pow(stack[sp - 2].as.d, stack[sp - 1].as.d);
+                stack[sp - 2].node = NO_NODE;
+                sp--;
+                DISPATCH();
+        }
+    }
+#ifdef COMPUTED_GOTO
+    #pragma GCC diagnostic pop
+#endif
+
+bail:
+    env->stack_length = entry_length;
+    return -1;
+}
+
+/* with the JIT on, functions it has compiled run as machine code instead, whether called here or from eval */
+int run_fun(Chunk *chunk, Env_t *env, int frame, Value *result) {
+    if (env->jit != NULL && jit_run(env->jit, chunk, env, &(env->stack[frame]), result) == 0) {
+        return 0;
+    }
+
+    return run_code(chunk, env, frame, result);
+}
+
+/* run_fun for a call from outside the VM, with the arguments anywhere. They're copied to a frame if need be */
+int call_fun(Env_t *env, Value callee, const Value *args, int num_args, Value *result) {
+    Chunk *code = is_fun(callee) ? callee.as.tree->code : NULL;
+    Memo *memo;
+    int frame, ran;
+
+    if (code == NULL || code->num_params != num_args) {
+        return -1;
+    }
+
+    memo = env->memos != NULL ? find_memo(env, callee.as.tree, callee.node) : NULL;
+
+    if (memo != NULL && memo_get(memo, args, result) == 0) {
+        return 0;
+    }
+
+    if (env->jit != NULL && jit_run(env->jit, code, env, args, result) == 0) {
+        ran = 0;
+    } else {
+        frame = push_frame(env, num_args);
+        memcpy(&(env->stack[frame]), args, num_args * sizeof(Value));
+        ran = run_code(code, env, frame, result);
+        pop_frame(env, frame);
+    }
+
+    if (ran == 0 && memo != NULL) {
+        memo_put(memo, args, *result);
+    }
+
+    return ran;
+}
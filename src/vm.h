@@ -0,0 +1,72 @@
+#ifndef Vm_h
+#define Vm_h
+
+#include "env.h"
+#include "parser.h"
+
+typedef enum {
+    OP_INT,     /* pushes the int in the next word */
+    OP_FLOAT,   /* pushes the float in the next word */
+    OP_LOCAL,   /* pushes the value in the frame slot in the next word */
+    OP_GLOBAL,  /* pushes the value bound to the global whose cache the next word indexes */
+    OP_ADD,
+    OP_SUB,
+    OP_MULT,
+    OP_DIV,
+    OP_EXP,
+    OP_CALL,    /* calls the function under as many arguments as the next word says */
+    OP_RETURN,
+    /* only in code specialized to argument types, where both operands are known to be ints */
+    OP_ADD_INT,
+    OP_SUB_INT,
+    OP_MULT_INT,
+    /* or both known to be floats */
+    OP_ADD_FLOAT,
+    OP_SUB_FLOAT,
+    OP_MULT_FLOAT,
+    OP_DIV_FLOAT,
+    OP_EXP_FLOAT
+} Opcode_t;
+
+/* an opcode, or the operand following it */
+typedef union {
+    Opcode_t op;
+    int arg;
+    long int i;
+    double d;
+} Word;
+
+/*
+ * An inline cache for the reads of one global in a compiled function: what it was bound to, which
+ * holds for as long as env's version is what it was then, since every change to a binding bumps
+ * it. So reading a global is one compare, and env_find only runs again after something's bound.
+ */
+typedef struct {
+    Symbol_t id;
+    unsigned long version;  /* env's version when value was found, or ULONG_MAX before it's been */
+    Value value;
+} GlobalCache;
+
+#define MAX_VERSIONS 2  /* how many signatures of argument types a function gets specialized code for */
+
+/* a function body compiled to run on env's value stack, made in one allocation */
+typedef struct chunk {
+    int num_params;
+    int max_stack;  /* the most values its code has on the stack at once, past its frame */
+    int length;
+    int calls;      /* how often it's been run, for the JIT to tell when it's hot */
+    int bail_debt;  /* how far its machine code's bails outweigh its runs that didn't bail (see jit.c) */
+    void *native;   /* machine code the JIT compiled it to (see jit.c), or NULL */
+    int num_versions;
+    unsigned int signatures[MAX_VERSIONS];  /* each version's argument types, bit i set if i is a float */
+    int num_globals;
+    GlobalCache *globals;   /* one per global the code reads, after the code in the same allocation */
+    Word code[];    /* length words of generic code, then room for MAX_VERSIONS specialized copies */
+} Chunk;
+
+Chunk *compile_fun(const ExprTree *tree, int fun);
+int resolve_global(Env_t *env, GlobalCache *global);
+int run_fun(Chunk *chunk, Env_t *env, int frame, Value *result);
+int call_fun(Env_t *env, Value callee, const Value *args, int num_args, Value *result);
+
+#endif
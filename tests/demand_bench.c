@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 199309L /* clock_gettime, fileno */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "../src/demand.h"
+#include "../src/reader.h"
+#include "../src/eval.h"
+#include "../src/env.h"
+#include "../src/parser.h"
+#include "../src/lexer.h"
+#include "../src/symbol.h"
+#include "test.h"
+
+#define NUM_PARAMS 200000
+#define NUM_CHAINS 1000
+
+/*
+ * Benchmarks a generated parameter file: 200,000 assignments in 1000 independent chains, each
+ * parameter computed from the one before it in its chain, and a last line reading two of them.
+ * It's evaluated line by line, the way mint -f does, and then on demand, which only evaluates the
+ * two chains the last line reads.
+ */
+static double now();
+static int script_fd();
+static char *eval_all(int fd, Env_t *env);
+
+int main() {
+    int fd = script_fd();
+    Env_t *env;
+    char *all_result, *demand_result;
+    double all_time, demand_time, start;
+
+    printf("| " C_SUITE_NAME("demand benchmarks") "\n");
+    printf("|\n");
+    printf("| " C_TEST_NAME("%s") "\n", "a parameter file of 200,000 assignments, 2 chains of them read");
+
+    env = init_env();
+    start = now();
+    all_result = eval_all(fd, env);
+    all_time = now() - start;
+    free_env(env);
+
+    lseek(fd, 0, SEEK_SET);
+    env = init_env();
+    start = now();
+    demand_result = eval_on_demand(fd, env);
+    demand_time = now() - start;
+    free_env(env);
+
+    if (all_result == NULL || demand_result == NULL || strcmp(all_result, demand_result) != 0) {
+        fprintf(stderr, "results differ\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("| every line: %8.2f ms\n", all_time * 1e3);
+    printf("| on demand:  %8.2f ms\n", demand_time * 1e3);
+    printf("| speedup:    %8.2fx\n", all_time / demand_time);
+
+    free(all_result);
+    free(demand_result);
+    close(fd);
+    free_symbols();
+
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int script_fd() {
+    FILE *file = tmpfile();
+    int fd = dup(fileno(file)), i;
+
+    for (i = 0; i < NUM_PARAMS; i++) {
+        if (i < NUM_CHAINS) {
+            fprintf(file, "p%d = %d.5\n", i, i);
+        } else {
+            fprintf(file, "p%d = p%d * 1.0001 + %d / 7 - p%d / 3\n", i, i - NUM_CHAINS, i, i - NUM_CHAINS);
+        }
+    }
+
+    fprintf(file, "p%d + p%d\n", NUM_PARAMS - 1, NUM_PARAMS - NUM_CHAINS / 2);
+    fclose(file);
+    lseek(fd, 0, SEEK_SET);
+
+    return fd;
+}
+
+/* evaluates every line, returning the last result there was */
+static char *eval_all(int fd, Env_t *env) {
+    LineReader *reader = open_reader(fd);
+    const char *line;
+    char *result, *last = NULL;
+    size_t length;
+
+    while ((line = next_line(reader, &length))) {
+        TokenList *tok_l = tokenize(line, length);
+        ExprTree *tree = parse(tok_l), *value;
+
+        errno = 0;
+        value = eval(tree, env);
+        result = errno == 0 ? eval_result_to_str(value) : NULL;
+
+        if (result != NULL && strcmp(result, "") != 0) {
+            free(last);
+            last = result;
+        } else {
+            free(result);
+        }
+
+        free_expr_tree(value);
+        free_expr_tree(tree);
+        free_token_list(tok_l);
+    }
+
+    close_reader(reader);
+    return last;
+}
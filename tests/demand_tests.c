@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L /* fileno */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include "../src/demand.h"
+#include "../src/eval.h"
+#include "../src/env.h"
+#include "../src/parser.h"
+#include "../src/lexer.h"
+#include "../src/symbol.h"
+#include "test.h"
+
+#define MAX_OUTPUT_LEN 4096
+
+/*
+ * Every test evaluates a script on demand. What it prints has to be what mint prints for the same
+ * script (worked out here line by line, the way mint -f does), and what's expected, and a line the
+ * result doesn't need has to have been skipped, which leaves the name it binds unbound. Errors
+ * have to be reported once each, whether or not the script ends up evaluated in full.
+ */
+typedef struct {
+    const char *name;
+    const char *script;
+    const char *output;   /* what's printed, without the trailing newline */
+    int num_errors;       /* how many errors are reported */
+    const char *skipped;  /* a name bound only by lines that shouldn't be evaluated, or NULL */
+} Test;
+
+int verbose = 0;
+static int run_all_tests(const Test *tests, int num_tests);
+static int fork_test(int (*test_fn)(const void *), const void *test, int i);
+static void print_result(const char *name, int t_result);
+static int run_test(const void *t);
+static void mint_output(const char *script, char *output);
+static int script_fd(const char *script);
+static int count_errors(FILE *reported);
+
+int main(int argc, char **argv) {
+    Test tests[] = {
+        {"unread assignment", "a = 1\nb = 2\na + 1", "2", 0, "b"},
+        {"chain of assignments", "a = 2\nb = a * 3\nc = b ^ 100000\nb + 1", "7", 0, "c"},
+        {"globals read when called", "k = 2\nfn f(x) = x * k\nk = 5\nf(3)", "15", 0, NULL},
+        {"unused function", "fn f(x) = x + 1\nfn g(x) = x * 2\ng(4)", "8", 0, "f"},
+        {"functions called by functions", "k = 1\nfn h(x) = x + k\nfn g(x) = h(x) * 2\nfn f(x) = g(x)\nf(1)", "4", 0, NULL},
+        {"failed assignment", "x = 4\nx = 9223372036854775807 + x\nx", "4", 1, NULL},
+        {"earlier assignments shadowed", "y = 1\nx = y + 1\nx = 3\nx * 2", "6", 0, "y"},
+        {"number after a failed assignment", "y = 1\nx = y + 1\nx = z\nx", "2", 1, NULL},
+        {"function assigned to a name", "k = 1\nfn f(x) = x + k\ng = f\nk = 10\ng(1)", "11", 0, NULL},
+        {
+            "redefinition", "fn f(x) = x + 1\na = f(1)\nfn f(x) = x * 10\nb = f(2)\nunused = f(3)\na + b", "22", 0,
+            "unused"
+        },
+        {"function definition last", "j = 3\nk = 2\nfn f(x) = x * k", "f(x) = x * k", 0, "j"},
+        {"assignment last", "a = 4\nb = 5\nc = a * a", "c: 16", 0, "b"},
+        {"errors skipped", "q = zz\nx = 2\nx", "2", 0, "q"},
+        {"last line fails", "a = 5\nb = a + 1\nzz + 1", "b: 6", 1, NULL},
+        {"function assigned last", "fn f(x) = x\nfn h(x) = x\ng = f", "g: f(x) = x", 0, "h"},
+        {"errors reported once", "a = zz\nb = 2\n2 ^ 63", "b: 2", 2, NULL},
+        {"blank and unparseable lines", "x = 1 +\n\n4 * 4\n\n1 +", "16", 2, "x"},
+        {"empty script", "", "", 0, NULL},
+    };
+    int num_tests = sizeof(tests) / sizeof(Test), num_passed, suite_result;
+
+    if (argc == 2 && (strcmp(argv[1], "-v") == 0
+                   || strcmp(argv[1], "--verbose") == 0)) {
+        verbose = 1;
+        printf(SEP);
+        printf("|\n|                        ");
+    } else {
+        printf("| ");
+    }
+
+    printf(C_SUITE_NAME("demand tests") "\n");
+    printf("|\n");
+
+    num_passed = run_all_tests(tests, num_tests);
+    suite_result = num_passed == num_tests ? SUCCESS : FAILURE;
+
+    printf("|\n| Ran (%d/%d) tests successfully\n", num_passed, num_tests);
+    printf("| Test suite %s\n", suite_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf("|\n");
+        printf(SEP);
+    }
+
+    return suite_result;
+}
+
+static int run_all_tests(const Test *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int fork_test(int (*test_fn)(const void *), const void *test, int i) {
+    int t_result;
+    pid_t fork_result;
+
+    if (i == 0 && verbose) {
+        printf(SEP);
+    }
+
+    fflush(stdout);
+    fork_result = fork();
+    if (fork_result < 0) {
+        fprintf(stderr, "Test %d: fork failed\n", i);
+        exit(EXIT_FAILURE);
+    } else if (fork_result != 0) {
+        int status;
+
+        wait(&status);
+
+        if (WIFEXITED(status)) {
+            t_result = WEXITSTATUS(status);
+        } else {
+            t_result = FAILURE;
+        }
+    } else {
+        t_result = test_fn(test);
+        exit(t_result);
+    }
+
+    return t_result;
+}
+
+static void print_result(const char *name, int t_result) {
+    if (verbose) {
+        printf("|\n");
+    }
+
+    printf("| " C_TEST_NAME("%s") " %s\n", name, t_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf(SEP);
+    }
+}
+
+static int run_test(const void *t) {
+    const Test *test = t;
+    char expected[MAX_OUTPUT_LEN] = "";
+    int fd = script_fd(test->script), skipped = 1, correct_output, num_errors;
+    Env_t *env = init_env();
+    FILE *reported = tmpfile();
+    char *output;
+
+    /* errors are counted from what's written to stderr, which is discarded */
+    dup2(fileno(reported), STDERR_FILENO);
+    output = eval_on_demand(fd, env);
+    num_errors = count_errors(reported);
+
+    if (test->skipped != NULL) {
+        skipped = env_find(env, intern(test->skipped, strlen(test->skipped))) == NULL;
+    }
+
+    mint_output(test->script, expected);
+    correct_output = strcmp(output != NULL ? output : "", test->output) == 0
+                  && strcmp(expected, test->output) == 0;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        printf("| script: %s\n", test->script);
+        printf("| skipped: %s (%s)\n", test->skipped != NULL ? test->skipped : "-", skipped ? "yes" : "no");
+        printf("| errors reported: %d\n", num_errors);
+        printf("| expected errors: %d\n", test->num_errors);
+        printf(SMALL_SEP);
+        printf("| on demand printed: %s\n", output != NULL ? output : "");
+        printf("| mint printed:      %s\n", expected);
+        printf("| expected:          %s\n", test->output);
+    }
+
+    close(fd);
+    fclose(reported);
+    free(output);
+    free_env(env);
+
+    return (correct_output && skipped && num_errors == test->num_errors) ? SUCCESS : FAILURE;
+}
+
+/* how many lines written to reported so far are errors */
+static int count_errors(FILE *reported) {
+    char line[MAX_OUTPUT_LEN];
+    int num_errors = 0;
+
+    fflush(stderr);
+    rewind(reported);
+
+    while (fgets(line, sizeof(line), reported) != NULL) {
+        num_errors += strstr(line, "error:") != NULL;
+    }
+
+    return num_errors;
+}
+
+/* what mint -f prints for script: the result of the last line to have one */
+static void mint_output(const char *script, char *output) {
+    Env_t *env = init_env();
+    const char *line = script;
+
+    while (*line != '\0') {
+        size_t length = strcspn(line, "\n");
+        TokenList *tok_l;
+        ExprTree *tree, *value;
+
+        errno = 0;
+        tok_l = tokenize(line, length);
+
+        if (errno == 0) {
+            tree = parse(tok_l);
+
+            if (errno == 0) {
+                value = eval(tree, env);
+
+                if (errno == 0) {
+                    char *result = eval_result_to_str(value);
+
+                    if (strcmp(result, "") != 0) {
+                        strcpy(output, result);
+                    }
+
+                    free(result);
+                }
+
+                free_expr_tree(value);
+            }
+
+            free_expr_tree(tree);
+        }
+
+        free_token_list(tok_l);
+        line += line[length] == '\n' ? length + 1 : length;
+    }
+
+    free_env(env);
+}
+
+static int script_fd(const char *script) {
+    FILE *file = tmpfile();
+    int fd = dup(fileno(file));
+
+    fwrite(script, 1, strlen(script), file);
+    fclose(file);
+    lseek(fd, 0, SEEK_SET);
+
+    return fd;
+}
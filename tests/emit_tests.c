@@ -0,0 +1,268 @@
+#define _POSIX_C_SOURCE 200809L /* fileno, mkdtemp */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include "../src/emit.h"
+#include "../src/eval.h"
+#include "../src/env.h"
+#include "../src/parser.h"
+#include "../src/lexer.h"
+#include "../src/symbol.h"
+#include "test.h"
+
+#define MAX_OUTPUT_LEN 4096
+#define MAX_CMD_LEN 4096
+
+/*
+ * Every test emits C for a script, builds it with the system's C compiler and runs it. What it
+ * prints has to be what mint prints for the same script (worked out here line by line, the way
+ * mint -f does), and what's expected.
+ */
+typedef struct {
+    const char *name;
+    int level;            /* how much function bodies are optimized (see optimize.c) */
+    const char *script;
+    const char *output;   /* what the program and mint print, without the trailing newline */
+    int err;              /* errno after emitting, with nothing emitted unless it's NOERR */
+} Test;
+
+int verbose = 0;
+static int run_all_tests(const Test *tests, int num_tests);
+static int fork_test(int (*test_fn)(const void *), const void *test, int i);
+static void print_result(const char *name, int t_result);
+static int run_test(const void *t);
+static void mint_output(const char *script, int level, char *output);
+static int script_fd(const char *script);
+
+int main(int argc, char **argv) {
+    Test tests[] = {
+        {"int arithmetic", 0, "1 + 2 * 3 - 4", "3", NOERR},
+        {"float arithmetic", 0, "1.5 * 4 - 0.25", "5.750000", NOERR},
+        {"int promoted to float", 0, "x = 3\nx / 2", "1.500000", NOERR},
+        {"exact int division", 0, "12 / 4", "3", NOERR},
+        {"negative exponent", 0, "2 ^ -2", "0.250000", NOERR},
+        {"assignment", 0, "x = 2 ^ 10", "x: 1024", NOERR},
+        {"functions", 0, "fn f(x, y) = x * y + 1\nfn g(x) = f(x, x) / 2\ng(3)", "5", NOERR},
+        {"function definition last", 0, "fn f(x) = x + 1", "f(x) = x + 1", NOERR},
+        {"globals read when called", 0, "k = 2\nfn f(x) = x * k\nk = 5\nf(3)", "15", NOERR},
+        {"redefinition", 0, "fn f(x) = x + 1\na = f(1)\nfn f(x) = x * 10\nb = f(2)\na + b", "22", NOERR},
+        {"overflow is an error", 0, "x = 1\nx = 9223372036854775807 + x\nx", "1", NOERR},
+        {"overflow in a function", 0, "fn f(x) = x * x\ny = f(4000000000)\nf(3)", "9", NOERR},
+        {"underflow", 0, "fn f(x) = x - 9223372036854775807\nf(-2)\nf(0)", "-9223372036854775807", NOERR},
+        {"division by 0", 0, "fn f(x) = 1 / x\nf(0)\nf(4)", "0.250000", NOERR},
+        {"unbound identifier", 0, "y + 1\n7", "7", NOERR},
+        {"wrong number of arguments", 0, "fn f(x) = x\nf(1, 2)\nf(8)", "8", NOERR},
+        {"parse errors left out", 0, "1 +\n(2 * 3", "", NOERR},
+        {"blank lines", 0, "\n4 * 4\n\n", "16", NOERR},
+        {"large floats", 0, "x = 2.0 ^ 70\nx + 0.5", "1180591620717411303424.000000", NOERR},
+        {
+            "callee redefined after it's inlined", 1,
+            "fn g(x) = x + 1\nfn f(x) = g(x) * 2\nfn g(x) = x + 100\nf(1)", "202", NOERR
+        },
+        {"function as a value", 0, "fn f(x) = x\ng = f", "", EINVAL},
+        {"symbolic result", 0, "fn f(x) = x\nfn g(x) = f\ng(1)", "", EINVAL},
+    };
+    int num_tests = sizeof(tests) / sizeof(Test), num_passed, suite_result;
+
+    if (argc == 2 && (strcmp(argv[1], "-v") == 0
+                   || strcmp(argv[1], "--verbose") == 0)) {
+        verbose = 1;
+        printf(SEP);
+        printf("|\n|                        ");
+    } else {
+        printf("| ");
+    }
+
+    printf(C_SUITE_NAME("emit tests") "\n");
+    printf("|\n");
+
+    num_passed = run_all_tests(tests, num_tests);
+    suite_result = num_passed == num_tests ? SUCCESS : FAILURE;
+
+    printf("|\n| Ran (%d/%d) tests successfully\n", num_passed, num_tests);
+    printf("| Test suite %s\n", suite_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf("|\n");
+        printf(SEP);
+    }
+
+    return suite_result;
+}
+
+static int run_all_tests(const Test *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int fork_test(int (*test_fn)(const void *), const void *test, int i) {
+    int t_result;
+    pid_t fork_result;
+
+    if (i == 0 && verbose) {
+        printf(SEP);
+    }
+
+    fflush(stdout);
+    fork_result = fork();
+    if (fork_result < 0) {
+        fprintf(stderr, "Test %d: fork failed\n", i);
+        exit(EXIT_FAILURE);
+    } else if (fork_result != 0) {
+        int status;
+
+        wait(&status);
+
+        if (WIFEXITED(status)) {
+            t_result = WEXITSTATUS(status);
+        } else {
+            t_result = FAILURE;
+        }
+    } else {
+        t_result = test_fn(test);
+        exit(t_result);
+    }
+
+    return t_result;
+}
+
+static void print_result(const char *name, int t_result) {
+    if (verbose) {
+        printf("|\n");
+    }
+
+    printf("| " C_TEST_NAME("%s") " %s\n", name, t_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf(SEP);
+    }
+}
+
+static int run_test(const void *t) {
+    const Test *test = t;
+    char dir[] = "/tmp/mint_emit_XXXXXX", cmd[MAX_CMD_LEN], output[MAX_OUTPUT_LEN] = "";
+    char expected[MAX_OUTPUT_LEN] = "";
+    int fd = script_fd(test->script), emitted, built = 0, err, correct_output;
+    Env_t *env = init_env();
+    FILE *c_file, *program;
+    long c_length;
+
+    if (!verbose) {
+        freopen("/dev/null", "w", stderr);
+    }
+
+    env->opt_level = test->level;
+    mkdtemp(dir);
+    sprintf(cmd, "%s/prog.c", dir);
+    c_file = fopen(cmd, "w");
+
+    errno = 0;
+    emitted = emit_c(fd, env, c_file) == 0;
+    err = errno;
+    c_length = ftell(c_file);
+    fclose(c_file);
+
+    if (emitted) {
+        sprintf(cmd, "cc -std=c99 -O2 -o %s/prog %s/prog.c -lm", dir, dir);
+        built = system(cmd) == 0;
+        sprintf(cmd, "%s/prog", dir);
+        program = popen(cmd, "r");
+        fread(output, 1, MAX_OUTPUT_LEN - 1, program);
+        pclose(program);
+        output[strcspn(output, "\n")] = '\0';
+    }
+
+    mint_output(test->script, test->level, expected);
+    correct_output = strcmp(output, test->output) == 0 && strcmp(expected, test->output) == 0;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        printf("| script: %s\n", test->script);
+        printf("| errno (after emitting): %d\n", err);
+        printf("| expected errno: %d\n", test->err);
+        printf("| C emitted: %ld bytes, built: %s\n", c_length, built ? "yes" : "no");
+        printf(SMALL_SEP);
+        printf("| program printed: %s\n", output);
+        printf("| mint printed:    %s\n", expected);
+        printf("| expected:        %s\n", test->output);
+    }
+
+    sprintf(cmd, "rm -rf %s", dir);
+    system(cmd);
+    close(fd);
+    free_env(env);
+
+    if (test->err != NOERR) {
+        return (err == test->err && !emitted && c_length == 0) ? SUCCESS : FAILURE;
+    }
+
+    return (emitted && built && err == NOERR && correct_output) ? SUCCESS : FAILURE;
+}
+
+/* what mint -f prints for script at an optimization level: the result of the last line to have one */
+static void mint_output(const char *script, int level, char *output) {
+    Env_t *env = init_env();
+    const char *line = script;
+
+    env->opt_level = level;
+
+    while (*line != '\0') {
+        size_t length = strcspn(line, "\n");
+        TokenList *tok_l;
+        ExprTree *tree, *value;
+
+        errno = 0;
+        tok_l = tokenize(line, length);
+
+        if (errno == 0) {
+            tree = parse(tok_l);
+
+            if (errno == 0) {
+                value = eval(tree, env);
+
+                if (errno == 0) {
+                    char *result = eval_result_to_str(value);
+
+                    if (strcmp(result, "") != 0) {
+                        strcpy(output, result);
+                    }
+
+                    free(result);
+                }
+
+                free_expr_tree(value);
+            }
+
+            free_expr_tree(tree);
+        }
+
+        free_token_list(tok_l);
+        line += line[length] == '\n' ? length + 1 : length;
+    }
+
+    free_env(env);
+}
+
+static int script_fd(const char *script) {
+    FILE *file = tmpfile();
+    int fd = dup(fileno(file));
+
+    fwrite(script, 1, strlen(script), file);
+    fclose(file);
+    lseek(fd, 0, SEEK_SET);
+
+    return fd;
+}
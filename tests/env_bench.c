@@ -0,0 +1,108 @@
+#define _POSIX_C_SOURCE 199309L /* clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/env.h"
+#include "../src/parser.h"
+#include "../src/symbol.h"
+#include "test.h"
+
+#define MAX_BINDINGS 1000000
+#define NUM_LOOKUPS 10000000
+#define NUM_SCOPES 1000000
+#define NUM_PROBES 4096 /* must be a power of 2 */
+
+/*
+ * Benchmarks variable lookup in environments of 10 up to 1 million bindings, the way a session
+ * that has loaded a big table of constants and helpers would use it. Lookups pick bound names at
+ * random so they aren't all served from the same few cache lines. A function call's parameter
+ * scope (shadow a name, then drop the scope) is timed too.
+ */
+static double now();
+static double bench_lookup(Env_t *env, const Symbol_t *probes);
+static double bench_scope(Env_t *env, const Symbol_t *probes, const ExprTree *value);
+
+int main() {
+    Symbol_t *ids = malloc(MAX_BINDINGS * sizeof(Symbol_t));
+    Symbol_t probes[NUM_PROBES];
+    ExprTree *value = new_expr_tree(1);
+    int num_bindings, i;
+
+    value->nodes[push_node(value, Int, NO_NODE, NO_NODE)].value.i = 42;
+
+    for (i = 0; i < MAX_BINDINGS; i++) {
+        char name[16];
+
+        ids[i] = intern(name, sprintf(name, "v%d", i));
+    }
+
+    printf("| " C_SUITE_NAME("environment benchmarks") "\n");
+    printf("|\n");
+    printf("| " C_TEST_NAME("%s") "\n", "lookup and call scope latency by environment size");
+    printf("|   bindings    lookup   call scope\n");
+
+    srand(1);
+
+    for (num_bindings = 10; num_bindings <= MAX_BINDINGS; num_bindings *= 10) {
+        Env_t *env = init_env();
+        double lookup_time, scope_time;
+
+        for (i = 0; i < num_bindings; i++) {
+            extend_env(env, ids[i], value, expr_tree_root(value));
+        }
+
+        for (i = 0; i < NUM_PROBES; i++) {
+            probes[i] = ids[rand() % num_bindings];
+        }
+
+        lookup_time = bench_lookup(env, probes);
+        scope_time = bench_scope(env, probes, value);
+
+        printf("| %10d %7.1f ns %9.1f ns\n", num_bindings,
+               lookup_time * 1e9 / NUM_LOOKUPS, scope_time * 1e9 / NUM_SCOPES);
+
+        free_env(env);
+    }
+
+    free_expr_tree(value);
+    free(ids);
+    free_symbols();
+
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* volatile sink keeps the lookups from being optimized away */
+static volatile long int sink;
+
+static double bench_lookup(Env_t *env, const Symbol_t *probes) {
+    double start = now();
+    int i;
+
+    for (i = 0; i < NUM_LOOKUPS; i++) {
+        sink = lookup(env, probes[i & (NUM_PROBES - 1)])->data->nodes[0].value.i;
+    }
+
+    return now() - start;
+}
+
+/* binds a parameter that shadows a global, reads it, then drops the scope */
+static double bench_scope(Env_t *env, const Symbol_t *probes, const ExprTree *value) {
+    double start = now();
+    int i, scope = env->num_bindings;
+
+    for (i = 0; i < NUM_SCOPES; i++) {
+        extend_env(env, probes[i & (NUM_PROBES - 1)], value, expr_tree_root(value));
+        sink = lookup(env, probes[i & (NUM_PROBES - 1)])->data->nodes[0].value.i;
+        shrink_env(env, scope);
+    }
+
+    return now() - start;
+}
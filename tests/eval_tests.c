@@ -6,8 +6,10 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include "../src/eval.h"
+#include "../src/env.h"
 #include "../src/parser.h"
 #include "../src/lexer.h"
+#include "../src/symbol.h"
 #include "test.h"
 
 #define MAX_TEST_ENV_SIZE 5
@@ -21,6 +23,7 @@ typedef struct {
     const char *expr_str;
     const char *env_ids[MAX_TEST_ENV_SIZE];
     const char *env_raw_vals[MAX_TEST_ENV_SIZE];
+    int share; /* whether the expression's repeats are shared before it's evaluated */
 } Raw_Input;
 
 typedef struct {
@@ -63,8 +66,8 @@ int main(int argc, char **argv) {
             "function defn",
             {"fn f(x, y) = x * y - 0.123456", {NULL}, {NULL}},
             {
-                "(Fun f (Param(ID x)(Param(ID y)()))(Sub(Mult(ID x)(ID y))(Float 0.123456)))",
-                "[(f : (Fun f (Param(ID x)(Param(ID y)()))(Sub(Mult(ID x)(ID y))(Float 0.123456))))]",
+                "(Fun f (Param(ID x)(Param(ID y)()))(Sub(Mult(Local x 0)(Local y 1))(Float 0.123456)))",
+                "[(f : (Fun f (Param(ID x)(Param(ID y)()))(Sub(Mult(Local x 0)(Local y 1))(Float 0.123456))))]",
                 NOERR
             }
         },
@@ -73,7 +76,7 @@ int main(int argc, char **argv) {
             {"f(42, 0.01)", {"f", NULL}, {"fn f(x, y) = x * y - 0.123456", NULL}},
             {
                 "(Float 0.296544)",
-                "[(f : (Fun f (Param(ID x)(Param(ID y)()))(Sub(Mult(ID x)(ID y))(Float 0.123456))))]",
+                "[(f : (Fun f (Param(ID x)(Param(ID y)()))(Sub(Mult(Local x 0)(Local y 1))(Float 0.123456))))]",
                 NOERR
             }
         },
@@ -86,8 +89,8 @@ int main(int argc, char **argv) {
             "function defn w/shadowed variable",
             {"fn area(r) = 3.14 * r*r", {"r", NULL}, {"4", NULL}},
             {
-                "(Fun area (Param(ID r)())(Mult(Mult(Float 3.140000)(ID r))(ID r)))",
-                "[(area : (Fun area (Param(ID r)())(Mult(Mult(Float 3.140000)(ID r))(ID r)))), (r : (Int 4))]",
+                "(Fun area (Param(ID r)())(Mult(Mult(Float 3.140000)(Local r 0))(Local r 0)))",
+                "[(area : (Fun area (Param(ID r)())(Mult(Mult(Float 3.140000)(Local r 0))(Local r 0)))), (r : (Int 4))]",
                 NOERR
             }
         },
@@ -103,7 +106,7 @@ int main(int argc, char **argv) {
             {"(4*2)^(f(23 - 2)^3)", {"f", NULL}, {"fn f(x) = x - 21", NULL}},
             {
                 "(Int 1)",
-                "[(f : (Fun f (Param(ID x)())(Sub(ID x)(Int 21))))]",
+                "[(f : (Fun f (Param(ID x)())(Sub(Local x 0)(Int 21))))]",
                 NOERR
             }
         },
@@ -118,14 +121,98 @@ int main(int argc, char **argv) {
         {
             "function defn w/undefined variable",
             {"fn f(x) = x - y", {NULL}, {NULL}},
-            {"(Fun f (Param(ID x)())(Sub(ID x)(ID y)))", "[]", EINVAL}
+            {"(Fun f (Param(ID x)())(Sub(Local x 0)(ID y)))", "[]", EINVAL}
         },
         {
             "function defn w/param same as function name",
             {"fn f(f) = 5*f", {NULL}, {NULL}},
-            {"(Fun f (Param(ID f)())(Mult(Int 5)(ID f)))", "[]", EINVAL}
+            {"(Fun f (Param(ID f)())(Mult(Int 5)(Local f 0)))", "[]", EINVAL}
         },
-        {"negative exponents", {"10^-3 + 5^-2", {NULL}, {NULL}}, {"(Float 0.041000)", "[]", NOERR}}
+        {"negative exponents", {"10^-3 + 5^-2", {NULL}, {NULL}}, {"(Float 0.041000)", "[]", NOERR}},
+        {
+            "application shadowing a variable",
+            {"f(3) + x", {"f", "x", NULL}, {"fn f(x) = x * 2", "5", NULL}},
+            {"(Int 11)", "[(x : (Int 5)), (f : (Fun f (Param(ID x)())(Mult(Local x 0)(Int 2))))]", NOERR}
+        },
+        {
+            "nested applications w/same param",
+            {"g(2) * x", {"f", "g", "x", NULL}, {"fn f(x) = x + 1", "fn g(x) = f(x * 10) - x", "4", NULL}},
+            {
+                "(Int 76)",
+                "[(x : (Int 4)), (g : (Fun g (Param(ID x)())(Sub(App(ID f)(Arg(Mult(Local x 0)(Int 10))()))(Local x 0)))), "
+                "(f : (Fun f (Param(ID x)())(Add(Local x 0)(Int 1))))]",
+                NOERR
+            }
+        },
+        {
+            "arguments bound in order",
+            {"h(10, 3) - h(3, 10)", {"h", NULL}, {"fn h(a, b) = a - b*2", NULL}},
+            {"(Int 21)", "[(h : (Fun h (Param(ID a)(Param(ID b)()))(Sub(Local a 0)(Mult(Local b 1)(Int 2)))))]", NOERR}
+        },
+        {
+            "application w/too many arguments",
+            {"f(1, 2)", {"f", NULL}, {"fn f(x) = x", NULL}},
+            {"(App(ID f)(Arg(Int 1)(Arg(Int 2)())))", "[(f : (Fun f (Param(ID x)())(Local x 0)))]", EINVAL}
+        },
+        {
+            "application reading a global",
+            {"f(3)", {"y", "f", NULL}, {"2.5", "fn f(x) = x * y", NULL}},
+            {"(Float 7.500000)", "[(f : (Fun f (Param(ID x)())(Mult(Local x 0)(ID y)))), (y : (Float 2.500000))]", NOERR}
+        },
+        {
+            "division by 0 in a nested application",
+            {"g(0)", {"f", "g", NULL}, {"fn f(x) = 1 / x", "fn g(x) = f(x) + 1", NULL}},
+            {
+                "(Add(Div(Int 1)(Int 0))(Int 1))",
+                "[(g : (Fun g (Param(ID x)())(Add(App(ID f)(Arg(Local x 0)()))(Int 1)))), "
+                "(f : (Fun f (Param(ID x)())(Div(Int 1)(Local x 0))))]",
+                EINVAL
+            }
+        },
+        {
+            "application specialized to floats",
+            {"f(1.5, 2.5) + f(0.5, 4.0)", {"f", NULL}, {"fn f(x, y) = x * y + 2 * x - y / 2", NULL}},
+            {"(Float 6.500000)", "[(f : (Fun f (Param(ID x)(Param(ID y)()))(Sub(Add(Mult(Local x 0)(Local y 1))(Mult(Int 2)(Local x 0)))(Div(Local y 1)(Int 2)))))]", NOERR}
+        },
+        {
+            "application specialized to ints",
+            {"f(3, 4) + f(5, 6)", {"f", NULL}, {"fn f(x, y) = x * y + 2 * x - y / 2", NULL}},
+            {"(Int 53)", "[(f : (Fun f (Param(ID x)(Param(ID y)()))(Sub(Add(Mult(Local x 0)(Local y 1))(Mult(Int 2)(Local x 0)))(Div(Local y 1)(Int 2)))))]", NOERR}
+        },
+        {
+            "applications w/more signatures than versions",
+            {"f(3, 4) + f(1.5, 2.5) + f(2, 0.5) + f(0.5, 3)", {"f", NULL}, {"fn f(x, y) = x * y + 2 * x - y / 2", NULL}},
+            {"(Float 27.250000)", "[(f : (Fun f (Param(ID x)(Param(ID y)()))(Sub(Add(Mult(Local x 0)(Local y 1))(Mult(Int 2)(Local x 0)))(Div(Local y 1)(Int 2)))))]", NOERR}
+        },
+        {
+            "overflow in int specialized application",
+            {"f(3, 4) + f(4611686018427387904, 2)", {"f", NULL}, {"fn f(x, y) = x * y + 2 * x - y / 2", NULL}},
+            {"(Int 15)", "[(f : (Fun f (Param(ID x)(Param(ID y)()))(Sub(Add(Mult(Local x 0)(Local y 1))(Mult(Int 2)(Local x 0)))(Div(Local y 1)(Int 2)))))]", ERANGE}
+        },
+        {
+            "shared repeats",
+            {"(a * b + c) / (a * b + c) - (a * b + c)", {"a", "b", "c", NULL}, {"2", "3", "1", NULL}, 1},
+            {"(Int -6)", "[(c : (Int 1)), (b : (Int 3)), (a : (Int 2))]", NOERR}
+        },
+        {
+            "shared applications",
+            {"f(2) * f(2) + f(2)", {"f", NULL}, {"fn f(x) = x * x + 1", NULL}, 1},
+            {"(Int 30)", "[(f : (Fun f (Param(ID x)())(Add(Mult(Local x 0)(Local x 0))(Int 1))))]", NOERR}
+        },
+        {
+            "shared symbolic repeats",
+            {"fn g(x) = (x + 1) * (x + 1)", {NULL}, {NULL}, 1},
+            {
+                "(Fun g (Param(ID x)())(Mult(Add(Local x 0)(Int 1))(Add(Local x 0)(Int 1))))",
+                "[(g : (Fun g (Param(ID x)())(Mult(Add(Local x 0)(Int 1))(Add(Local x 0)(Int 1)))))]",
+                NOERR
+            }
+        },
+        {
+            "shared repeats w/errors",
+            {"(x / 0) * 2 + (x / 0)", {"x", NULL}, {"5", NULL}, 1},
+            {"(Add(Mult(Div(Int 5)(Int 0))(Int 2))(Div(Int 5)(Int 0)))", "[(x : (Int 5))]", EINVAL}
+        }
     };
     int num_tests = sizeof(tests) / sizeof(Test), num_passed, suite_result;
 
@@ -207,19 +294,20 @@ static int run_all_tests(const Test *tests, int num_tests) {
 static int run_test(const Test *test) {
     ExprTree *tree;
     Input *input = create_input(&(test->raw_input));
-    char *tree_str, *input_str, *before_env_str, *after_env_str;
-    int errno_before, correct_tree, correct_env, correct_err, t_result;
+    char *tree_str, *input_str, *after_input_str, *before_env_str, *after_env_str;
+    int errno_before, correct_tree, correct_env, correct_err, correct_input, t_result;
 
     if (verbose) {
         printf("| " C_TEST_NAME("%s") " test:\n", test->name);
-        input_str = expr_tree_to_str(input->tree);
     }
-    
+
+    input_str = expr_tree_to_str(input->tree);
     errno_before = errno;
     before_env_str = env_to_str(input->env);
-    tree = eval(&(input->tree), input->env);
+    tree = eval(input->tree, input->env);
     tree_str = expr_tree_to_str(tree);
     after_env_str = env_to_str(input->env);
+    after_input_str = expr_tree_to_str(input->tree);
 
     if (verbose) {
         printf("| raw string input:      %s\n", test->raw_input.expr_str);
@@ -236,16 +324,20 @@ static int run_test(const Test *test) {
         printf("| eval return val: %p\n", (void *) tree);
         printf("| evaluated tree:  %s\n", tree_str);
         printf("| expected tree:   %s\n", test->ans.tree);
-
-        free(input_str);
+        printf(SMALL_SEP);
+        printf("| input tree after eval: %s\n", after_input_str);
     }
 
     correct_tree = strcmp(tree_str, test->ans.tree) == 0;
     correct_env = strcmp(after_env_str, test->ans.env) == 0;
     correct_err = errno == test->ans.err;
-    t_result = (correct_tree && correct_env && correct_err) ? SUCCESS : FAILURE;
+    correct_input = strcmp(after_input_str, input_str) == 0;
+    t_result = (correct_tree && correct_env && correct_err && correct_input) ? SUCCESS : FAILURE;
 
     free(tree_str);
+    free(input_str);
+    free(after_input_str);
+    free_expr_tree(tree);
     free(before_env_str);
     free(after_env_str);
     free_input(input);
@@ -259,19 +351,6 @@ static void free_input(Input *input) {
     free(input);
 }
 
-/* extend_env in eval.c is static and I don't want to expose it just for this test suite */
-static void t_extend_env(Env_t *env, const char *id, ExprTree *data) {
-    Env_t *new_data;
-
-    new_data = malloc(sizeof(Env_t));
-    new_data->id = malloc(strlen(id) + 1);
-    strcpy(new_data->id, id);
-    new_data->data = data;
-    new_data->next = env->next;
-
-    env->next = new_data;
-}
-
 static Input *create_input(const Raw_Input *raw_input) {
     const char * const *env_ids = raw_input->env_ids;
     const char * const *env_raw_vals = raw_input->env_raw_vals;
@@ -281,23 +360,31 @@ static Input *create_input(const Raw_Input *raw_input) {
     Env_t *env = init_env();
     int i = 0;
 
-    compile_regexs();
-    tok_l = tokenize(raw_input->expr_str);
+    tok_l = tokenize(raw_input->expr_str, strlen(raw_input->expr_str));
     tree = parse(tok_l);
     free_token_list(tok_l);
 
+    if (raw_input->share) {
+        share_subtrees(tree);
+    }
+
     while (env_raw_vals[i] != NULL && env_ids[i] != NULL) {
-        TokenList *e_tok_l = tokenize(env_raw_vals[i]);
+        TokenList *e_tok_l = tokenize(env_raw_vals[i], strlen(env_raw_vals[i]));
         ExprTree *e_tree = parse(e_tok_l);
 
-        t_extend_env(env, env_ids[i], e_tree);
+        /* functions are defined (under their own name) so their parameters are resolved to slots */
+        if (e_tree->nodes[expr_tree_root(e_tree)].expr == Fun) {
+            free_expr_tree(eval(e_tree, env));
+        } else {
+            extend_env(env, intern(env_ids[i], strlen(env_ids[i])), e_tree, expr_tree_root(e_tree));
+        }
+
+        free_expr_tree(e_tree);
 
         free_token_list(e_tok_l);
         i++;
     }
 
-    free_regexs();
-
     input->tree = tree;
     input->env = env;
 
@@ -0,0 +1,424 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include "../src/jit.h"
+#include "../src/vm.h"
+#include "../src/eval.h"
+#include "../src/env.h"
+#include "../src/parser.h"
+#include "../src/lexer.h"
+#include "../src/symbol.h"
+#include "test.h"
+
+#define MAX_TEST_DEFS 8
+#define TEST_THRESHOLD 2    /* the first call runs on the VM, the rest as machine code */
+#define NUM_ROUNDS 3
+#define NUM_RANDOM_FUNS 4
+#define NUM_RANDOM_CALLS 60
+#define MAX_EXPR_LEN 8192
+
+/*
+ * Every test evaluates the same lines in two environments, one with the JIT on and one without,
+ * and they have to agree on every result and every error.
+ */
+typedef struct {
+    const char *name;
+    const char *defs[MAX_TEST_DEFS];
+    const char *expr;   /* evaluated NUM_ROUNDS times */
+    const char *tree;   /* what expr evaluates to */
+    int err;
+    const char *fun;    /* the function whose code is checked for afterwards */
+    int native;         /* whether it should still have machine code then */
+} Test;
+
+/* random tests define functions with random bodies and call them on random arguments */
+typedef struct {
+    const char *name;
+    unsigned int seed;
+} RandomTest;
+
+typedef struct {
+    Env_t *env;
+    Jit *jit;
+} Side;
+
+int verbose = 0;
+static int run_all_tests(const Test *tests, int num_tests);
+static int run_all_random_tests(const RandomTest *tests, int num_tests);
+static int fork_test(int (*test_fn)(const void *), const void *test, int i);
+static void print_result(const char *name, int t_result);
+static int run_test(const void *t);
+static int run_random_test(const void *t);
+static int compare(const char *line, Side *sides, char **tree_str, int *err);
+static int has_native(Env_t *env, const char *fun);
+
+int main(int argc, char **argv) {
+    Test tests[] = {
+        {"int arithmetic", {"fn f(x, y) = x * y - x + 7"}, "f(6, 7)", "(Int 43)", NOERR, "f", 1},
+        {"float arithmetic", {"fn f(x, y) = x * 0.5 + y / 4"}, "f(3, 2.5)", "(Float 2.125000)", NOERR, "f", 1},
+        {"int and float mixed", {"fn f(x) = x - 0.25 + x * 2"}, "f(3)", "(Float 8.750000)", NOERR, "f", 1},
+        {"division and exponent", {"fn f(x, y) = x ^ y / 4"}, "f(2, 3)", "(Int 2)", NOERR, "f", 1},
+        {
+            "compiled code calling compiled code",
+            {"fn g(x) = x + 1", "fn f(x) = g(x) * g(x + 1)"},
+            "f(4)", "(Int 30)", NOERR, "g", 1
+        },
+        {"reading a global", {"k = 2.5", "fn f(x) = x * k"}, "f(4)", "(Float 10.000000)", NOERR, "f", 1},
+        {
+            "global rebound after it's cached",
+            {"k = 2", "fn f(x) = x * k", "f(1)", "f(1)", "k = 5"},
+            "f(4)", "(Int 20)", NOERR, "f", 1
+        },
+        {
+            "callee redefined after it's cached",
+            {"fn g(x) = x + 1", "fn f(x) = g(x) * 2", "f(1)", "f(1)", "fn g(x) = x * 10"},
+            "f(4)", "(Int 80)", NOERR, "f", 1
+        },
+        {"adding two negatives", {"fn f(x, y) = x + y"}, "f(-5, -3)", "(Int -8)", NOERR, "f", 1},
+        {
+            "int overflow goes back to the VM",
+            {"fn f(x) = x * x"},
+            "f(4000000000)", "(Int -2446744073709551616)", ERANGE, "f", 1
+        },
+        {"division by 0 goes back to the VM", {"fn f(x) = 1 / x"}, "f(0)", "(Div(Int 1)(Int 0))", EINVAL, "f", 1},
+        {
+            "symbolic argument goes back to the VM",
+            {"fn h(k) = k + 1", "fn q(x) = x"},
+            "h(q)", "(Add(Fun q (Param(ID x)())(Local x 0))(Int 1))", NOERR, "h", 1
+        },
+        {
+            "machine code kept after a bail",
+            {"fn f(x) = x * x", "f(2)", "f(3)", "f(4000000000)"},
+            "f(5)", "(Int 25)", NOERR, "f", 1
+        },
+        {
+            "machine code that keeps bailing dropped",
+            {"fn f(x) = 1 / x", "f(0)", "f(0)", "f(0)", "f(0)", "f(0)", "f(0)"},
+            "f(0)", "(Div(Int 1)(Int 0))", EINVAL, "f", 0
+        },
+        {
+            "redefinition starts over",
+            {"fn f(x) = x + 1", "f(1)", "f(1)", "fn f(x) = x * 10"},
+            "f(2)", "(Int 20)", NOERR, "f", 1
+        }
+    };
+    RandomTest random_tests[] = {
+        {"random functions (seed 1)", 1},
+        {"random functions (seed 2)", 2},
+        {"random functions (seed 3)", 3},
+        {"random functions (seed 4)", 4},
+        {"random functions (seed 5)", 5},
+        {"random functions (seed 6)", 6},
+        {"random functions (seed 7)", 7},
+        {"random functions (seed 8)", 8},
+    };
+    int num_tests = sizeof(tests) / sizeof(Test), num_passed;
+    int num_random_tests = sizeof(random_tests) / sizeof(RandomTest), suite_result;
+
+    if (argc == 2 && (strcmp(argv[1], "-v") == 0
+                   || strcmp(argv[1], "--verbose") == 0)) {
+        verbose = 1;
+        printf(SEP);
+        printf("|\n|                        ");
+    } else {
+        printf("| ");
+    }
+
+    printf(C_SUITE_NAME("jit tests") "\n");
+    printf("|\n");
+
+    num_passed = run_all_tests(tests, num_tests);
+    num_passed += run_all_random_tests(random_tests, num_random_tests);
+    num_tests += num_random_tests;
+    suite_result = num_passed == num_tests ? SUCCESS : FAILURE;
+
+    printf("|\n| Ran (%d/%d) tests successfully\n", num_passed, num_tests);
+    printf("| Test suite %s\n", suite_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf("|\n");
+        printf(SEP);
+    }
+
+    return suite_result;
+}
+
+static int run_all_tests(const Test *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int run_all_random_tests(const RandomTest *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_random_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int fork_test(int (*test_fn)(const void *), const void *test, int i) {
+    int t_result;
+    pid_t fork_result;
+
+    if (i == 0 && verbose) {
+        printf(SEP);
+    }
+
+    fflush(stdout);
+    fork_result = fork();
+    if (fork_result < 0) {
+        fprintf(stderr, "Test %d: fork failed\n", i);
+        exit(EXIT_FAILURE);
+    } else if (fork_result != 0) {
+        int status;
+
+        wait(&status);
+
+        if (WIFEXITED(status)) {
+            t_result = WEXITSTATUS(status);
+        } else {
+            t_result = FAILURE;
+        }
+    } else {
+        t_result = test_fn(test);
+        exit(t_result);
+    }
+
+    return t_result;
+}
+
+static void print_result(const char *name, int t_result) {
+    if (verbose) {
+        printf("|\n");
+    }
+
+    printf("| " C_TEST_NAME("%s") " %s\n", name, t_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf(SEP);
+    }
+}
+
+static void open_sides(Side *sides) {
+    sides[0].env = init_env();
+    sides[0].jit = NULL;
+    sides[1].env = init_env();
+    sides[1].jit = new_jit(TEST_THRESHOLD);
+    sides[1].env->jit = sides[1].jit;
+}
+
+static void close_sides(Side *sides) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        free_env(sides[i].env);
+        free_jit(sides[i].jit);
+    }
+}
+
+static int run_test(const void *t) {
+    const Test *test = t;
+    Side sides[2];
+    char *tree_str = NULL;
+    int i, err, agree = 1, correct_tree = 1, correct_err = 1, correct_native;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+    }
+
+    open_sides(sides);
+
+    for (i = 0; i < MAX_TEST_DEFS && test->defs[i] != NULL; i++) {
+        agree = compare(test->defs[i], sides, NULL, &err) && agree;
+    }
+
+    for (i = 0; i < NUM_ROUNDS; i++) {
+        agree = compare(test->expr, sides, &tree_str, &err) && agree;
+        correct_tree = strcmp(tree_str, test->tree) == 0 && correct_tree;
+        correct_err = err == test->err && correct_err;
+
+        if (verbose) {
+            printf("| round %d: %s (errno %d)\n", i + 1, tree_str, err);
+        }
+
+        free(tree_str);
+    }
+
+    correct_native = has_native(sides[1].env, test->fun) == test->native;
+
+    if (verbose) {
+        printf(SMALL_SEP);
+        printf("| expected tree:  %s\n", test->tree);
+        printf("| expected errno: %d\n", test->err);
+        printf("| %s has machine code: %d (expected %d)\n", test->fun,
+               has_native(sides[1].env, test->fun), test->native);
+    }
+
+    close_sides(sides);
+
+    return (agree && correct_tree && correct_err && correct_native) ? SUCCESS : FAILURE;
+}
+
+/* numbers that are mostly small, with some at the edges of the int range and some floats */
+static int random_number(char *buf) {
+    static const char *edges[] = {
+        "9223372036854775807", "-9223372036854775807", "4611686018427387904", "3037000500", "-3037000499"
+    };
+    static const char *floats[] = {"0.5", "2.25", "-1.5", "1000000000.25"};
+    int r = rand() % 10;
+
+    if (r < 2) {
+        return sprintf(buf, "%s", edges[rand() % 5]);
+    } else if (r < 4) {
+        return sprintf(buf, "%s", floats[rand() % 4]);
+    }
+
+    return sprintf(buf, "%d", rand() % 13 - 3);
+}
+
+/* a random body over params p0 to p(num_params - 1), calling any of the first num_funs functions */
+static int random_expr(char *buf, int num_params, int num_funs, int depth) {
+    static const char ops[] = "+-*+-*/^";
+    int r = rand() % 10, len = 0;
+
+    if (depth > 3 || r < 3) {
+        if (num_params > 0 && rand() % 2) {
+            return sprintf(buf, "p%d", rand() % num_params);
+        }
+
+        return random_number(buf);
+    }
+
+    if (num_funs > 0 && r < 5) {
+        int fun = rand() % num_funs, i;
+
+        len += sprintf(buf, "f%d(", fun);
+
+        /* f(i) takes i + 1 params */
+        for (i = 0; i <= fun; i++) {
+            len += sprintf(buf + len, "%s", i > 0 ? ", " : "");
+            len += random_expr(buf + len, num_params, num_funs, depth + 1);
+        }
+
+        return len + sprintf(buf + len, ")");
+    }
+
+    len += sprintf(buf, "(");
+    len += random_expr(buf + len, num_params, num_funs, depth + 1);
+    len += sprintf(buf + len, " %c ", ops[rand() % 8]);
+    len += random_expr(buf + len, num_params, num_funs, depth + 1);
+
+    return len + sprintf(buf + len, ")");
+}
+
+static int run_random_test(const void *t) {
+    const RandomTest *test = t;
+    char *line = malloc(MAX_EXPR_LEN);
+    Side sides[2];
+    int i, err, agree = 1;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+    }
+
+    /* a good share of the calls are errors, which would bury the results */
+    if (!verbose) {
+        freopen("/dev/null", "w", stderr);
+    }
+
+    srand(test->seed);
+    open_sides(sides);
+    agree = compare("g = 3", sides, NULL, &err);
+
+    for (i = 0; i < NUM_RANDOM_FUNS; i++) {
+        int len = sprintf(line, "fn f%d(p0", i), j;
+
+        for (j = 1; j <= i; j++) {
+            len += sprintf(line + len, ", p%d", j);
+        }
+
+        len += sprintf(line + len, ") = ");
+        random_expr(line + len, i + 1, i, 0);
+        agree = compare(line, sides, NULL, &err) && agree;
+    }
+
+    for (i = 0; i < NUM_RANDOM_CALLS; i++) {
+        int fun = rand() % NUM_RANDOM_FUNS, len = sprintf(line, "f%d(", fun), j;
+
+        for (j = 0; j <= fun; j++) {
+            len += sprintf(line + len, "%s", j > 0 ? ", " : "");
+            len += random_number(line + len);
+        }
+
+        sprintf(line + len, ")");
+        agree = compare(line, sides, NULL, &err) && agree;
+    }
+
+    close_sides(sides);
+    free(line);
+
+    return agree ? SUCCESS : FAILURE;
+}
+
+/* evaluates line on both sides, returning whether they agree, and what the JIT side gave */
+static int compare(const char *line, Side *sides, char **tree_str, int *err) {
+    char *results[2];
+    int errs[2], i, agree;
+
+    for (i = 0; i < 2; i++) {
+        TokenList *tok_l;
+        ExprTree *tree, *value;
+
+        errno = 0;
+        tok_l = tokenize(line, strlen(line));
+        tree = parse(tok_l);
+        value = eval(tree, sides[i].env);
+        errs[i] = errno;
+        results[i] = expr_tree_to_str(value);
+
+        free_expr_tree(value);
+        free_expr_tree(tree);
+        free_token_list(tok_l);
+    }
+
+    agree = strcmp(results[0], results[1]) == 0 && errs[0] == errs[1];
+
+    if (verbose && !agree) {
+        printf("| %s\n|   interpreted: %s (errno %d)\n|   jit:         %s (errno %d)\n",
+               line, results[0], errs[0], results[1], errs[1]);
+    }
+
+    free(results[0]);
+    *err = errs[1];
+
+    if (tree_str != NULL) {
+        *tree_str = results[1];
+    } else {
+        free(results[1]);
+    }
+
+    return agree;
+}
+
+static int has_native(Env_t *env, const char *fun) {
+    Binding *binding = env_find(env, intern(fun, strlen(fun)));
+
+    return binding != NULL && binding->data->code != NULL && binding->data->code->native != NULL;
+}
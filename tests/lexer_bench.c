@@ -0,0 +1,178 @@
+#define _POSIX_C_SOURCE 199309L /* clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/lexer.h"
+#include "../src/number.h"
+#include "test.h"
+
+#define NUM_LITERALS 1000000
+#define NUM_RUNS 5
+
+/*
+ * Benchmarks lexing a data table pasted in as one expression, i.e. a line that is almost all
+ * number literals. The literal conversion is also timed on its own against the way the lexer used
+ * to do it (copy the match into a fresh string and call atof/atol), since that's the part of
+ * tokenize this input stresses.
+ */
+typedef struct {
+    const char *str;
+    int length;
+    int is_float;
+} Literal;
+
+static double now();
+static char *make_table(Literal *literals);
+static double bench_tokenize(const char *input);
+static double bench_legacy_convert(const Literal *literals);
+static double bench_convert(const Literal *literals);
+
+int main() {
+    Literal *literals = malloc(NUM_LITERALS * sizeof(Literal));
+    char *input = make_table(literals);
+    double tokenize_time, legacy_time, convert_time;
+
+    printf("| " C_SUITE_NAME("lexer benchmarks") "\n");
+    printf("|\n");
+
+    tokenize_time = bench_tokenize(input);
+    legacy_time = bench_legacy_convert(literals);
+    convert_time = bench_convert(literals);
+
+    printf("| " C_TEST_NAME("%s") "\n", "data table, 1 million literals");
+    printf("| tokenize:               %8.2f ms (%.1f ns/literal, %.0f MB/s)\n",
+           tokenize_time * 1e3, tokenize_time * 1e9 / NUM_LITERALS, strlen(input) / tokenize_time / 1e6);
+    printf("| convert (calloc + atof): %7.2f ms (%.1f ns/literal)\n",
+           legacy_time * 1e3, legacy_time * 1e9 / NUM_LITERALS);
+    printf("| convert (parse_*):       %7.2f ms (%.1f ns/literal)\n",
+           convert_time * 1e3, convert_time * 1e9 / NUM_LITERALS);
+    printf("| conversion speedup:      %7.2fx\n", legacy_time / convert_time);
+
+    free(input);
+    free(literals);
+
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* rows of prices, measurements, and counts, e.g. "1042.75 + -0.0031 + 88 + 3.14159265 + ..." */
+static char *make_table(Literal *literals) {
+    char *input = malloc(NUM_LITERALS * 32), *p = input;
+    int i;
+
+    srand(1);
+
+    for (i = 0; i < NUM_LITERALS; i++) {
+        char *start;
+
+        if (i > 0) {
+            p += sprintf(p, " + ");
+        }
+
+        start = p;
+
+        switch (i % 4) {
+            case 0:
+                p += sprintf(p, "%d.%02d", rand() % 100000, rand() % 100);
+                break;
+            case 1:
+                p += sprintf(p, "-0.%04d", rand() % 10000);
+                break;
+            case 2:
+                p += sprintf(p, "%d", rand());
+                break;
+            default:
+                p += sprintf(p, "%d.%08d", rand() % 10, rand() % 100000000);
+                break;
+        }
+
+        literals[i].str = start;
+        literals[i].length = p - start;
+        literals[i].is_float = i % 4 != 2;
+    }
+
+    return input;
+}
+
+static double bench_tokenize(const char *input) {
+    size_t input_length = strlen(input);
+    double best = 0;
+    int run;
+
+    for (run = 0; run < NUM_RUNS; run++) {
+        double start = now(), elapsed;
+        TokenList *tok_l = tokenize(input, input_length);
+
+        elapsed = now() - start;
+        best = run == 0 || elapsed < best ? elapsed : best;
+
+        free_token_list(tok_l);
+    }
+
+    return best;
+}
+
+/* volatile sinks keep the conversions from being optimized away */
+static volatile double float_sink;
+static volatile long int int_sink;
+
+static double bench_legacy_convert(const Literal *literals) {
+    double best = 0;
+    int run, i;
+
+    for (run = 0; run < NUM_RUNS; run++) {
+        double start = now(), elapsed;
+
+        for (i = 0; i < NUM_LITERALS; i++) {
+            char *num_str = calloc(1, literals[i].length + 1);
+
+            strncpy(num_str, literals[i].str, literals[i].length);
+
+            if (literals[i].is_float) {
+                float_sink = atof(num_str);
+            } else {
+                int_sink = atol(num_str);
+            }
+
+            free(num_str);
+        }
+
+        elapsed = now() - start;
+        best = run == 0 || elapsed < best ? elapsed : best;
+    }
+
+    return best;
+}
+
+static double bench_convert(const Literal *literals) {
+    double best = 0;
+    int run, i;
+
+    for (run = 0; run < NUM_RUNS; run++) {
+        double start = now(), elapsed;
+
+        for (i = 0; i < NUM_LITERALS; i++) {
+            if (literals[i].is_float) {
+                float_sink = parse_float(literals[i].str, literals[i].length);
+            } else {
+                long int num;
+
+                parse_int(literals[i].str, literals[i].length, &num);
+                int_sink = num;
+            }
+        }
+
+        elapsed = now() - start;
+        best = run == 0 || elapsed < best ? elapsed : best;
+    }
+
+    return best;
+}
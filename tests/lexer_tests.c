@@ -4,7 +4,9 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <errno.h>
+#include <regex.h>
 #include "../src/lexer.h"
 #include "test.h"
 
@@ -17,11 +19,36 @@ typedef struct {
     const char *name;
     const char *input;
     Ans ans;
+    int length; /* how much of input to lex, or 0 for all of it */
 } Test;
 
+/* stress tests build their input by repeating unit until the line holds num_toks tokens */
+typedef struct {
+    const char *name;
+    const char *unit;
+    int toks_per_unit;
+    int num_toks;
+} StressTest;
+
+/* rounding tests lex num_literals random floats of up to max_digits digits and compare with strtod */
+typedef struct {
+    const char *name;
+    int num_literals;
+    int max_digits;
+} RoundingTest;
+
+#define DEFAULT_STACK_SIZE (8 * 1024 * 1024)
+
 int verbose = 0;
 static int run_all_tests(const Test *tests, int num_tests);
-static int run_test(const Test *test);
+static int run_all_stress_tests(const StressTest *tests, int num_tests);
+static int run_all_rounding_tests(const RoundingTest *tests, int num_tests);
+static int fork_test(int (*test_fn)(const void *), const void *test, int i);
+static void print_result(const char *name, int t_result);
+static int run_test(const void *t);
+static int run_stress_test(const void *t);
+static int run_rounding_test(const void *t);
+static char *ref_tokenize(const char *input, int *err);
 
 int main(int argc, char **argv) {
     Test tests[] = {
@@ -62,8 +89,36 @@ int main(int argc, char **argv) {
             "fn xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx(y) = 0",
             {"[TOK_FUN]", ENAMETOOLONG}
         },
+        {
+            "number edge cases",
+            "-.5 -. 5.5.5 1-2",
+            {"[TOK_FLOAT -0.500000, TOK_SUB, TOK_DOT, TOK_FLOAT 5.500000, TOK_FLOAT 0.500000, TOK_INT 1, TOK_INT -2]", NOERR}
+        },
+        {"fn prefix", "fnord", {"[TOK_ID fnord]", NOERR}},
+        {"leading underscore", "_x", {"[]", EINVAL}},
+        {
+            "int limits",
+            "9223372036854775807 -9223372036854775808",
+            {"[TOK_INT 9223372036854775807, TOK_INT -9223372036854775808]", NOERR}
+        },
+        {"int overflow", "9223372036854775808", {"[]", ERANGE}},
+        {"negative int overflow", "1 + -9223372036854775809", {"[TOK_INT 1, TOK_ADD]", ERANGE}},
+        {"long int overflow", "99999999999999999999999", {"[]", ERANGE}},
+        {"long float", "0.000000000000000000000000000123456789012345678901234", {"[TOK_FLOAT 0.000000]", NOERR}},
+        {"part of a line", "12 + 345 # comment", {"[TOK_INT 12, TOK_ADD, TOK_INT 3]", NOERR}, 6},
+        {"part of a line ending in a comment", "1 # ab\n2", {"[TOK_INT 1, TOK_COMMENT]", NOERR}, 6},
+    };
+    StressTest stress_tests[] = {
+        {"10 million token line", "x1 * 2.5 - ", 4, 10000000},
+        {"10 million single char tokens", "(+", 2, 10000000},
+    };
+    RoundingTest rounding_tests[] = {
+        {"float rounding (short literals)", 200000, 17},
+        {"float rounding (long literals)", 50000, 40},
     };
     int num_tests = sizeof(tests) / sizeof(Test), num_passed;
+    int num_stress_tests = sizeof(stress_tests) / sizeof(StressTest);
+    int num_rounding_tests = sizeof(rounding_tests) / sizeof(RoundingTest);
 
     if (argc == 2 && (strcmp(argv[1], "-v") == 0 
                    || strcmp(argv[1], "--verbose") == 0)) {
@@ -78,6 +133,9 @@ int main(int argc, char **argv) {
     printf("|\n");
 
     num_passed = run_all_tests(tests, num_tests);
+    num_passed += run_all_stress_tests(stress_tests, num_stress_tests);
+    num_passed += run_all_rounding_tests(rounding_tests, num_rounding_tests);
+    num_tests += num_stress_tests + num_rounding_tests;
 
     printf("|\n| Ran (%d/%d) tests successfully\n", num_passed, num_tests);
     printf("| Test suite %s\n", num_passed == num_tests ? PASSED : FAILED);
@@ -94,84 +152,369 @@ static int run_all_tests(const Test *tests, int num_tests) {
     int i, num_passed = 0;
 
     for (i = 0; i < num_tests; i++) {
-        int t_result;
-        pid_t fork_result;
+        int t_result = fork_test(run_test, &(tests[i]), i);
 
-        if (i == 0 && verbose) {
-            printf(SEP);
-        }
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
 
-        fflush(stdout);
-        fork_result = fork();
-        if (fork_result < 0) {
-            fprintf(stderr, "Test %d: fork failed\n", i);
-            exit(EXIT_FAILURE);
-        } else if (fork_result != 0) {
-            int status;
+    return num_passed;
+}
 
-            wait(&status);
+static int run_all_stress_tests(const StressTest *tests, int num_tests) {
+    int i, num_passed = 0;
 
-            if (WIFEXITED(status)) {
-                t_result = WEXITSTATUS(status);
-            } else {
-                t_result = FAILURE;
-            }
-        } else {
-            t_result = run_test(&(tests[i]));
-            exit(t_result);
-        }
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_stress_test, &(tests[i]), i);
 
         num_passed += t_result == SUCCESS ? 1 : 0;
-        
-        if (verbose) {
-            printf("|\n");
-        }
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
 
-        printf("| " C_TEST_NAME("%s") " %s\n", tests[i].name,
-               t_result == SUCCESS ? PASSED : FAILED);
+static int run_all_rounding_tests(const RoundingTest *tests, int num_tests) {
+    int i, num_passed = 0;
 
-        if (verbose) {
-            printf(SEP);
-        }
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_rounding_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
     }
 
     return num_passed;
 }
 
-static int run_test(const Test *test) {
+static int fork_test(int (*test_fn)(const void *), const void *test, int i) {
+    int t_result;
+    pid_t fork_result;
+
+    if (i == 0 && verbose) {
+        printf(SEP);
+    }
+
+    fflush(stdout);
+    fork_result = fork();
+    if (fork_result < 0) {
+        fprintf(stderr, "Test %d: fork failed\n", i);
+        exit(EXIT_FAILURE);
+    } else if (fork_result != 0) {
+        int status;
+
+        wait(&status);
+
+        if (WIFEXITED(status)) {
+            t_result = WEXITSTATUS(status);
+        } else {
+            t_result = FAILURE;
+        }
+    } else {
+        t_result = test_fn(test);
+        exit(t_result);
+    }
+
+    return t_result;
+}
+
+static void print_result(const char *name, int t_result) {
+    if (verbose) {
+        printf("|\n");
+    }
+
+    printf("| " C_TEST_NAME("%s") " %s\n", name, t_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf(SEP);
+    }
+}
+
+static int run_test(const void *t) {
+    const Test *test = t;
     TokenList *tok_l;
-    char *tok_l_str;
-    int errno_before, correct_tok_l, correct_err, t_result;
+    char *tok_l_str, *ref_str, *input;
+    int errno_before, errno_after, ref_err, correct_tok_l, correct_err, matches_ref, t_result;
+    size_t length;
 
     if (verbose) {
         printf("| " C_TEST_NAME("%s") " test:\n", test->name);
     }
 
-    compile_regexs();
+    /* the reference lexer needs a terminated string, so it gets a copy of just the part lexed */
+    length = test->length != 0 ? test->length : strlen(test->input);
+    input = malloc(length + 1);
+    memcpy(input, test->input, length);
+    input[length] = '\0';
 
     errno_before = errno;
-    tok_l = tokenize(test->input);
+    tok_l = tokenize(test->input, length);
+    errno_after = errno;
     tok_l_str = token_list_to_str(tok_l);
+    ref_str = ref_tokenize(input, &ref_err);
 
     if (verbose) {
-        printf("| input: \"%s\"\n", test->input);
+        printf("| input: \"%s\"\n", input);
         printf(SMALL_SEP);
         printf("| errno (before tokenize): %d\n", errno_before);
-        printf("| errno (after tokenize):  %d\n", errno);
+        printf("| errno (after tokenize):  %d\n", errno_after);
         printf("| expected errno:          %d\n", test->ans.err);
+        printf("| reference lexer errno:   %d\n", ref_err);
         printf(SMALL_SEP);
         printf("| tokenize return val: %p\n", (void *) tok_l);
         printf("| token list: %s\n", tok_l_str);
         printf("| expected:   %s\n", test->ans.tok_l);
+        printf("| reference:  %s\n", ref_str);
     }
     
     correct_tok_l = strcmp(tok_l_str, test->ans.tok_l) == 0;
-    correct_err = errno == test->ans.err;
-    t_result = (correct_tok_l && correct_err) ? SUCCESS : FAILURE;
+    correct_err = errno_after == test->ans.err;
+    matches_ref = strcmp(tok_l_str, ref_str) == 0 && errno_after == ref_err;
+    t_result = (correct_tok_l && correct_err && matches_ref) ? SUCCESS : FAILURE;
     
+    free(input);
     free(tok_l_str);
+    free(ref_str);
     free_token_list(tok_l);
-    free_regexs();
 
     return t_result;
 }
+
+/*
+ * Lexes and frees one huge line under the default 8 MB stack limit, so any per-token recursion in
+ * tokenize or free_token_list crashes the child process and fails the test.
+ */
+static int run_stress_test(const void *t) {
+    const StressTest *test = t;
+    struct rlimit stack_limit;
+    TokenList *tok_l;
+    char *input;
+    int unit_len = strlen(test->unit), num_units = test->num_toks / test->toks_per_unit;
+    int i, num_toks, correct_toks, correct_err;
+
+    getrlimit(RLIMIT_STACK, &stack_limit);
+    stack_limit.rlim_cur = DEFAULT_STACK_SIZE;
+    setrlimit(RLIMIT_STACK, &stack_limit);
+
+    input = malloc(unit_len * num_units + 1);
+    for (i = 0; i < num_units; i++) {
+        memcpy(input + i * unit_len, test->unit, unit_len);
+    }
+    input[unit_len * num_units] = '\0';
+
+    errno = 0;
+    tok_l = tokenize(input, strlen(input));
+
+    num_toks = tok_l->length;
+
+    correct_toks = num_toks == test->num_toks;
+    correct_err = errno == NOERR;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        printf("| input: \"%s\" repeated %d times\n", test->unit, num_units);
+        printf(SMALL_SEP);
+        printf("| errno (after tokenize): %d\n", errno);
+        printf("| tokens lexed:    %d\n", num_toks);
+        printf("| expected tokens: %d\n", test->num_toks);
+    }
+
+    free_token_list(tok_l);
+    free(input);
+
+    return (correct_toks && correct_err) ? SUCCESS : FAILURE;
+}
+
+/*
+ * Literals that sit on or next to a rounding boundary, or at the edges of the double range, go
+ * first, then random ones. Every literal must convert to exactly the double strtod gives.
+ */
+static int run_rounding_test(const void *t) {
+    const RoundingTest *test = t;
+    const char *edge_cases[] = {
+        "9007199254740993.", "9007199254740992.5", "0.1", "0.3", "2.2250738585072011",
+        "179769313486231570814527423731704356798070567525844996598917476803157260780028538760589558632766878"
+        "171540458953514382464234321326889464182768467546703537516986049910576551282076245490090389328944075"
+        "868508455133942304583236903222948165808559332123348274797826204144723168738177180919299881250404026"
+        "184124858368.",
+        "179769313486231580793728971405303415079934132710037826936173778980444968292764750946649017977587207"
+        "096330286416692887910946555547851940402630657488671505820681908902000708383676273854845817711531764"
+        "475730270069855571366959622842914819860834936475292719074168444365510704342711559699508093042880177"
+        "904174497792.",
+        "0.0000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "00494065645841246544176568792868221372365059802614324764425585682500675507270208751865299836361635"
+        "99237979656469544571773092665671035593979639877479601078187812630071319031140452784581716784898210"
+        "36887186360569987307230500063874091535649843873124733972731696151400317153853980741262385655911710"
+        "26658556686768187039560310624931945271591492455329305456544401127480129709999541931989409080416563"
+        "32452475714786901472678015935523861155013480352649347201937902681071074917033322268447533357208324"
+        "31936092382893458368060106011506169809753078342277318329247904982524730776375927247874656084778203"
+        "73446969953364701797267771758512566055119913150489110145103786273816725095583738973359899366480994"
+        "1164205702637090279242767544565229087538682506419718265533447265625",
+        "0.0000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "0000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "0024703282292062327208828439643411068618252990130716238221279284125033775363510437593264991818081799"
+        "618989828234772285886546332835517796989819938739800539093906315035659515570226392290858392449105184"
+        "435931802849936536152500319370457678249219365623669863658480757001585769269903706311928279558551332"
+        "927834338409351978015531246597263579574622766465272827220056374006485499977096599470454020828166226"
+        "237857393450736339007967761930577506740176324673600968951340535537458516661134223766678604162159680"
+        "461914467291840300530057530849048765391711386591646239524912623653881879636239373280423891018672348"
+        "497668235089863388587925628302755995657524455507255189313690836254779186948667994968324049705821028"
+        "513185451396213837722826145437693412532098591327667236328125",
+        "-0.0", "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203126",
+        "7317770170789331.0", "123456789012345678901234567890.", "9999999999999999999.",
+        "0.000000000000000000000000000000000000000000000000000000000000000000000000000000000000000001"
+    };
+    int num_edge_cases = sizeof(edge_cases) / sizeof(char *), num_wrong = 0, i;
+    char literal[128];
+
+    srand(test->max_digits);
+
+    for (i = 0; i < num_edge_cases + test->num_literals; i++) {
+        const char *input = literal;
+        TokenList *tok_l;
+        double expected;
+
+        if (i < num_edge_cases) {
+            input = edge_cases[i];
+        } else {
+            int num_digits = 1 + rand() % test->max_digits, dot = rand() % (num_digits + 1), j, len = 0;
+
+            if (rand() % 2) {
+                literal[len++] = '-';
+            }
+
+            for (j = 0; j < num_digits; j++) {
+                if (j == dot) {
+                    literal[len++] = '.';
+                }
+                literal[len++] = '0' + rand() % 10;
+            }
+
+            if (dot == num_digits) {
+                literal[len++] = '.';
+            }
+
+            literal[len] = '\0';
+        }
+
+        /* strtod would read an exponent, but no literal here has one */
+        expected = strtod(input, NULL);
+        tok_l = tokenize(input, strlen(input));
+
+        if (tok_l->length != 1 || tok_l->toks[0].token != TOK_FLOAT
+                || memcmp(&(tok_l->toks[0].value.d), &expected, sizeof(double)) != 0) {
+            if (verbose && num_wrong < 10) {
+                printf("| %s: expected %.17g\n", input, expected);
+            }
+            num_wrong++;
+        }
+
+        free_token_list(tok_l);
+    }
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        printf("| literals checked:    %d\n", num_edge_cases + test->num_literals);
+        printf("| literals misrounded: %d\n", num_wrong);
+    }
+
+    return num_wrong == 0 ? SUCCESS : FAILURE;
+}
+
+/*
+ * Reference implementation: the regex cascade the lexer used before the table-driven scanner.
+ * It renders tokens straight into the token_list_to_str format so every test also checks that
+ * the scanner is token-for-token compatible with it. Warnings are left out to keep stderr quiet.
+ */
+static char *ref_tokenize(const char *input, int *err) {
+    regex_t id_re, float_re, int_re, comment_re, whitespace_re;
+    const char *singles = "()=.+-*/^,";
+    const char *single_names[] = {
+        "TOK_LPAREN", "TOK_RPAREN", "TOK_EQUAL", "TOK_DOT", "TOK_ADD",
+        "TOK_SUB", "TOK_MULT", "TOK_DIV", "TOK_EXP", "TOK_COMMA"
+    };
+    char *str = malloc(strlen(input) * 64 + 3);
+    const char *p = input;
+    regmatch_t m;
+
+    regcomp(&comment_re,    "^(#.*)$",                              REG_EXTENDED);
+    regcomp(&float_re,      "^-?([0-9]+\\.[0-9]*|[0-9]*\\.[0-9]+)", REG_EXTENDED);
+    regcomp(&id_re,         "^[a-zA-Z][a-zA-Z0-9_]*",               REG_EXTENDED);
+    regcomp(&int_re,        "^-?[0-9]+",                            REG_EXTENDED);
+    regcomp(&whitespace_re, "^([ \t])+",                            REG_EXTENDED);
+
+    *err = NOERR;
+    strcpy(str, "[");
+
+    while (*p != '\0') {
+        char tok_str[128], num_str[64];
+        const char *single = strchr(singles, *p);
+        int len;
+
+        if (regexec(&whitespace_re, p, 1, &m, 0) == 0) {
+            p += m.rm_eo;
+            continue;
+        }
+
+        if (regexec(&id_re, p, 1, &m, 0) == 0) {
+            len = m.rm_eo;
+
+            if (len > 50) {
+                *err = ENAMETOOLONG;
+                break;
+            }
+
+            /* the fn keyword used to match as a prefix of any name, now it has to be the whole name */
+            if (len == 2 && strncmp(p, "fn", 2) == 0) {
+                strcpy(tok_str, "TOK_FUN");
+            } else {
+                sprintf(tok_str, "TOK_ID %.*s", len, p);
+            }
+        } else if (regexec(&float_re, p, 1, &m, 0) == 0) {
+            len = m.rm_eo;
+            sprintf(num_str, "%.*s", len, p);
+            sprintf(tok_str, "TOK_FLOAT %f", atof(num_str));
+        } else if (regexec(&int_re, p, 1, &m, 0) == 0) {
+            len = m.rm_eo;
+            sprintf(num_str, "%.*s", len, p);
+            errno = 0;
+            sprintf(tok_str, "TOK_INT %ld", strtol(num_str, NULL, 10));
+
+            if (errno == ERANGE) {
+                *err = ERANGE;
+                break;
+            }
+        } else if (single != NULL) {
+            len = 1;
+            strcpy(tok_str, single_names[single - singles]);
+        } else if (regexec(&comment_re, p, 1, &m, 0) == 0) {
+            len = m.rm_eo;
+            strcpy(tok_str, "TOK_COMMENT");
+        } else {
+            *err = EINVAL;
+            break;
+        }
+
+        if (str[1] != '\0') {
+            strcat(str, ", ");
+        }
+
+        strcat(str, tok_str);
+        p += len;
+    }
+
+    strcat(str, "]");
+
+    regfree(&comment_re);
+    regfree(&float_re);
+    regfree(&id_re);
+    regfree(&int_re);
+    regfree(&whitespace_re);
+
+    return str;
+}
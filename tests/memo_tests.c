@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include "../src/memo.h"
+#include "../src/eval.h"
+#include "../src/env.h"
+#include "../src/parser.h"
+#include "../src/lexer.h"
+#include "../src/symbol.h"
+#include "test.h"
+
+/*
+ * Every test runs a script line by line with calls to one function remembered, checking how the
+ * memo did. Each line has to give what it does without the memo.
+ */
+typedef struct {
+    const char *name;
+    int capacity;
+    const char *script;
+    const char *value;  /* what the last line gives, "" for an error */
+    long int hits;
+    long int misses;
+    long int evictions;
+} Test;
+
+int verbose = 0;
+static int run_all_tests(const Test *tests, int num_tests);
+static int fork_test(int (*test_fn)(const void *), const void *test, int i);
+static void print_result(const char *name, int t_result);
+static int run_test(const void *t);
+static char *eval_line(const char *line, size_t length, Env_t *env);
+
+int main(int argc, char **argv) {
+    Test tests[] = {
+        {"same arguments again", 8, "fn f(x) = x * x + 1\nf(2)\nf(2)\nf(3)\nf(2)", "5", 2, 2, 0},
+        {"ints and floats kept apart", 8, "fn f(x) = x * x + 1\nf(2)\nf(2.0)\nf(2.0)", "5.000000", 1, 2, 0},
+        {"redefinition", 8, "fn f(x) = x * x\nf(2)\nfn f(x) = x + 1\nf(2)", "3", 0, 2, 0},
+        {"global redefined", 8, "k = 2\nfn f(x) = x * k\nf(3)\nk = 5\nf(3)", "15", 0, 2, 0},
+        {
+            "function called redefined", 8, "fn g(x) = x * 2\nfn f(x) = g(x) + 1\nf(2)\nfn g(x) = x * 3\nf(2)",
+            "7", 0, 2, 0
+        },
+        {
+            "function called by a function called redefined", 8,
+            "fn h(x) = x + 1\nfn g(x) = h(x) * 2\nfn f(x) = g(x)\nf(1)\nfn h(x) = x + 2\nf(1)", "6", 0, 2, 0
+        },
+        {
+            "unrelated assignments", 8, "fn f(x) = x * x\na = f(4)\nb = f(4)\nfn g(x) = x\nc = f(4)", "c: 16",
+            2, 1, 0
+        },
+        {"least recently used evicted", 2, "fn f(x) = x * x + 1\nf(1)\nf(2)\nf(1)\nf(3)\nf(2)\nf(3)", "10", 2, 4, 2},
+        {"errors not remembered", 8, "fn f(x) = 1 / x\nf(0)\nf(0)", "", 0, 2, 0},
+        {"overflow not remembered", 8, "fn f(x) = x * 2\nf(9223372036854775807)\nf(9223372036854775807)", "", 0, 2, 0},
+        {"calls from other functions", 8, "fn f(x) = x * x\nfn g(x) = f(x) + f(x)\ng(3)\ng(3)", "18", 3, 1, 0},
+        {"symbolic arguments", 8, "fn f(x) = x + 1\nf(y)\nf(y)", "", 0, 0, 0},
+        {"old definition under another name", 8, "fn f(x) = x + 1\ng = f\nfn f(x) = x + 2\ng(1)\ng(1)", "2", 0, 0, 0},
+    };
+    int num_tests = sizeof(tests) / sizeof(Test), num_passed, suite_result;
+
+    if (argc == 2 && (strcmp(argv[1], "-v") == 0
+                   || strcmp(argv[1], "--verbose") == 0)) {
+        verbose = 1;
+        printf(SEP);
+        printf("|\n|                        ");
+    } else {
+        printf("| ");
+    }
+
+    printf(C_SUITE_NAME("memo tests") "\n");
+    printf("|\n");
+
+    num_passed = run_all_tests(tests, num_tests);
+    suite_result = num_passed == num_tests ? SUCCESS : FAILURE;
+
+    printf("|\n| Ran (%d/%d) tests successfully\n", num_passed, num_tests);
+    printf("| Test suite %s\n", suite_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf("|\n");
+        printf(SEP);
+    }
+
+    return suite_result;
+}
+
+static int run_all_tests(const Test *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int fork_test(int (*test_fn)(const void *), const void *test, int i) {
+    int t_result;
+    pid_t fork_result;
+
+    if (i == 0 && verbose) {
+        printf(SEP);
+    }
+
+    fflush(stdout);
+    fork_result = fork();
+    if (fork_result < 0) {
+        fprintf(stderr, "Test %d: fork failed\n", i);
+        exit(EXIT_FAILURE);
+    } else if (fork_result != 0) {
+        int status;
+
+        wait(&status);
+
+        if (WIFEXITED(status)) {
+            t_result = WEXITSTATUS(status);
+        } else {
+            t_result = FAILURE;
+        }
+    } else {
+        t_result = test_fn(test);
+        exit(t_result);
+    }
+
+    return t_result;
+}
+
+static void print_result(const char *name, int t_result) {
+    if (verbose) {
+        printf("|\n");
+    }
+
+    printf("| " C_TEST_NAME("%s") " %s\n", name, t_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf(SEP);
+    }
+}
+
+static int run_test(const void *t) {
+    const Test *test = t;
+    Env_t *env = init_env(), *plain_env = init_env();
+    Memo *memo = add_memo(env, intern("f", 1), test->capacity);
+    const char *line = test->script;
+    char *value = calloc(1, 1);
+    int same_values = 1, correct_counts;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        fflush(stdout);
+    }
+
+    while (*line != '\0') {
+        size_t length = strcspn(line, "\n");
+        char *plain_value = eval_line(line, length, plain_env);
+
+        free(value);
+        value = eval_line(line, length, env);
+        same_values = same_values && strcmp(value, plain_value) == 0;
+
+        if (verbose) {
+            printf("| %.*s => %s (without the memo: %s)\n", (int) length, line, value, plain_value);
+        }
+
+        free(plain_value);
+        line += line[length] == '\n' ? length + 1 : length;
+    }
+
+    correct_counts = memo->hits == test->hits && memo->misses == test->misses && memo->evictions == test->evictions;
+
+    if (verbose) {
+        printf(SMALL_SEP);
+        printf("| last value: %s\n", value);
+        printf("| expected:   %s\n", test->value);
+        printf(SMALL_SEP);
+        printf("| hits, misses, evictions: %ld, %ld, %ld\n", memo->hits, memo->misses, memo->evictions);
+        printf("| expected:                %ld, %ld, %ld\n", test->hits, test->misses, test->evictions);
+    }
+
+    same_values = same_values && strcmp(value, test->value) == 0;
+
+    free(value);
+    free_memos(env->memos);
+    free_env(env);
+    free_env(plain_env);
+
+    return (same_values && correct_counts) ? SUCCESS : FAILURE;
+}
+
+/* what mint prints for line, or "" for nothing */
+static char *eval_line(const char *line, size_t length, Env_t *env) {
+    TokenList *tok_l;
+    ExprTree *tree, *value;
+    char *result;
+
+    errno = 0;
+    tok_l = tokenize(line, length);
+    tree = parse(tok_l);
+    value = eval(tree, env);
+    result = errno == 0 ? eval_result_to_str(value) : calloc(1, 1);
+
+    free_expr_tree(value);
+    free_expr_tree(tree);
+    free_token_list(tok_l);
+
+    return result;
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include "../src/optimize.h"
+#include "../src/eval.h"
+#include "../src/env.h"
+#include "../src/parser.h"
+#include "../src/lexer.h"
+#include "../src/symbol.h"
+#include "test.h"
+
+/*
+ * Every test defines a function at some optimization level, checks what its body became, and
+ * calls it. The call has to give the same result as it does with the function left alone.
+ */
+typedef struct {
+    const char *name;
+    int level;
+    const char *callee; /* a function def calls, or NULL */
+    const char *def;
+    const char *fun;   /* what defining it evaluates to */
+    const char *call;
+    const char *value; /* what call evaluates to, at the level and unoptimized */
+} Test;
+
+/*
+ * Every redefinition test runs a script, one line at a time, then checks what a function with
+ * others inlined into it is bound to, and calls it. Again the call has to give the same result as
+ * it does with nothing optimized.
+ */
+typedef struct {
+    const char *name;
+    int level;
+    const char *script;
+    const char *fun;   /* a function the script defines */
+    const char *def;   /* what it's bound to at the end */
+    const char *call;
+    const char *value;
+} RedefinitionTest;
+
+int verbose = 0;
+static int run_all_tests(const Test *tests, int num_tests);
+static int run_all_redefinition_tests(const RedefinitionTest *tests, int num_tests);
+static int fork_test(int (*test_fn)(const void *), const void *test, int i);
+static void print_result(const char *name, int t_result);
+static int run_test(const void *t);
+static int run_redefinition_test(const void *t);
+static void run_script(const char *script, Env_t *env);
+static char *eval_line(const char *line, size_t length, Env_t *env);
+
+int main(int argc, char **argv) {
+    Test tests[] = {
+        {"level 0 leaves bodies alone", 0, NULL, "fn f(x) = x * 1 + 0", "f(x) = x * 1 + 0", "f(3)", "3"},
+        {"times 1", 1, NULL, "fn f(x) = x * 1", "f(x) = x", "f(2.5)", "2.500000"},
+        {"1 times and minus 0", 1, NULL, "fn f(x) = 1 * x - 0", "f(x) = x", "f(7)", "7"},
+        {"divided by 1", 1, NULL, "fn f(x, y) = (x + y) / 1", "f(x, y) = x + y", "f(1, 2.5)", "3.500000"},
+        {"float 1 kept", 1, NULL, "fn f(x) = x * 1.0", "f(x) = x * 1.000000", "f(3)", "3.000000"},
+        {"plus 0 kept at level 1", 1, NULL, "fn f(x) = x + 0", "f(x) = x + 0", "f(4)", "4"},
+        {"plus 0", 2, NULL, "fn f(x) = 0 + x + 0", "f(x) = x", "f(4)", "4"},
+        {"exponent 1", 2, NULL, "fn f(x) = x^1 * 2", "f(x) = x * 2", "f(5)", "10"},
+        {"square to multiplication", 2, NULL, "fn f(x) = x^2 + 1", "f(x) = x * x + 1", "f(3)", "10"},
+        {"square of a call kept", 2, "fn g(a) = a * a", "fn f(x) = g(x + 1)^2", "f(x) = g(x + 1)^2", "f(2)", "81"},
+        {"division by a power of two", 1, NULL, "fn f(x) = x / 4.0", "f(x) = x * 0.250000", "f(3)", "0.750000"},
+        {"division by 3.0 kept", 1, NULL, "fn f(x) = x / 3.0", "f(x) = x / 3.000000", "f(3)", "1.000000"},
+        {"int division kept", 1, NULL, "fn f(x) = x / 4", "f(x) = x / 4", "f(6)", "1.500000"},
+        {"sum of constants", 2, NULL, "fn f(x) = x + 1 + 2 + 3", "f(x) = x + 6", "f(4)", "10"},
+        {"product of constants", 2, NULL, "fn f(x) = 2 * (x * 3)", "f(x) = x * 6", "f(0.5)", "3.000000"},
+        {"differences cancelling out", 2, NULL, "fn f(x) = x - 1 - 2 + 3", "f(x) = x", "f(9)", "9"},
+        {"constants kept apart at level 1", 1, NULL, "fn f(x) = x + 1 + 2", "f(x) = x + 1 + 2", "f(1)", "4"},
+        {
+            "overflowing constants kept apart", 2, NULL, "fn f(x) = x + 9223372036854775807 + 1",
+            "f(x) = x + 9223372036854775807 + 1", "f(-5)", "9223372036854775803"
+        },
+        {
+            "rewrites inside arguments", 1, "fn g(a, b) = a - b * b",
+            "fn f(x) = g(x * 1, 1 * x - 0)", "f(x) = g(x, x)", "f(2)", "-2"
+        },
+        {"calls kept at level 0", 0, "fn g(a) = a + 1", "fn f(x) = g(x / 2)", "f(x) = g(x / 2)", "f(5)", "3.500000"},
+        {"inlining", 1, "fn g(a) = a + 1", "fn f(x) = g(x / 2)", "f(x) = x / 2 + 1", "f(5)", "3.500000"},
+        {"parameter used twice", 1, "fn g(a) = a * a", "fn f(x) = g(x)", "f(x) = x * x", "f(-3)", "9"},
+        {"expression used twice kept", 1, "fn g(a) = a * a", "fn f(x) = g(x + 1)", "f(x) = g(x + 1)", "f(2)", "9"},
+        {"unused argument kept", 1, "fn g(a, b) = a", "fn f(x) = g(x, x * 2)", "f(x) = g(x, x * 2)", "f(2)", "2"},
+        {"unused number dropped", 1, "fn g(a, b) = a", "fn f(x) = g(x, 2)", "f(x) = x", "f(2)", "2"},
+        {
+            "arguments out of order kept", 1, "fn g(a, b) = b - a",
+            "fn f(x) = g(x + 1, x * 2)", "f(x) = g(x + 1, x * 2)", "f(4)", "3"
+        },
+        {"inlined constants folded", 1, "fn g(a) = a * 2 + 1", "fn f(x) = g(3) + x", "f(x) = 7 + x", "f(1)", "8"},
+        {"calls in arguments", 1, "fn g(a) = a + 1", "fn f(x) = g(g(x))", "f(x) = x + 1 + 1", "f(1)", "3"},
+    };
+    RedefinitionTest redefinition_tests[] = {
+        {
+            "callee redefined", 1, "fn f(x) = x + 1\nfn g(y) = f(y / 2)\nfn f(x) = x * 10",
+            "g", "g(y) = y / 2 * 10", "g(3)", "15.000000"
+        },
+        {
+            "callee assigned a number", 1, "fn f(x) = x + 1\nfn g(y) = f(y)\nf = 3",
+            "g", "g(y) = f(y)", "g(3)", ""
+        },
+        {
+            "callee grown too big", 1,
+            "fn f(x) = x + 1\nfn g(y) = f(y)\nfn f(x) = x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x+x",
+            "g", "g(y) = f(y)", "g(1)", "17"
+        },
+        {
+            "chain collapsed", 2, "fn a(x) = x * 2\nfn b(x) = a(x) + 1\nfn c(x) = b(x) * 3\nfn d(x) = c(x) - 4",
+            "d", "d(x) = x * 2 + 1 * 3 - 4", "d(5)", "29"
+        },
+        {
+            "chain redefined from the bottom", 2,
+            "fn a(x) = x * 2\nfn b(x) = a(x) + 1\nfn c(x) = b(x) * 3\nfn a(x) = x - 1",
+            "c", "c(x) = x * 3", "c(5)", "15"
+        },
+        {
+            "caller redefined", 1, "fn f(x) = x + 1\nfn g(y) = f(y)\nfn g(y) = y * 2\nfn f(x) = x - 1",
+            "g", "g(y) = y * 2", "g(5)", "10"
+        },
+        {
+            "caller assigned a number", 1, "fn f(x) = x + 1\nfn g(y) = f(y)\ng = 7\nfn f(x) = x - 1",
+            "g", "7", "g", "7"
+        },
+        {
+            "inlined into each other", 1, "fn f(x) = x + 1\nfn g(x) = f(x) * 2\nfn f(x) = g(x) - 1\ng = 1",
+            "f", "f(x) = g(x) - 1", "f(1)", ""
+        },
+    };
+    int num_tests = sizeof(tests) / sizeof(Test), num_passed, suite_result;
+    int num_redefinition_tests = sizeof(redefinition_tests) / sizeof(RedefinitionTest);
+
+    if (argc == 2 && (strcmp(argv[1], "-v") == 0
+                   || strcmp(argv[1], "--verbose") == 0)) {
+        verbose = 1;
+        printf(SEP);
+        printf("|\n|                        ");
+    } else {
+        printf("| ");
+    }
+
+    printf(C_SUITE_NAME("optimize tests") "\n");
+    printf("|\n");
+
+    num_passed = run_all_tests(tests, num_tests);
+    num_passed += run_all_redefinition_tests(redefinition_tests, num_redefinition_tests);
+    num_tests += num_redefinition_tests;
+    suite_result = num_passed == num_tests ? SUCCESS : FAILURE;
+
+    printf("|\n| Ran (%d/%d) tests successfully\n", num_passed, num_tests);
+    printf("| Test suite %s\n", suite_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf("|\n");
+        printf(SEP);
+    }
+
+    return suite_result;
+}
+
+static int run_all_tests(const Test *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int run_all_redefinition_tests(const RedefinitionTest *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_redefinition_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int fork_test(int (*test_fn)(const void *), const void *test, int i) {
+    int t_result;
+    pid_t fork_result;
+
+    if (i == 0 && verbose) {
+        printf(SEP);
+    }
+
+    fflush(stdout);
+    fork_result = fork();
+    if (fork_result < 0) {
+        fprintf(stderr, "Test %d: fork failed\n", i);
+        exit(EXIT_FAILURE);
+    } else if (fork_result != 0) {
+        int status;
+
+        wait(&status);
+
+        if (WIFEXITED(status)) {
+            t_result = WEXITSTATUS(status);
+        } else {
+            t_result = FAILURE;
+        }
+    } else {
+        t_result = test_fn(test);
+        exit(t_result);
+    }
+
+    return t_result;
+}
+
+static void print_result(const char *name, int t_result) {
+    if (verbose) {
+        printf("|\n");
+    }
+
+    printf("| " C_TEST_NAME("%s") " %s\n", name, t_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf(SEP);
+    }
+}
+
+static int run_test(const void *t) {
+    const Test *test = t;
+    Env_t *env = init_env(), *plain_env = init_env();
+    char *fun, *value, *plain_value;
+    int correct_fun, correct_value;
+
+    env->opt_level = test->level;
+    env->opt_verbose = verbose;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        fflush(stdout);
+    }
+
+    if (test->callee != NULL) {
+        free(eval_line(test->callee, strlen(test->callee), env));
+        free(eval_line(test->callee, strlen(test->callee), plain_env));
+    }
+
+    fun = eval_line(test->def, strlen(test->def), env);
+    value = eval_line(test->call, strlen(test->call), env);
+    free(eval_line(test->def, strlen(test->def), plain_env));
+    plain_value = eval_line(test->call, strlen(test->call), plain_env);
+
+    correct_fun = strcmp(fun, test->fun) == 0;
+    correct_value = strcmp(value, test->value) == 0 && strcmp(plain_value, test->value) == 0;
+
+    if (verbose) {
+        printf("| level: %d\n", test->level);
+        printf("| defined:          %s\n", fun);
+        printf("| expected:         %s\n", test->fun);
+        printf(SMALL_SEP);
+        printf("| %s gave:        %s\n", test->call, value);
+        printf("| unoptimized gave: %s\n", plain_value);
+        printf("| expected:         %s\n", test->value);
+    }
+
+    free(fun);
+    free(value);
+    free(plain_value);
+    free_env(env);
+    free_env(plain_env);
+
+    return (correct_fun && correct_value) ? SUCCESS : FAILURE;
+}
+
+static int run_redefinition_test(const void *t) {
+    const RedefinitionTest *test = t;
+    Env_t *env = init_env(), *plain_env = init_env();
+    char *def, *value, *plain_value;
+    int correct_def, correct_value;
+
+    env->opt_level = test->level;
+    env->opt_verbose = verbose;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        fflush(stdout);
+    }
+
+    run_script(test->script, env);
+    run_script(test->script, plain_env);
+
+    def = eval_line(test->fun, strlen(test->fun), env);
+    value = eval_line(test->call, strlen(test->call), env);
+    plain_value = eval_line(test->call, strlen(test->call), plain_env);
+
+    correct_def = strcmp(def, test->def) == 0;
+    correct_value = strcmp(value, test->value) == 0 && strcmp(plain_value, test->value) == 0;
+
+    if (verbose) {
+        printf("| level: %d\n", test->level);
+        printf("| %s is:           %s\n", test->fun, def);
+        printf("| expected:         %s\n", test->def);
+        printf(SMALL_SEP);
+        printf("| %s gave:        %s\n", test->call, value);
+        printf("| unoptimized gave: %s\n", plain_value);
+        printf("| expected:         %s\n", test->value);
+    }
+
+    free(def);
+    free(value);
+    free(plain_value);
+    free_env(env);
+    free_env(plain_env);
+
+    return (correct_def && correct_value) ? SUCCESS : FAILURE;
+}
+
+/* evaluates each line of script in turn */
+static void run_script(const char *script, Env_t *env) {
+    while (*script != '\0') {
+        size_t length = strcspn(script, "\n");
+
+        free(eval_line(script, length, env));
+        script += script[length] == '\n' ? length + 1 : length;
+    }
+}
+
+/* what mint prints for the line of the given length, or "" for nothing */
+static char *eval_line(const char *line, size_t length, Env_t *env) {
+    TokenList *tok_l;
+    ExprTree *tree, *value;
+    char *result;
+
+    errno = 0;
+    tok_l = tokenize(line, length);
+    tree = parse(tok_l);
+    value = eval(tree, env);
+    result = errno == 0 ? eval_result_to_str(value) : calloc(1, 1);
+
+    free_expr_tree(value);
+    free_expr_tree(tree);
+    free_token_list(tok_l);
+
+    return result;
+}
@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include "../src/parser.h"
 #include "../src/lexer.h"
@@ -20,9 +21,36 @@ typedef struct {
     Ans ans;
 } Test;
 
+/* nesting tests parse open repeated depth times, then inner, then close repeated depth times */
+typedef struct {
+    const char *name;
+    const char *open;
+    const char *inner;
+    const char *close;
+    int depth;
+    int num_nodes;
+    int err;
+} NestingTest;
+
+/* sharing tests parse input, share its repeated subtrees, and check how many nodes are left */
+typedef struct {
+    const char *name;
+    const char *raw_input;
+    int num_nodes;
+} SharingTest;
+
+#define DEFAULT_STACK_SIZE (8 * 1024 * 1024)
+
 int verbose = 0;
 static int run_all_tests(const Test *tests, int num_tests);
-static int run_test(const Test *test);
+static int run_all_nesting_tests(const NestingTest *tests, int num_tests);
+static int run_all_sharing_tests(const SharingTest *tests, int num_tests);
+static int fork_test(int (*test_fn)(const void *), const void *test, int i);
+static void print_result(const char *name, int t_result);
+static int run_test(const void *t);
+static int run_nesting_test(const void *t);
+static int run_sharing_test(const void *t);
+static int is_well_formed(const ExprTree *tree);
 
 int main(int argc, char **argv) {
     Test tests[] = {
@@ -77,9 +105,29 @@ int main(int argc, char **argv) {
         {"missing operator", "2 3", {"(Int 2)", EINVAL}},
         {"improper assign", "4 = 5", {"(Int 4)", EINVAL}},
         {"improper function defn", "fn 3(x) = 34", {"()", EINVAL}},
-        {"improper function param", "fn f(3) = 3 + 4", {"()", EINVAL}}
+        {"improper function param", "fn f(3) = 3 + 4", {"()", EINVAL}},
+        {"chained exponent", "2^3^2", {"(Exp(Int 2)(Int 3))", EINVAL}},
+        {"unclosed application", "f(1, 2 +", {"(App(ID f)(Arg(Int 1)()))", EINVAL}}
+    };
+    NestingTest nesting_tests[] = {
+        {"1 million nested parens", "(", "1 + 2", ")", 1000000, 3, NOERR},
+        {"1 million nested applications", "f(", "x", ")", 1000000, 3000001, NOERR},
+        {"1 million right nested sums", "1 + (", "2", ")", 1000000, 2000001, NOERR},
+        {"1 million term flat chain", "x * 2 - ", "1", "", 1000000, 4000001, NOERR},
+        {"1 million unclosed parens", "(", "1", "", 1000000, 1, EINVAL},
+    };
+    SharingTest sharing_tests[] = {
+        {"shared repeat", "(a * b + c) / (a * b + c)", 7},
+        {"shared repeat of repeats", "(a * b + c) / (a * b + c) - (a * b + c) / (a * b + c)", 9},
+        {"operands in another order not shared", "a * b + b * a", 7},
+        {"int and float not shared", "(1 + 2) * (1 + 2.0)", 7},
+        {"shared applications", "f(x + 1, x + 1) + f(x + 1, x + 1)", 10},
+        {"shared in function defn", "fn g(x) = (x * 2)^(x * 2)", 8},
+        {"nothing to share", "x = 1 + 2 * 3", 7},
     };
     int num_tests = sizeof(tests) / sizeof(Test), num_passed;
+    int num_nesting_tests = sizeof(nesting_tests) / sizeof(NestingTest);
+    int num_sharing_tests = sizeof(sharing_tests) / sizeof(SharingTest);
 
 
     if (argc == 2 && (strcmp(argv[1], "-v") == 0
@@ -95,6 +143,9 @@ int main(int argc, char **argv) {
     printf("|\n");
 
     num_passed = run_all_tests(tests, num_tests);
+    num_passed += run_all_nesting_tests(nesting_tests, num_nesting_tests);
+    num_passed += run_all_sharing_tests(sharing_tests, num_sharing_tests);
+    num_tests += num_nesting_tests + num_sharing_tests;
 
     printf("|\n| Ran (%d/%d) tests successfully\n", num_passed, num_tests);
     printf("| Test suite %s\n", num_passed == num_tests ? PASSED : FAILED);
@@ -108,62 +159,95 @@ int main(int argc, char **argv) {
 }
 
 static int run_all_tests(const Test *tests, int num_tests) {
-    int num_passed = 0, i;
+    int i, num_passed = 0;
 
     for (i = 0; i < num_tests; i++) {
-        int t_result;
-        pid_t fork_result;
+        int t_result = fork_test(run_test, &(tests[i]), i);
 
-        if (i == 0 && verbose) {
-            printf(SEP);
-        }
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
 
-        fflush(stdout);
-        fork_result = fork();
-        if (fork_result < 0) {
-            fprintf(stderr, "Test %d: fork failed\n", i);
-            exit(EXIT_FAILURE);
-        } else if (fork_result != 0) {
-            int status;
+    return num_passed;
+}
 
-            wait(&status);
+static int run_all_nesting_tests(const NestingTest *tests, int num_tests) {
+    int i, num_passed = 0;
 
-            if (WIFEXITED(status)) {
-                t_result = WEXITSTATUS(status);
-            } else {
-                t_result = FAILURE;
-            }
-        } else {
-            t_result = run_test(&(tests[i]));
-            exit(t_result);
-        }
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_nesting_test, &(tests[i]), i);
 
         num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
 
-        if (verbose) {
-            printf("|\n");
-        }
+    return num_passed;
+}
 
-        printf("| " C_TEST_NAME("%s") " %s\n", tests[i].name,
-               t_result == SUCCESS ? PASSED : FAILED);
+static int run_all_sharing_tests(const SharingTest *tests, int num_tests) {
+    int i, num_passed = 0;
 
-        if (verbose) {
-            printf(SEP);
-        }
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_sharing_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
     }
 
     return num_passed;
 }
 
-static int run_test(const Test *test) {
+static int fork_test(int (*test_fn)(const void *), const void *test, int i) {
+    int t_result;
+    pid_t fork_result;
+
+    if (i == 0 && verbose) {
+        printf(SEP);
+    }
+
+    fflush(stdout);
+    fork_result = fork();
+    if (fork_result < 0) {
+        fprintf(stderr, "Test %d: fork failed\n", i);
+        exit(EXIT_FAILURE);
+    } else if (fork_result != 0) {
+        int status;
+
+        wait(&status);
+
+        if (WIFEXITED(status)) {
+            t_result = WEXITSTATUS(status);
+        } else {
+            t_result = FAILURE;
+        }
+    } else {
+        t_result = test_fn(test);
+        exit(t_result);
+    }
+
+    return t_result;
+}
+
+static void print_result(const char *name, int t_result) {
+    if (verbose) {
+        printf("|\n");
+    }
+
+    printf("| " C_TEST_NAME("%s") " %s\n", name, t_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf(SEP);
+    }
+}
+
+static int run_test(const void *t) {
+    const Test *test = t;
     TokenList *input;
     ExprTree *tree;
     char *tree_str, *input_str;
     int errno_before, correct_tree, correct_err, t_result;
 
-    compile_regexs();
-    input = tokenize(test->raw_input);
-    free_regexs();
+    input = tokenize(test->raw_input, strlen(test->raw_input));
 
     if (verbose) {
         printf("| " C_TEST_NAME("%s") " test:\n", test->name);
@@ -199,3 +283,136 @@ static int run_test(const Test *test) {
 
     return t_result;
 }
+
+/*
+ * Parses one deeply nested line under the default 8 MB stack limit, so any per-level recursion in
+ * parse crashes the child process and fails the test. The tree is too deep to print, so it's
+ * checked node by node instead.
+ */
+static int run_nesting_test(const void *t) {
+    const NestingTest *test = t;
+    struct rlimit stack_limit;
+    TokenList *input;
+    ExprTree *tree;
+    char *raw_input, *p;
+    int open_len = strlen(test->open), close_len = strlen(test->close), i;
+    int correct_nodes, correct_err, well_formed;
+
+    getrlimit(RLIMIT_STACK, &stack_limit);
+    stack_limit.rlim_cur = DEFAULT_STACK_SIZE;
+    setrlimit(RLIMIT_STACK, &stack_limit);
+
+    raw_input = malloc((size_t) (open_len + close_len) * test->depth + strlen(test->inner) + 1);
+    p = raw_input;
+
+    for (i = 0; i < test->depth; i++) {
+        memcpy(p, test->open, open_len);
+        p += open_len;
+    }
+
+    strcpy(p, test->inner);
+    p += strlen(test->inner);
+
+    for (i = 0; i < test->depth; i++) {
+        memcpy(p, test->close, close_len);
+        p += close_len;
+    }
+
+    *p = '\0';
+
+    input = tokenize(raw_input, p - raw_input);
+    tree = parse(input);
+
+    correct_nodes = tree->length == test->num_nodes;
+    correct_err = errno == test->err;
+    well_formed = is_well_formed(tree);
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        printf("| input: \"%s\" %d times, \"%s\", \"%s\" %d times\n",
+               test->open, test->depth, test->inner, test->close, test->depth);
+        printf(SMALL_SEP);
+        printf("| errno (after parse): %d\n", errno);
+        printf("| expected errno:      %d\n", test->err);
+        printf(SMALL_SEP);
+        printf("| nodes parsed:   %d\n", tree->length);
+        printf("| expected nodes: %d\n", test->num_nodes);
+        printf("| well formed:    %s\n", well_formed ? "yes" : "no");
+    }
+
+    free_expr_tree(tree);
+    free_token_list(input);
+    free(raw_input);
+
+    return (correct_nodes && correct_err && well_formed) ? SUCCESS : FAILURE;
+}
+
+/*
+ * Sharing has to leave the tree's string as it was, drop the nodes it says it did, and leave
+ * nothing to share for a second time round.
+ */
+static int run_sharing_test(const void *t) {
+    const SharingTest *test = t;
+    TokenList *input = tokenize(test->raw_input, strlen(test->raw_input));
+    ExprTree *tree = parse(input);
+    char *tree_str = expr_tree_to_str(tree), *shared_str;
+    int length = tree->length, dropped, dropped_again, correct_nodes, correct_str, well_formed;
+
+    dropped = share_subtrees(tree);
+    dropped_again = share_subtrees(tree);
+    shared_str = expr_tree_to_str(tree);
+
+    correct_nodes = tree->length == test->num_nodes && dropped == length - test->num_nodes && dropped_again == 0;
+    correct_str = strcmp(shared_str, tree_str) == 0;
+    well_formed = is_well_formed(tree);
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        printf("| raw string input: %s\n", test->raw_input);
+        printf(SMALL_SEP);
+        printf("| parse tree:  %s\n", tree_str);
+        printf("| shared tree: %s\n", shared_str);
+        printf(SMALL_SEP);
+        printf("| nodes parsed:   %d\n", length);
+        printf("| nodes dropped:  %d, then %d\n", dropped, dropped_again);
+        printf("| nodes left:     %d\n", tree->length);
+        printf("| expected nodes: %d\n", test->num_nodes);
+        printf("| well formed:    %s\n", well_formed ? "yes" : "no");
+    }
+
+    free(tree_str);
+    free(shared_str);
+    free_expr_tree(tree);
+    free_token_list(input);
+
+    return (correct_nodes && correct_str && well_formed) ? SUCCESS : FAILURE;
+}
+
+/* every subtree must be the run of nodes ending at its root, with the root of the tree last */
+static int is_well_formed(const ExprTree *tree) {
+    int i;
+
+    for (i = 0; i < tree->length; i++) {
+        int left = left_child(tree, i), right = right_child(tree, i), size = 1;
+
+        if (left != NO_NODE) {
+            size += tree->nodes[left].size;
+        }
+
+        if (right != NO_NODE) {
+            size += tree->nodes[right].size;
+
+            if (right != i - 1 || (left != NO_NODE && left != right - tree->nodes[right].size)) {
+                return 0;
+            }
+        } else if (left != NO_NODE && left != i - 1) {
+            return 0;
+        }
+
+        if (tree->nodes[i].size != size || size > i + 1) {
+            return 0;
+        }
+    }
+
+    return tree->length == 0 || tree->nodes[tree->length - 1].size == tree->length;
+}
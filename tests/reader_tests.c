@@ -0,0 +1,274 @@
+#define _POSIX_C_SOURCE 200809L /* fileno */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include "../src/reader.h"
+#include "test.h"
+
+typedef enum {
+    FROM_PIPE,
+    FROM_FILE
+} Source_t;
+
+typedef struct {
+    const char *name;
+    const char *input;
+    Source_t source;
+    const char *lines; /* every line read, each wrapped in [] */
+} Test;
+
+/* long line tests read num_lines lines of line_length x's each */
+typedef struct {
+    const char *name;
+    int line_length;
+    int num_lines;
+    Source_t source;
+} LongLineTest;
+
+int verbose = 0;
+static int run_all_tests(const Test *tests, int num_tests);
+static int run_all_long_line_tests(const LongLineTest *tests, int num_tests);
+static int fork_test(int (*test_fn)(const void *), const void *test, int i);
+static void print_result(const char *name, int t_result);
+static int run_test(const void *t);
+static int run_long_line_test(const void *t);
+static int open_input(const char *input, size_t length, Source_t source);
+
+int main(int argc, char **argv) {
+    Test tests[] = {
+        {"empty input", "", FROM_PIPE, ""},
+        {"empty file", "", FROM_FILE, ""},
+        {"one line", "1 + 2\n", FROM_PIPE, "[1 + 2]"},
+        {"no trailing newline", "x = 4\nx * 2", FROM_PIPE, "[x = 4][x * 2]"},
+        {"no trailing newline (file)", "x = 4\nx * 2", FROM_FILE, "[x = 4][x * 2]"},
+        {"blank lines", "\n\nfn f(x) = x\n\n", FROM_PIPE, "[][][fn f(x) = x][]"},
+        {"one char last line", "a\nb", FROM_FILE, "[a][b]"},
+        {"whitespace only", "  \t\n", FROM_PIPE, "[  \t]"},
+    };
+    LongLineTest long_line_tests[] = {
+        {"line longer than 1024 bytes", 5000, 3, FROM_PIPE},
+        {"3 MB lines from a pipe", 3000000, 3, FROM_PIPE},
+        {"3 MB lines from a file", 3000000, 3, FROM_FILE},
+        {"short lines across block boundaries", 7, 500000, FROM_PIPE},
+        {"short lines across block boundaries (file)", 7, 500000, FROM_FILE},
+        {"file bigger than the unmap chunk", 1000000, 40, FROM_FILE},
+    };
+    int num_tests = sizeof(tests) / sizeof(Test), num_passed;
+    int num_long_line_tests = sizeof(long_line_tests) / sizeof(LongLineTest), suite_result;
+
+    if (argc == 2 && (strcmp(argv[1], "-v") == 0
+                   || strcmp(argv[1], "--verbose") == 0)) {
+        verbose = 1;
+        printf(SEP);
+        printf("|\n|                        ");
+    } else {
+        printf("| ");
+    }
+
+    printf(C_SUITE_NAME("reader tests") "\n");
+    printf("|\n");
+
+    num_passed = run_all_tests(tests, num_tests);
+    num_passed += run_all_long_line_tests(long_line_tests, num_long_line_tests);
+    num_tests += num_long_line_tests;
+    suite_result = num_passed == num_tests ? SUCCESS : FAILURE;
+
+    printf("|\n| Ran (%d/%d) tests successfully\n", num_passed, num_tests);
+    printf("| Test suite %s\n", suite_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf("|\n");
+        printf(SEP);
+    }
+
+    return suite_result;
+}
+
+static int run_all_tests(const Test *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int run_all_long_line_tests(const LongLineTest *tests, int num_tests) {
+    int i, num_passed = 0;
+
+    for (i = 0; i < num_tests; i++) {
+        int t_result = fork_test(run_long_line_test, &(tests[i]), i);
+
+        num_passed += t_result == SUCCESS ? 1 : 0;
+        print_result(tests[i].name, t_result);
+    }
+
+    return num_passed;
+}
+
+static int fork_test(int (*test_fn)(const void *), const void *test, int i) {
+    int t_result;
+    pid_t fork_result;
+
+    if (i == 0 && verbose) {
+        printf(SEP);
+    }
+
+    fflush(stdout);
+    fork_result = fork();
+    if (fork_result < 0) {
+        fprintf(stderr, "Test %d: fork failed\n", i);
+        exit(EXIT_FAILURE);
+    } else if (fork_result != 0) {
+        int status;
+
+        wait(&status);
+
+        if (WIFEXITED(status)) {
+            t_result = WEXITSTATUS(status);
+        } else {
+            t_result = FAILURE;
+        }
+    } else {
+        t_result = test_fn(test);
+        exit(t_result);
+    }
+
+    return t_result;
+}
+
+static void print_result(const char *name, int t_result) {
+    if (verbose) {
+        printf("|\n");
+    }
+
+    printf("| " C_TEST_NAME("%s") " %s\n", name, t_result == SUCCESS ? PASSED : FAILED);
+
+    if (verbose) {
+        printf(SEP);
+    }
+}
+
+static int run_test(const void *t) {
+    const Test *test = t;
+    int fd = open_input(test->input, strlen(test->input), test->source), correct_lines, correct_err;
+    LineReader *reader = open_reader(fd);
+    char *lines = calloc(1, strlen(test->input) * 3 + 1);
+    const char *line;
+    size_t line_length;
+
+    errno = 0;
+    while ((line = next_line(reader, &line_length))) {
+        strcat(lines, "[");
+        strncat(lines, line, line_length);
+        strcat(lines, "]");
+    }
+
+    correct_lines = strcmp(lines, test->lines) == 0;
+    correct_err = errno == NOERR;
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        printf("| errno (after reading): %d\n", errno);
+        printf(SMALL_SEP);
+        printf("| lines read:     %s\n", lines);
+        printf("| expected lines: %s\n", test->lines);
+    }
+
+    free(lines);
+    close_reader(reader);
+    close(fd);
+
+    return (correct_lines && correct_err) ? SUCCESS : FAILURE;
+}
+
+static int run_long_line_test(const void *t) {
+    const LongLineTest *test = t;
+    size_t length = (size_t) (test->line_length + 1) * test->num_lines, line_length;
+    char *input = malloc(length);
+    const char *line;
+    int fd, i, num_lines = 0, num_wrong = 0;
+    LineReader *reader;
+
+    memset(input, 'x', length);
+    for (i = 0; i < test->num_lines; i++) {
+        input[(size_t) (test->line_length + 1) * i + test->line_length] = '\n';
+    }
+
+    fd = open_input(input, length, test->source);
+    reader = open_reader(fd);
+
+    errno = 0;
+    while ((line = next_line(reader, &line_length))) {
+        if (line_length != test->line_length || memchr(line, '\n', line_length) != NULL) {
+            num_wrong++;
+        }
+
+        num_lines++;
+    }
+
+    if (verbose) {
+        printf("| " C_TEST_NAME("%s") " test:\n", test->name);
+        printf("| errno (after reading): %d\n", errno);
+        printf(SMALL_SEP);
+        printf("| lines read:     %d\n", num_lines);
+        printf("| expected lines: %d\n", test->num_lines);
+        printf("| malformed lines: %d\n", num_wrong);
+    }
+
+    free(input);
+    close_reader(reader);
+    close(fd);
+
+    return (num_lines == test->num_lines && num_wrong == 0 && errno == NOERR) ? SUCCESS : FAILURE;
+}
+
+/*
+ * Pipe input is written by a separate process so the reader sees data arrive in pieces, the way
+ * it would from another program. File input goes through a temporary file.
+ */
+static int open_input(const char *input, size_t length, Source_t source) {
+    int fds[2];
+
+    if (source == FROM_FILE) {
+        FILE *file = tmpfile();
+        int fd = dup(fileno(file));
+
+        fwrite(input, 1, length, file);
+        fclose(file);
+        lseek(fd, 0, SEEK_SET);
+
+        return fd;
+    }
+
+    pipe(fds);
+
+    if (fork() == 0) {
+        size_t written = 0;
+
+        close(fds[0]);
+        while (written < length) {
+            ssize_t n = write(fds[1], input + written, length - written);
+
+            if (n < 0) {
+                _exit(EXIT_FAILURE);
+            }
+
+            written += n;
+        }
+
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    return fds[0];
+}
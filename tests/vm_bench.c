@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 199309L /* clock_gettime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "../src/vm.h"
+#include "../src/jit.h"
+#include "../src/eval.h"
+#include "../src/env.h"
+#include "../src/parser.h"
+#include "../src/lexer.h"
+#include "../src/symbol.h"
+#include "test.h"
+
+#define NUM_GLOBALS 20
+#define NUM_CALLS 10000000
+
+/*
+ * Benchmarks calling a compiled function that reads 20 globals, the way a formula over a table of
+ * constants would be used. Each read goes through the global's inline cache, which holds as long
+ * as nothing gets bound. It's timed that way, and with every read resolved again (as they were
+ * before the caches) by bumping the env's version before each call, in the VM and then the JIT.
+ */
+static double now();
+static void eval_line(const char *line, Env_t *env);
+static double bench_calls(Env_t *env, Value fun, int resolve);
+
+int main() {
+    Env_t *env = init_env();
+    char line[512];
+    char *p = line;
+    Binding *binding;
+    Value fun;
+    double cached_time, resolved_time;
+    int i;
+
+    for (i = 0; i < NUM_GLOBALS; i++) {
+        sprintf(line, "g%d = %d", i, i + 1);
+        eval_line(line, env);
+    }
+
+    p += sprintf(p, "fn f(x) = x");
+
+    for (i = 0; i < NUM_GLOBALS; i++) {
+        p += sprintf(p, " + g%d", i);
+    }
+
+    eval_line(line, env);
+    binding = env_find(env, intern("f", 1));
+    fun = node_value(binding->data, expr_tree_root(binding->data));
+
+    printf("| " C_SUITE_NAME("VM benchmarks") "\n");
+    printf("|\n");
+    printf("| " C_TEST_NAME("%s") "\n", "10 million calls of a function reading 20 globals");
+
+    cached_time = bench_calls(env, fun, 0);
+    resolved_time = bench_calls(env, fun, 1);
+
+    printf("| VM, cached globals:   %8.2f ms (%.1f ns/call)\n", cached_time * 1e3, cached_time * 1e9 / NUM_CALLS);
+    printf("| VM, resolved globals: %8.2f ms (%.1f ns/call)\n", resolved_time * 1e3, resolved_time * 1e9 / NUM_CALLS);
+    printf("| VM speedup:           %8.2fx\n", resolved_time / cached_time);
+
+    env->jit = new_jit(0);
+
+    /* warms up, so the function's compiled to machine code before it's timed */
+    bench_calls(env, fun, 0);
+
+    if (binding->data->code->native != NULL) {
+        cached_time = bench_calls(env, fun, 0);
+        resolved_time = bench_calls(env, fun, 1);
+
+        printf("| JIT, cached globals:   %7.2f ms (%.1f ns/call)\n", cached_time * 1e3, cached_time * 1e9 / NUM_CALLS);
+        printf("| JIT, resolved globals: %7.2f ms (%.1f ns/call)\n", resolved_time * 1e3, resolved_time * 1e9 / NUM_CALLS);
+        printf("| JIT speedup:           %7.2fx\n", resolved_time / cached_time);
+    }
+
+    free_jit(env->jit);
+    free_env(env);
+    free_symbols();
+
+    return 0;
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void eval_line(const char *line, Env_t *env) {
+    TokenList *tok_l = tokenize(line, strlen(line));
+    ExprTree *tree = parse(tok_l);
+
+    free_expr_tree(eval(tree, env));
+    free_expr_tree(tree);
+    free_token_list(tok_l);
+}
+
+/* volatile sink keeps the calls from being optimized away */
+static volatile long int sink;
+
+static double bench_calls(Env_t *env, Value fun, int resolve) {
+    double start = now();
+    Value arg, result;
+    int i;
+
+    arg.type = INT_VALUE;
+    arg.node = NO_NODE;
+
+    for (i = 0; i < NUM_CALLS; i++) {
+        env->version += resolve;
+        arg.as.i = i;
+
+        if (call_fun(env, fun, &arg, 1, &result) != 0) {
+            fprintf(stderr, "call failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        sink = result.as.i;
+    }
+
+    return now() - start;
+}